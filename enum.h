@@ -39,8 +39,11 @@
  */
 
 #include "maps.h"
+#include "maps_static.h"
 #include "types/typeinfo.h"
+#include <array>
 #include <cassert>
+#include <cstdint>
 #include <functional>
 #include <ios>
 #include <iterator>
@@ -73,6 +76,51 @@ String get_name()
     return type_name;
 }
 
+#if defined(__GNUC__)
+#define TYPES_ENUM_STATIC_NAMES 1
+
+template<class EnumVal>
+constexpr const char* pretty_function()
+{
+  return __PRETTY_FUNCTION__;
+}
+
+//! get a name of enum value at compile time, the same as
+//! get_name() (parses "... [with EnumVal = ns::name]")
+template<class EnumVal>
+constexpr map::string_view static_name()
+{
+  const char* f = pretty_function<EnumVal>();
+  std::size_t first = 0;
+  while (!(f[first] == '=' && f[first + 1] == ' '))
+    ++first;
+  first += 2;
+
+  std::size_t last = first;
+  while (f[last] != 0)
+    ++last;
+  --last; // ']'
+
+  std::size_t name = first;
+  for (std::size_t i = first; i < last; ++i)
+    if (f[i] == ':')
+      name = i + 1;
+  return map::string_view(f + name, last - name);
+}
+#endif
+
+//! One static object per enum value, the objects of an enum are
+//! contiguous
+template<class... Vals>
+struct objects
+{
+  static const std::tuple<Vals...>& get()
+  {
+    static const std::tuple<Vals...> the_objects{};
+    return the_objects;
+  }
+};
+
 template<class Int, class Base>
 struct dict
 {
@@ -85,7 +133,7 @@ struct dict
 	using interval_size_type = marker::type<interval_size_marker, int_type>;
 	
   using dictionary = map::multi_way_object_indexer::type<
-		map::unordered_map,
+		map::flat_unordered_map,
 		map::deque,
 		int_type,
 		std::tuple<string, int_type>,
@@ -94,8 +142,15 @@ struct dict
 
 	using index_type = typename dictionary::index_marker_type;
 	
-	template<class Val>
+	template<class... Vals>
+	static const std::tuple<Vals...>& values()
+	{
+		return objects<Vals...>::get();
+	}
+
+	template<class Val, class Values>
 	static auto make_row(
+		const Values& values,
 		const std::string& name,
 		int_type idx,
 		interval_size_type interval_size
@@ -104,7 +159,7 @@ struct dict
     return std::make_tuple(
 			string::cast(name),
 			idx,
-			pointer_type{new Val}, // TODO make Val as static var
+			pointer_type{&std::get<Val>(values)},
 			interval_size
 		); 
 	}
@@ -140,15 +195,23 @@ struct dict<Int, void>
 	using interval_size_type = marker::type<interval_size_marker, int_type>;
 
   using dictionary = map::multi_way_object_indexer::type<
-		map::unordered_map,
+		map::flat_unordered_map,
 		map::deque,
 		int_type,
 		std::tuple<string, int_type>,
 	  std::tuple<interval_size_type>
 	>;
 
-	template<class Val>
+	// no objects without Base
+	template<class... Vals>
+	static std::nullptr_t values()
+	{
+		return nullptr;
+	}
+
+	template<class Val, class Values>
 	static auto make_row(
+		const Values&,
 		const std::string& name,
 		int_type idx,
 		interval_size_type interval_size
@@ -238,8 +301,8 @@ public:
   }
 
 protected:
-  template<class It>
-  static void fill_dict(It) 
+  template<class It, class Values>
+  static void fill_dict(It, const Values&) 
   {
   }
 };
@@ -283,19 +346,20 @@ public:
   }
 
 protected:
-  template<class It>
-  static void fill_dict(It it)
+  template<class It, class Values>
+  static void fill_dict(It it, const Values& values)
   {
 		using the_dict = dict<Int, Base>;
 		
 		*it++ = the_dict::template make_row<Val>(
+			values,
 			name(*(Val*)0),
 			n,
 			typename the_dict::interval_size_type(
 				the_range.second - the_range.first + 1
 			)
 		);
-		base::fill_dict(it);
+		base::fill_dict(it, values);
   }
 
   static constexpr Int meta_index(const Val&)
@@ -304,6 +368,87 @@ protected:
   }
 };
 
+//! The indexes and ranges of Vals as meta assigns them (a value
+//! without c() or range() gets the index preceding the next value),
+//! computed in one pass instead of an overload resolution per value
+template<class Int, class... Vals>
+struct layout
+{
+  map::impl_::static_array<Int, sizeof...(Vals) + 1> first, last;
+  std::intmax_t min, max;
+
+  constexpr layout() : first{}, last{}, min(0), max(0)
+  {
+    const bool defined[] = { false,
+      (enum_const_def<Vals, Int, 0>::range() == enum_const_def<Vals, Int, 1>::range())...
+    };
+    const std::pair<Int, Int> ranges[] = { std::pair<Int, Int>(),
+      enum_const_def<Vals, Int, 0>::range()...
+    };
+
+    Int next = enum_const_def<void, Int, sizeof...(Vals)>::index();
+    for (std::size_t k = sizeof...(Vals); k > 0; --k)
+    {
+      first[k - 1] = defined[k] ? ranges[k].first : next - 1;
+      last[k - 1] = defined[k] ? ranges[k].second : next - 1;
+      next = first[k - 1];
+    }
+
+    min = std::numeric_limits<Int>::max();
+    max = std::numeric_limits<Int>::min();
+    for (std::size_t k = 0; k < sizeof...(Vals); ++k)
+    {
+      if (first[k] < min)
+        min = first[k];
+      if (last[k] > max)
+        max = last[k];
+    }
+  }
+};
+
+//! The ranges of Vals sorted by their first indexes, the range
+//! containing an index is found by a binary search
+template<class Int, class... Vals>
+struct sorted_ranges
+{
+  map::impl_::static_array<Int, sizeof...(Vals) + 1> first, last;
+
+  constexpr sorted_ranges() : first{}, last{}
+  {
+    const layout<Int, Vals...> l{};
+
+    // insertion sort, linear for values in the ascending order
+    for (std::size_t k = 0; k < sizeof...(Vals); ++k)
+    {
+      std::size_t j = k;
+      for (; j > 0 && first[j - 1] > l.first[k]; --j)
+      {
+        first[j] = first[j - 1];
+        last[j] = last[j - 1];
+      }
+      first[j] = l.first[k];
+      last[j] = l.last[k];
+    }
+  }
+
+  //! the first index of the range containing i or not_found
+  constexpr Int range_first(std::intmax_t i, Int not_found) const
+  {
+    // the first range starting after i
+    std::size_t lo = 0;
+    std::size_t hi = sizeof...(Vals);
+    while (lo < hi)
+    {
+      const std::size_t mid = lo + (hi - lo) / 2;
+      if (first[mid] <= i)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    return (lo > 0 && i <= last[lo - 1]) ? first[lo - 1] : not_found;
+  }
+};
+
 static int xalloc()
 {
   static int xalloc_ = std::ios_base::xalloc();
@@ -348,12 +493,13 @@ public:
 		return dict_helper::range(dict(), i);
 	}
 	
+  // s is any string convertible to map::string_view, it is not copied
   template<int_type NotFound, class String>
   static int_type lookup(const String& s)
   {
     const auto& indexes = dict();
-    const auto it = indexes.find(dict_helper::string::cast(s));
-    return (it != indexes.end()) ? types::strip((*it).index(), NotFound) : NotFound;
+    const auto it = indexes.template find<typename dict_helper::string>(map::string_view(s));
+    return (it != indexes.end()) ? (*it).template by_type<const int_type>() : NotFound;
   }
 
 private:
@@ -366,9 +512,9 @@ private:
   static dictionary build_dictionary()
   {
     dictionary d;
-    // TODO d.reserve(sizeof...(Vals));
+    d.reserve(sizeof...(Vals));
     meta<Int, MaxRange, Base, sizeof...(Vals), Vals...>
-      ::fill_dict(map::back_inserter(d));
+      ::fill_dict(map::back_inserter(d), dict_helper::template values<Vals...>());
     return d;
   }
 };
@@ -409,20 +555,20 @@ public:
 	
 	type_with_base& assign(Int i)
 	{
-		idx = base::is_valid_index(i) ? i : bottom_idx();
+		idx = (range_first(i) == i) ? i : bottom_idx();
 		return *this;
 	}
 	
-  const std::string& name() const
+  // NB the view is to a static storage
+  map::string_view name() const
   {
     if (__builtin_expect(idx != bottom_idx(), 1))
     {
-        return base::name(idx);
+        return name_int(std::integral_constant<bool, static_names>());
     }
     else
     {
-        static std::string na = "<N/A>";
-        return na;
+        return map::string_view("<N/A>", 5);
     }
 	}
 
@@ -435,7 +581,8 @@ public:
 	{
     if (__builtin_expect(idx != bottom_idx(), 1))
     {
-			name = base::name(idx);
+			const map::string_view n = this->name();
+			name.assign(n.data(), n.size());
 			return true;
 		}
 		else
@@ -445,7 +592,15 @@ public:
   template<class String>
   void parse(const String& s)
   {
+#ifdef TYPES_ENUM_STATIC_NAMES
+    // a perfect hash of the names, built at compile time
+    static constexpr names_indexer names = make_indexer(std::index_sequence_for<Vals...>());
+
+    const Int* i = names.template find_object<Int>(map::string_view(s));
+    idx = i ? *i : bottom_idx();
+#else
     idx = base::template lookup<bottom_idx()>(s);
+#endif
   }
 
   constexpr bool operator==(const type_with_base& b) const
@@ -481,7 +636,7 @@ public:
 #else
 	const Base* object_ptr() const
 	{
-		return base::base_ptr(idx);
+		return object_ptr_int(std::integral_constant<bool, dense && !std::is_void<Base>::value>());
 	}
 #endif
 
@@ -495,10 +650,133 @@ public:
   Int idx;
 	//Base* base_ptr;
 
+  using layout_type = enum_::layout<Int, Vals...>;
+
+  static constexpr std::intmax_t min_index()
+  {
+    return layout_type().min;
+  }
+
+  // the last index of the ranges
+  static constexpr std::intmax_t max_index()
+  {
+    return layout_type().max;
+  }
+
+  // the names and the objects are in arrays indexed by idx - min_index()
+  // if the indexes are not too sparse
+  static constexpr bool dense = sizeof...(Vals) > 0
+    && max_index() - min_index() < 16 * (std::intmax_t) sizeof...(Vals) + 64;
+
+  static constexpr std::size_t dense_size = dense ? max_index() - min_index() + 1 : 1;
+
+  static std::array<const Base*, dense_size> make_object_ptrs()
+  {
+    constexpr layout_type l{};
+    const Base* ptrs[] = { &std::get<Vals>(enum_::objects<Vals...>::get())... };
+
+    std::array<const Base*, dense_size> res{};
+    for (std::size_t k = 0; k < sizeof...(Vals); ++k)
+      res[l.first[k] - l.min] = ptrs[k];
+    return res;
+  }
+
+  const Base* object_ptr_int(std::true_type) const
+  {
+    static const std::array<const Base*, dense_size> ptrs = make_object_ptrs();
+
+    const std::size_t k = static_cast<std::size_t>(idx - min_index());
+    return (k < dense_size) ? ptrs[k] : nullptr;
+  }
+
+  const Base* object_ptr_int(std::false_type) const
+  {
+    return base::base_ptr(idx);
+  }
+
+  // the first index of the range containing each index
+  static constexpr map::impl_::static_array<Int, dense_size> make_range_firsts()
+  {
+    const layout_type l{};
+    map::impl_::static_array<Int, dense_size> res{};
+    for (std::size_t i = 0; i < dense_size; ++i)
+      res[i] = bottom_idx();
+    for (std::size_t k = 0; k < sizeof...(Vals); ++k)
+      for (std::intmax_t i = l.first[k]; i <= l.last[k]; ++i)
+        res[i - l.min] = l.first[k];
+    return res;
+  }
+
+  // the range start of i or bottom_idx()
+  static Int range_first(Int i, std::true_type)
+  {
+    static constexpr map::impl_::static_array<Int, dense_size> firsts =
+      make_range_firsts();
+
+    const std::intmax_t k = (std::intmax_t) i - min_index();
+    return (k >= 0 && k < (std::intmax_t) dense_size) ? firsts[k] : bottom_idx();
+  }
+
+  // a binary search of the range for sparse indexes
+  static Int range_first(Int i, std::false_type)
+  {
+    static constexpr enum_::sorted_ranges<Int, Vals...> ranges{};
+
+    return ranges.range_first(i, bottom_idx());
+  }
+
+  static Int range_first(Int i)
+  {
+    return range_first(i, std::integral_constant<bool, dense>());
+  }
+
+#ifdef TYPES_ENUM_STATIC_NAMES
+  static constexpr bool static_names = dense;
+
+  using names_indexer = map::static_multi_way_indexer<
+    sizeof...(Vals),
+    std::tuple<map::string_view>,
+    std::tuple<Int>
+  >;
+
+  template<std::size_t... K>
+  static constexpr names_indexer make_indexer(std::index_sequence<K...>)
+  {
+    const layout_type l{};
+    return { std::make_tuple(enum_::static_name<Vals>(), l.first[K])... };
+  }
+
+  static constexpr map::impl_::static_array<map::string_view, dense_size> make_names()
+  {
+    const layout_type l{};
+    const map::string_view names[] = { map::string_view(), enum_::static_name<Vals>()... };
+    map::impl_::static_array<map::string_view, dense_size> res{};
+    for (std::size_t k = 0; k < sizeof...(Vals); ++k)
+      res[l.first[k] - l.min] = names[k + 1];
+    return res;
+  }
+
+  map::string_view name_int(std::true_type) const
+  {
+    static constexpr map::impl_::static_array<map::string_view, dense_size> names =
+      make_names();
+
+    const std::size_t k = static_cast<std::size_t>(idx - min_index());
+    assert(k < dense_size && !names[k].empty());
+    return names[k];
+  }
+#else
+  static constexpr bool static_names = false;
+#endif
+
+  map::string_view name_int(std::false_type) const
+  {
+    return base::name(idx);
+  }
+
 	bool in(Int first, Int i) const
 	{
-		const auto r = base::range(first);
-		return i >= r.first && i <= r.second;
+		return first != bottom_idx() && range_first(i) == first;
 	}
 
   // It is protected to allow safely build
@@ -506,15 +784,8 @@ public:
   // the type_with_base in different form
   // supported by public constructors
   // e.g. string, EnumVal type, enumerate etc.
-  explicit type_with_base(Int i) : idx(i)
+  explicit type_with_base(Int i) : idx(range_first(i))
 	{
-		for (Int cnt = 0;
-				 !base::is_valid_index(idx) && cnt < MaxRange;
-				 --idx, cnt++)
-			;	// search the start of the range
-
-		if (!base::is_valid_index(idx) || !in(idx, i))
-			idx = bottom_idx();
 	}
 };
 
@@ -643,7 +914,7 @@ public:
 			this->idx = i;
 	}
 
-  const std::string& name() const
+  map::string_view name() const
   {
 		return base{range_first_idx}.name();
 	}
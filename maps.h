@@ -3,21 +3,335 @@
 #include "tuple.h"
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <deque>
 #include <initializer_list>
 #include <iterator>
 #include <functional>
+#include <future>
+#include <limits>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
 #include <type_traits>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
+#include <vector>
+#if __cplusplus >= 201703L
+#include <memory_resource>
+#include <string_view>
+#else
+#include <experimental/memory_resource>
+#include <experimental/string_view>
+#endif
 
 // Contains classes which implement different types of associative colletions (maps)
 namespace map
 {
 
+#if __cplusplus >= 201703L
+using string_view = std::string_view;
+#else
+using string_view = std::experimental::string_view;
+#endif
+
+// Hints the processor to load the cache line of p, does nothing if the
+// compiler has no prefetch builtin
+inline void prefetch(const void* p) noexcept
+{
+#if defined(__GNUC__)
+	__builtin_prefetch(p);
+#else
+	(void) p;
+#endif
+}
+
+// the number of objects find_many() hashes and prefetches before probing
+constexpr std::size_t find_batch_size = 16;
+
+namespace impl_
+{
+
+template<class Map, class ForwardIt, class OutputIt>
+auto find_many(const Map& m, ForwardIt first, ForwardIt last, OutputIt out, int)
+	-> decltype(m.find_many(first, last, out))
+{
+	return m.find_many(first, last, out);
+}
+
+template<class Map, class ForwardIt, class OutputIt>
+OutputIt find_many(const Map& m, ForwardIt first, ForwardIt last, OutputIt out, long)
+{
+	for (; first != last; ++first)
+		*out++ = m.find(*first);
+	return out;
+}
+
+} // namespace impl_
+
+// Writes m.find() of each object of [first, last) to out, batched if the
+// map has find_many() (see basic_flat_unordered_map::find_many())
+template<class Map, class ForwardIt, class OutputIt>
+OutputIt find_many(const Map& m, ForwardIt first, ForwardIt last, OutputIt out)
+{
+	return impl_::find_many(m, first, last, out, 0);
+}
+
+// Writes the indexes of objects [first, last) found in an object -> index
+// map to out, IndexMarker{} (no value) for missing objects. Calls
+// observer(object, found) for each object.
+template<class IndexMarker, class Map, class ForwardIt, class OutputIt, class Observer>
+OutputIt find_indexes(const Map& m, ForwardIt first, ForwardIt last, OutputIt out, Observer observer)
+{
+	std::array<typename Map::const_iterator, find_batch_size> found;
+	while (first != last)
+	{
+		ForwardIt batch_last = first;
+		std::size_t n = 0;
+		for (; n < found.size() && batch_last != last; ++n)
+			++batch_last;
+
+		find_many(m, first, batch_last, found.begin());
+		for (std::size_t i = 0; first != batch_last; ++i, ++first)
+		{
+			const bool hit = found[i] != m.end();
+			observer(*first, hit);
+			*out++ = hit ? IndexMarker{found[i]->second} : IndexMarker{};
+		}
+	}
+	return out;
+}
+
+template<class IndexMarker, class Map, class ForwardIt, class OutputIt>
+OutputIt find_indexes(const Map& m, ForwardIt first, ForwardIt last, OutputIt out)
+{
+	return find_indexes<IndexMarker>(m, first, last, out, [](const auto&, bool) {});
+}
+
+// A lookup in an object -> index map which result is reused by the insert
+// on a miss: the probed slot for flat_unordered_map, the lower bound hint
+// for std::map. Other maps are searched again by emplace. With
+// CountProbes std::unordered_map is searched by a walk of the bucket
+// which counts the nodes.
+template<class Map, bool CountProbes = false, class Enable = void>
+struct single_probe
+{
+	using position = typename Map::iterator;
+
+	template<class K>
+	static position find(Map& m, const K& key)
+	{
+		return m.find(key);
+	}
+
+	template<class K>
+	static bool found(const Map& m, const position& p, const K&)
+	{
+		return p != m.end();
+	}
+
+	static typename Map::mapped_type mapped(const Map&, const position& p)
+	{
+		return p->second;
+	}
+
+	// the slots or nodes inspected by find(), see counted_find_as()
+	static std::size_t probes(const position&)
+	{
+		return 0;
+	}
+
+	template<class Ref>
+	static void emplace(Map& m, const position&, Ref&& ref, typename Map::mapped_type v)
+	{
+		m.emplace(std::forward<Ref>(ref), v);
+	}
+};
+
+// std::unordered_map, the bucket is walked to count its nodes
+template<class Map>
+struct single_probe<Map, true, types::void_t<typename Map::local_iterator>>
+{
+	struct position
+	{
+		typename Map::local_iterator it;
+		bool found;
+		std::size_t probes;
+	};
+
+	template<class K>
+	static position find(Map& m, const K& key)
+	{
+		const auto b = m.bucket(key);
+		position p{m.end(b), false, 0};
+		for (auto it = m.begin(b); it != m.end(b); ++it)
+		{
+			++p.probes;
+			if (m.key_eq()(it->first, key))
+				return position{it, true, p.probes};
+		}
+		return p;
+	}
+
+	template<class K>
+	static bool found(const Map&, const position& p, const K&)
+	{
+		return p.found;
+	}
+
+	static typename Map::mapped_type mapped(const Map&, const position& p)
+	{
+		return p.it->second;
+	}
+
+	static std::size_t probes(const position& p)
+	{
+		return p.probes;
+	}
+
+	template<class Ref>
+	static void emplace(Map& m, const position&, Ref&& ref, typename Map::mapped_type v)
+	{
+		m.emplace(std::forward<Ref>(ref), v);
+	}
+};
+
+template<class Map, bool CountProbes>
+struct single_probe<Map, CountProbes, types::void_t<typename Map::position>>
+{
+	using position = typename Map::position;
+
+	template<class K>
+	static position find(Map& m, const K& key)
+	{
+		return m.find_position(key);
+	}
+
+	template<class K>
+	static bool found(const Map&, const position& p, const K&)
+	{
+		return p.found;
+	}
+
+	static typename Map::mapped_type mapped(const Map& m, const position& p)
+	{
+		return m.iterator_at(p)->second;
+	}
+
+	static std::size_t probes(const position& p)
+	{
+		return p.probes;
+	}
+
+	template<class Ref>
+	static void emplace(Map& m, const position& p, Ref&&, typename Map::mapped_type v)
+	{
+		m.emplace_at(p, v);
+	}
+};
+
+template<class K, class V, class C, class A, bool CountProbes>
+struct single_probe<std::map<K, V, C, A>, CountProbes>
+{
+	using map_type = std::map<K, V, C, A>;
+	using position = typename map_type::iterator;
+
+	template<class Key>
+	static position find(map_type& m, const Key& key)
+	{
+		return m.lower_bound(key);
+	}
+
+	template<class Key>
+	static bool found(const map_type& m, const position& p, const Key& key)
+	{
+		return p != m.end() && !m.key_comp()(key, p->first);
+	}
+
+	static V mapped(const map_type&, const position& p)
+	{
+		return p->second;
+	}
+
+	static std::size_t probes(const position&)
+	{
+		return 0;
+	}
+
+	template<class Ref>
+	static void emplace(map_type& m, const position& p, Ref&& ref, V v)
+	{
+		m.emplace_hint(p, std::forward<Ref>(ref), v);
+	}
+};
+
+namespace impl_
+{
+
+// the position of the first of Ts which decays to T, sizeof...(Ts) if none
+template<class T, class... Ts>
+struct arg_position : std::integral_constant<std::size_t, 0> {};
+
+template<class T, class U, class... Ts>
+struct arg_position<T, U, Ts...> : std::integral_constant<
+	std::size_t,
+	std::is_same<T, std::decay_t<U>>::value ? 0 : 1 + arg_position<T, Ts...>::value
+> {};
+
+template<std::size_t I, class Column, class Args>
+void emplace_arg(Column& column, Args&& args, std::true_type)
+{
+	column.emplace_back(std::get<I>(std::forward<Args>(args)));
+}
+
+template<std::size_t I, class Column, class Args>
+void emplace_arg(Column& column, Args&&, std::false_type)
+{
+	column.emplace_back();
+}
+
+} // namespace impl_
+
+namespace impl_
+{
+
+template<class Column, class Args, std::size_t... I>
+void emplace_back_from_tuple(Column& column, Args&& args, std::index_sequence<I...>)
+{
+	(void) args; // no arguments
+	column.emplace_back(std::get<I>(std::forward<Args>(args))...);
+}
+
+} // namespace impl_
+
+// Appends an object constructed from the arguments tuple args (like
+// std::pair piecewise constructor) to the column
+template<class Column, class Args>
+void emplace_back_piecewise(Column& column, Args&& args)
+{
+	impl_::emplace_back_from_tuple(
+		column,
+		std::forward<Args>(args),
+		std::make_index_sequence<std::tuple_size<std::decay_t<Args>>::value>()
+	);
+}
+
+// Appends the argument of type T from the tuple of references args to the
+// column or a default T if there is none
+template<class T, class Column, class... Args>
+void emplace_arg(Column& column, std::tuple<Args...>&& args)
+{
+	constexpr std::size_t i = impl_::arg_position<T, Args...>::value;
+	impl_::emplace_arg<i>(column, std::move(args), std::integral_constant<bool, (i < sizeof...(Args))>());
+}
+
 // Object to index and index to object mapping
 namespace two_way_object_indexer
 {
@@ -435,6 +749,14 @@ public:
 		return begin() + it->second;
 	}
 
+	// Writes the indexes of objects [first, last) to out (no value for
+	// missing objects), see map::find_many()
+	template<class ForwardIt, class OutputIt>
+	OutputIt find_many(ForwardIt first, ForwardIt last, OutputIt out) const
+	{
+		return find_indexes<typename value_type::first_type>(_object2index, first, last, out);
+	}
+
 	reference operator[](typename value_type::first_type idx) const
 	{
 		auto it = find(idx);
@@ -499,110 +821,448 @@ void swap(type<O, I, O2I, I2O>& a, type<O, I, O2I, I2O>& b)
 
 } // namespace two_way_object_indexer
 
-namespace multi_way_object_indexer
+// false for Index2ObjectT which can move elements (see basic_cow_chunked_vector)
+template<class Index2Object>
+struct has_stable_elements : std::true_type {};
+
+// true if each Index2ObjectT of the Columns tuple has stable elements
+template<class Columns>
+struct has_stable_columns;
+
+template<class... Columns>
+struct has_stable_columns<std::tuple<Columns...>>
+	: std::is_same<
+		std::integer_sequence<bool, true, has_stable_elements<Columns>::value...>,
+		std::integer_sequence<bool, has_stable_elements<Columns>::value..., true>
+	>
+{};
+
+// An object -> index map which doesn't store objects itself should know
+// the index -> object column of the same indexer (see basic_flat_unordered_map).
+// Node based maps store references to objects and need nothing.
+template<class Object2Index, class Index2Object>
+void bind_column(Object2Index&, const Index2Object&)
 {
+	static_assert(
+		has_stable_elements<Index2Object>::value,
+		"The map keeps references to objects which can be moved by Index2ObjectT, "
+		"use flat_unordered_map or flat_map as Object2IndexT"
+	);
+}
 
+namespace impl_
+{
 
-/* the indexed multi-value container value_type */
-template<class Index, class ValTuple>
-class value_type
-	: public tuple::helper<ValTuple>::template prepend<marker::type<marker::index_marker, Index>>
+template<class Container>
+auto reserve(Container& c, std::size_t n, int) -> decltype(c.reserve(n), void())
 {
-	template<class _Index, class _ValTuple>
-	friend std::ostream& operator<<(std::ostream& out, const value_type<_Index, _ValTuple>& val);
-	
-	using index_value_type = Index;
-public:
-	using base = typename tuple::helper<ValTuple>::template prepend<marker::type<marker::index_marker, Index>>;
+	c.reserve(n);
+}
 
-	using index_marker_type = marker::type<marker::index_marker, Index>;
-	using value_tuple = ValTuple;
-	
-	// the default constructor constructs the "no value"
-	constexpr value_type() : value_type(index_marker_type{}) {}
+template<class Container>
+void reserve(Container&, std::size_t, long)
+{
+}
 
-	template<class... Ts>
-	value_type(std::tuple<Ts...>&& t)
-		: base(std::tuple_cat(std::make_tuple(index_marker_type{}), make_value_tuple(std::move(t))))
-	{}
-	
-	explicit value_type(const index_marker_type& idx)
-		: base(std::tuple_cat(std::make_tuple(idx), value_tuple()))
-	{}
+template<class Container>
+auto equal_allocators(const Container& a, const Container& b, int) -> decltype(bool(a.get_allocator() == b.get_allocator()))
+{
+	return a.get_allocator() == b.get_allocator();
+}
 
-	value_type(const index_marker_type& idx, const ValTuple& tup)
-		: base(std::tuple_cat(std::make_tuple(idx), tup))
-	{}
+template<class Container>
+bool equal_allocators(const Container&, const Container&, long)
+{
+	return true;
+}
 
-	value_type(const index_marker_type& idx, ValTuple&& tup)
-		: base(std::tuple_cat(std::make_tuple(idx), std::move(tup)))
-	{}
+template<class Tuple, std::size_t... I>
+bool equal_allocators(const Tuple& a, const Tuple& b, std::index_sequence<I...>)
+{
+	const bool equal[] = {true, equal_allocators(std::get<I>(a), std::get<I>(b), 0)...};
+	for (bool e : equal)
+		if (!e)
+			return false;
+	return true;
+}
 
-	// a value tuple doesn't contain index (and has no no_type).
-	template<class... Ts> 
-	static value_tuple make_value_tuple(std::tuple<Ts...>&& tup)
-	{
-		return tuple::helper<value_tuple>::expand(std::move(tup));
-	}
+// swaps containers with unequal allocators (which are not propagated)
+// by moving their elements
+template<class Tuple>
+void move_swap(Tuple& a, Tuple& b)
+{
+	Tuple tmp(std::move(a));
+	a = std::move(b);
+	b = std::move(tmp);
+}
 
-	value_tuple get_value_tuple() const
-	{
-		return tuple::helper<value_tuple>::select(
-			static_cast<const base&>(*this),
-			index_marker_type{}
-		);
-	}
-	
-	bool operator==(const value_type& o) const
-	{
-		if (is_no_value() || o.is_no_value())
-			return is_no_value() && o.is_no_value();
-		else 
-			return base::operator==(o);
-	}
+} // namespace impl_
 
-	index_marker_type index() const 
-	{
-		return index_marker_type{std::get<0>(*this)};
-	}
-	
-	static value_type no_value()
-	{
-		return value_type{};
-	}
+// False if a container of the tuple a has an allocator unequal to the one
+// of its pair in b (e.g. map::pmr containers of different memory
+// resources). A move assignment or a swap of them moves the elements
+// instead of the storage.
+template<class... Containers>
+bool equal_allocators(const std::tuple<Containers...>& a, const std::tuple<Containers...>& b)
+{
+	return impl_::equal_allocators(a, b, std::index_sequence_for<Containers...>());
+}
 
-	bool is_no_value() const
-	{
-		return index() == index_marker_type{}; /* || &base::second.get() == nullptr;*/
-	}
-};
+// reserve space in containers which support it (std::deque and std::map don't)
+template<class Container>
+void reserve_if_possible(Container& c, std::size_t n)
+{
+	impl_::reserve(c, n, 0);
+}
 
-template<class T>
-struct select_functor
+namespace impl_
 {
-	template<class DstTuple, class SrcTuple>
-	void operator()(DstTuple& dst, const SrcTuple& src) const
-	{
-		using helper = tuple::recursive_helper<SrcTuple, 0>;
-		std::get<T>(dst) = helper::template get_by_unref_type<T>(src);
-	}
-};
 
-template<class T>
-struct push_functor_2w
+template<class Object, class Map, class Key>
+auto find_as(Map& m, const Key& key, int) -> decltype(m.find(key))
 {
-	template<
-		class Index,
-		class object2index_tuple,
-		class index2object_tuple,
-		class value_tuple
-	>
-	void operator()(
-		object2index_tuple& o2i_tup,
-		index2object_tuple& i2o_tup,
-		value_tuple&& tup,
-		Index idx
-	) const
+	return m.find(key);
+}
+
+template<class Object, class Map, class Key>
+auto find_as(Map& m, const Key& key, long)
+{
+	const Object obj(key);
+	return m.find(obj);
+}
+
+} // namespace impl_
+
+// heterogeneous find if the map supports it, otherwise converts key to Object.
+// std::unordered_map supports it with __cpp_lib_generic_unordered_lookup
+// (C++20) for transparent hashers and key_equal, like ref_hash and
+// ref_equal_to of strings.
+template<class Object, class Map, class Key>
+auto find_as(Map& m, const Key& key)
+{
+	return impl_::find_as<Object>(m, key, 0);
+}
+
+namespace impl_
+{
+
+template<class Map, class Key>
+auto counted_find(const Map& m, const Key& key, typename Map::mapped_type& mapped, std::size_t& probes, int)
+	-> decltype(m.counted_find(key, probes), bool())
+{
+	const auto it = m.counted_find(key, probes);
+	if (it == m.end())
+		return false;
+
+	mapped = it->second;
+	return true;
+}
+
+// the bucket is walked instead of find() to count its nodes
+template<class Map, class Key>
+auto counted_find(const Map& m, const Key& key, typename Map::mapped_type& mapped, std::size_t& probes, long)
+	-> decltype(m.bucket(key), bool())
+{
+	const auto b = m.bucket(key);
+	for (auto it = m.begin(b); it != m.end(b); ++it)
+	{
+		++probes;
+		if (m.key_eq()(it->first, key))
+		{
+			mapped = it->second;
+			return true;
+		}
+	}
+	return false;
+}
+
+template<class Map, class Key>
+bool counted_find(const Map& m, const Key& key, typename Map::mapped_type& mapped, std::size_t&, ...)
+{
+	const auto it = m.find(key);
+	if (it == m.end())
+		return false;
+
+	mapped = it->second;
+	return true;
+}
+
+template<class Object, class Map, class Key>
+auto counted_find_as(const Map& m, const Key& key, typename Map::mapped_type& mapped, std::size_t& probes, int)
+	-> decltype(m.find(key), bool())
+{
+	return counted_find(m, key, mapped, probes, 0);
+}
+
+template<class Object, class Map, class Key>
+bool counted_find_as(const Map& m, const Key& key, typename Map::mapped_type& mapped, std::size_t& probes, long)
+{
+	const Object obj(key);
+	return counted_find(m, obj, mapped, probes, 0);
+}
+
+} // namespace impl_
+
+// One lookup of key (see find_as()) which writes the mapped value of a
+// found key to mapped and adds the number of slots (flat_unordered_map)
+// or bucket nodes (std::unordered_map) it inspects to probes, nothing for
+// other maps. Returns true if key is found.
+template<class Object, class Map, class Key>
+bool counted_find_as(const Map& m, const Key& key, typename Map::mapped_type& mapped, std::size_t& probes)
+{
+	return impl_::counted_find_as<Object>(m, key, mapped, probes, 0);
+}
+
+// A set of row indexes (a bitmap) returned by column scans
+class selection
+{
+public:
+	selection() = default;
+
+	explicit selection(std::size_t n) : _bits((n + 63) / 64), _size(n) {}
+
+	// the number of rows covered
+	std::size_t size() const noexcept
+	{
+		return _size;
+	}
+
+	// the number of rows selected
+	std::size_t count() const noexcept
+	{
+		std::size_t c = 0;
+		for (std::uint64_t w : _bits)
+			c += __builtin_popcountll(w);
+		return c;
+	}
+
+	bool test(std::size_t idx) const noexcept
+	{
+		assert(idx < _size);
+		return (_bits[idx >> 6] >> (idx & 63)) & 1;
+	}
+
+	void set(std::size_t idx) noexcept
+	{
+		assert(idx < _size);
+		_bits[idx >> 6] |= std::uint64_t(1) << (idx & 63);
+	}
+
+	void reset(std::size_t idx) noexcept
+	{
+		assert(idx < _size);
+		_bits[idx >> 6] &= ~(std::uint64_t(1) << (idx & 63));
+	}
+
+	selection& operator&=(const selection& o) noexcept
+	{
+		assert(_size == o._size);
+		for (std::size_t k = 0; k < _bits.size(); ++k)
+			_bits[k] &= o._bits[k];
+		return *this;
+	}
+
+	selection& operator|=(const selection& o) noexcept
+	{
+		assert(_size == o._size);
+		for (std::size_t k = 0; k < _bits.size(); ++k)
+			_bits[k] |= o._bits[k];
+		return *this;
+	}
+
+	// calls f(idx) for each selected row in the index order
+	template<class F>
+	void for_each(F f) const
+	{
+		for (std::size_t k = 0; k < _bits.size(); ++k)
+			for (std::uint64_t w = _bits[k]; w != 0; w &= w - 1)
+				f((k << 6) + __builtin_ctzll(w));
+	}
+
+	std::vector<std::size_t> indexes() const
+	{
+		std::vector<std::size_t> res;
+		res.reserve(count());
+		for_each([&res](std::size_t idx) { res.push_back(idx); });
+		return res;
+	}
+
+	// 64 rows per word, the row idx is the bit idx & 63 of the word idx >> 6
+	std::uint64_t* words() noexcept
+	{
+		return _bits.data();
+	}
+
+	const std::uint64_t* words() const noexcept
+	{
+		return _bits.data();
+	}
+
+private:
+	std::vector<std::uint64_t> _bits;
+	std::size_t _size = 0;
+};
+
+namespace impl_
+{
+
+// Evaluates pred for len <= 64 elements starting from it (and advances
+// it). The comparisons are stored in a byte array first, it makes the
+// loop vectorizable for arithmetic (and fixed_t) elements in a
+// contiguous memory.
+template<class It, class Pred>
+std::uint64_t scan_word(It& it, std::size_t len, Pred& pred)
+{
+	assert(len <= 64);
+	unsigned char m[64] = {};
+	for (std::size_t k = 0; k < len; ++k, ++it)
+		m[k] = (bool) pred(*it);
+
+	std::uint64_t w = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	// pack 8 bytes of 0/1 into 8 bits by one multiplication
+	for (unsigned k = 0; k < 8; ++k)
+	{
+		std::uint64_t x;
+		std::memcpy(&x, m + 8 * k, 8);
+		w |= ((x * 0x0102040810204080ull) >> 56) << (8 * k);
+	}
+#else
+	for (unsigned k = 0; k < 64; ++k)
+		w |= std::uint64_t(m[k]) << k;
+#endif
+	return w;
+}
+
+// 32 bits of the hash used by the flat hash tables, never 0 (0 marks an
+// empty slot), the slot position is fragment >> (32 - log2(slots))
+template<class Hasher, class Object>
+std::uint32_t hash_fragment(const Object& obj)
+{
+	// fibonacci hashing, std::hash of integers is identity
+	const std::uint64_t h = static_cast<std::uint64_t>(Hasher()(obj)) * 0x9E3779B97F4A7C15ull;
+	const std::uint32_t frag = static_cast<std::uint32_t>(h >> 32);
+	return (frag != 0) ? frag : 1;
+}
+
+} // namespace impl_
+
+// Sets bits[idx] = pred(column[idx]) for idx < n (bits should have
+// (n + 63) / 64 words). Contiguous columns have their own overloads
+// (see basic_chunked_vector).
+template<class Index2Object, class Pred>
+void scan_column(const Index2Object& column, std::size_t n, Pred& pred, std::uint64_t* bits)
+{
+	assert(n <= column.size());
+	auto it = column.begin();
+	for (std::size_t first = 0; first < n; first += 64)
+		*bits++ = impl_::scan_word(it, std::min<std::size_t>(64, n - first), pred);
+}
+
+namespace multi_way_object_indexer
+{
+
+
+/* the indexed multi-value container value_type */
+template<class Index, class ValTuple>
+class value_type
+	: public tuple::helper<ValTuple>::template prepend<marker::type<marker::index_marker, Index>>
+{
+	template<class _Index, class _ValTuple>
+	friend std::ostream& operator<<(std::ostream& out, const value_type<_Index, _ValTuple>& val);
+	
+	using index_value_type = Index;
+public:
+	using base = typename tuple::helper<ValTuple>::template prepend<marker::type<marker::index_marker, Index>>;
+
+	using index_marker_type = marker::type<marker::index_marker, Index>;
+	using value_tuple = ValTuple;
+	
+	// the default constructor constructs the "no value"
+	constexpr value_type() : value_type(index_marker_type{}) {}
+
+	template<class... Ts>
+	value_type(std::tuple<Ts...>&& t)
+		: base(std::tuple_cat(std::make_tuple(index_marker_type{}), make_value_tuple(std::move(t))))
+	{}
+	
+	explicit value_type(const index_marker_type& idx)
+		: base(std::tuple_cat(std::make_tuple(idx), value_tuple()))
+	{}
+
+	value_type(const index_marker_type& idx, const ValTuple& tup)
+		: base(std::tuple_cat(std::make_tuple(idx), tup))
+	{}
+
+	value_type(const index_marker_type& idx, ValTuple&& tup)
+		: base(std::tuple_cat(std::make_tuple(idx), std::move(tup)))
+	{}
+
+	// a value tuple doesn't contain index (and has no no_type).
+	template<class... Ts> 
+	static value_tuple make_value_tuple(std::tuple<Ts...>&& tup)
+	{
+		return tuple::helper<value_tuple>::expand(std::move(tup));
+	}
+
+	value_tuple get_value_tuple() const
+	{
+		return tuple::helper<value_tuple>::select(
+			static_cast<const base&>(*this),
+			index_marker_type{}
+		);
+	}
+	
+	bool operator==(const value_type& o) const
+	{
+		if (is_no_value() || o.is_no_value())
+			return is_no_value() && o.is_no_value();
+		else 
+			return base::operator==(o);
+	}
+
+	index_marker_type index() const 
+	{
+		return index_marker_type{std::get<0>(*this)};
+	}
+	
+	static value_type no_value()
+	{
+		return value_type{};
+	}
+
+	bool is_no_value() const
+	{
+		return index() == index_marker_type{}; /* || &base::second.get() == nullptr;*/
+	}
+};
+
+template<class T>
+struct select_functor
+{
+	template<class DstTuple, class SrcTuple>
+	void operator()(DstTuple& dst, const SrcTuple& src) const
+	{
+		using helper = tuple::recursive_helper<SrcTuple, 0>;
+		std::get<T>(dst) = helper::template get_by_unref_type<T>(src);
+	}
+};
+
+template<class T>
+struct push_functor_2w
+{
+	template<
+		class Index,
+		class object2index_tuple,
+		class index2object_tuple,
+		class value_tuple
+	>
+	void operator()(
+		object2index_tuple& o2i_tup,
+		index2object_tuple& i2o_tup,
+		value_tuple&& tup,
+		Index idx
+	) const
 	{
 		auto& o2i = std::get<
 			tuple::container_idx_from_tuple<0, object2index_tuple, T>::value
@@ -646,91 +1306,207 @@ struct push_functor_1w
 	}
 };
 
+// push_functor_2w from a tuple of references (see emplace_arg()), the
+// object of type Key is left for the caller to insert to its o2i map
 template<class T>
-struct rewrite_functor_2w
+struct emplace_functor_2w
 {
 	template<
 		class Index,
 		class object2index_tuple,
 		class index2object_tuple,
-		class value_tuple
+		class Args,
+		class Key
 	>
 	void operator()(
 		object2index_tuple& o2i_tup,
 		index2object_tuple& i2o_tup,
-		value_tuple&& tup,
-		Index idx
+		Args&& args,
+		Index idx,
+		const Key*
 	) const
 	{
-		auto& o2i = std::get<
-			tuple::container_idx_from_tuple<0, object2index_tuple, T>::value
-		>(o2i_tup);
-		
 		auto& i2o = std::get<
 			tuple::container_idx_from_tuple<
 				0,
 				index2object_tuple,
 				std::reference_wrapper<const T>>::value
 		>(i2o_tup);
-				
-		auto& ref = i2o.at(idx);
-		ref = std::get<T>(std::forward<value_tuple>(tup));
 
-		o2i.emplace(ref, idx);
-	  // NB: ignore the result of this insertion		
+		emplace_arg<T>(i2o, std::forward<Args>(args));
+		assert((std::size_t)idx == i2o.size() - 1);
+
+		if (!std::is_same<T, Key>::value)
+		{
+			auto& o2i = std::get<
+				tuple::container_idx_from_tuple<0, object2index_tuple, T>::value
+			>(o2i_tup);
+			o2i.emplace(i2o.back(), idx);
+		}
 	}
 };
 
-#if 0 // the proper implementation is under protect<> below
+// push_functor_2w constructing the object in place from the arguments
+// tuple of its column (see emplace_back_piecewise())
 template<class T>
-struct rewrite_functor_1w
+struct piecewise_functor_2w
 {
 	template<
 		class Index,
+		class object2index_tuple,
 		class index2object_tuple,
-		class value_tuple
+		class ArgsTuples
 	>
 	void operator()(
+		object2index_tuple& o2i_tup,
 		index2object_tuple& i2o_tup,
-		value_tuple&& tup,
+		ArgsTuples&& argss,
 		Index idx
 	) const
 	{
-		auto& i2o = std::get<
-			tuple::container_idx_from_tuple<0, index2object_tuple, T>::value
-		>(i2o_tup);
+		constexpr std::size_t column = tuple::container_idx_from_tuple<
+			0,
+			index2object_tuple,
+			std::reference_wrapper<const T>
+		>::value;
+		auto& o2i = std::get<
+			tuple::container_idx_from_tuple<0, object2index_tuple, T>::value
+		>(o2i_tup);
+		auto& i2o = std::get<column>(i2o_tup);
 
-		i2o.at(idx) = std::get<T>(std::forward<value_tuple>(tup));
+		emplace_back_piecewise(i2o, std::get<column>(std::forward<ArgsTuples>(argss)));
+		assert((std::size_t)idx == i2o.size() - 1);
+
+		o2i.emplace(i2o.back(), idx);
+	  // NB: ignore the result of this insertion		
 	}
 };
-#endif
-
-template<class TwoWayObjects>
-struct protect // protect from imroper instantiation
-{
 
+// push_functor_1w constructing the object in place (see
+// piecewise_functor_2w)
 template<class T>
-struct rewrite_functor_1w
+struct piecewise_functor_1w
 {
-	static_assert(
-		!tuple::among_tuple_types<types::remove_cvref_t<T>, TwoWayObjects>::value,
-		"don't partially update 2 way-objects - the full row must be updated in this case"
-	);
-		
 	template<
 		class Index,
 		class index2object_tuple,
-		class value_tuple
+		class ArgsTuples
 	>
-	void operator()(index2object_tuple& i2o_tup, value_tuple&& tup, Index idx) const
+	void operator()(index2object_tuple& i2o_tup, ArgsTuples&& argss, Index idx) const
 	{
-		typename Index::value_type idx_int;
-		if (!types::get_value(idx, idx_int))
-			return;
-		
-		auto& i2o = std::get<
-			tuple::container_idx_from_tuple<0, index2object_tuple, types::remove_cvref_t<T>>::value
-		>(i2o_tup);
+		constexpr std::size_t column = tuple::container_idx_from_tuple<0, index2object_tuple, T>::value;
+		auto& i2o = std::get<column>(i2o_tup);
+
+		emplace_back_piecewise(i2o, std::get<column>(std::forward<ArgsTuples>(argss)));
+		assert((std::size_t)idx == i2o.size() - 1);
+	}
+};
+
+// push_functor_1w from a tuple of references (see emplace_arg())
+template<class T>
+struct emplace_functor_1w
+{
+	template<
+		class Index,
+		class index2object_tuple,
+		class Args
+	>
+	void operator()(index2object_tuple& i2o_tup, Args&& args, Index idx) const
+	{
+		auto& i2o = std::get<
+			tuple::container_idx_from_tuple<0, index2object_tuple, T>::value
+		>(i2o_tup);
+
+		emplace_arg<T>(i2o, std::forward<Args>(args));
+		assert((std::size_t)idx == i2o.size() - 1);
+	}
+};
+
+template<class T>
+struct rewrite_functor_2w
+{
+	template<
+		class Index,
+		class object2index_tuple,
+		class index2object_tuple,
+		class value_tuple
+	>
+	void operator()(
+		object2index_tuple& o2i_tup,
+		index2object_tuple& i2o_tup,
+		value_tuple&& tup,
+		Index idx
+	) const
+	{
+		auto& o2i = std::get<
+			tuple::container_idx_from_tuple<0, object2index_tuple, T>::value
+		>(o2i_tup);
+		
+		auto& i2o = std::get<
+			tuple::container_idx_from_tuple<
+				0,
+				index2object_tuple,
+				std::reference_wrapper<const T>>::value
+		>(i2o_tup);
+				
+		auto& ref = i2o.at(idx);
+		ref = std::get<T>(std::forward<value_tuple>(tup));
+
+		o2i.emplace(ref, idx);
+	  // NB: ignore the result of this insertion		
+	}
+};
+
+#if 0 // the proper implementation is under protect<> below
+template<class T>
+struct rewrite_functor_1w
+{
+	template<
+		class Index,
+		class index2object_tuple,
+		class value_tuple
+	>
+	void operator()(
+		index2object_tuple& i2o_tup,
+		value_tuple&& tup,
+		Index idx
+	) const
+	{
+		auto& i2o = std::get<
+			tuple::container_idx_from_tuple<0, index2object_tuple, T>::value
+		>(i2o_tup);
+
+		i2o.at(idx) = std::get<T>(std::forward<value_tuple>(tup));
+	}
+};
+#endif
+
+template<class TwoWayObjects>
+struct protect // protect from imroper instantiation
+{
+
+template<class T>
+struct rewrite_functor_1w
+{
+	static_assert(
+		!tuple::among_tuple_types<types::remove_cvref_t<T>, TwoWayObjects>::value,
+		"don't partially update 2 way-objects - the full row must be updated in this case"
+	);
+		
+	template<
+		class Index,
+		class index2object_tuple,
+		class value_tuple
+	>
+	void operator()(index2object_tuple& i2o_tup, value_tuple&& tup, Index idx) const
+	{
+		typename Index::value_type idx_int;
+		if (!types::get_value(idx, idx_int))
+			return;
+		
+		auto& i2o = std::get<
+			tuple::container_idx_from_tuple<0, index2object_tuple, types::remove_cvref_t<T>>::value
+		>(i2o_tup);
 
 		i2o.at(idx_int) = tuple::recursive_helper<value_tuple, 0>::template get_by_unref_type<T>(std::forward<value_tuple>(tup));
 	}
@@ -785,6 +1561,73 @@ struct erase_functor_1w
 	}
 };
 
+// moves the row `from` to the (erased) row `to`, the key reference is moved too
+template<class T>
+struct move_row_functor_2w
+{
+	template<
+		class Index,
+		class object2index_tuple,
+		class index2object_tuple
+	>
+	void operator()(object2index_tuple& o2i_tup, index2object_tuple& i2o_tup, Index from, Index to) const
+	{
+		auto& o2i = std::get<tuple::container_idx_from_tuple<0, object2index_tuple, T>::value>(o2i_tup);
+		auto& i2o = std::get<
+			tuple::container_idx_from_tuple<0, index2object_tuple, std::reference_wrapper<const T>>::value
+		>(i2o_tup);
+
+		// NB a row superseded by push_back_as_update has no key
+		bool indexed = false;
+		const auto range = o2i.equal_range(i2o[from]);
+		for (auto it = range.first; it != range.second; ++it)
+		{
+			if (&it->first.get() == &i2o[from])
+			{
+				o2i.erase(it);
+				indexed = true;
+				break;
+			}
+		}
+
+		i2o[to] = std::move(i2o[from]);
+		if (indexed)
+			o2i.emplace(i2o[to], to);
+	}
+};
+
+template<class T>
+struct move_row_functor_1w
+{
+	template<
+		class Index,
+		class index2object_tuple
+	>
+	void operator()(index2object_tuple& i2o_tup, Index from, Index to) const
+	{
+		auto& i2o = std::get<
+			tuple::container_idx_from_tuple<0, index2object_tuple, std::reference_wrapper<const T>>::value
+		>(i2o_tup);
+
+		i2o[to] = std::move(i2o[from]);
+	}
+};
+
+template<class T>
+struct truncate_functor
+{
+	template<class index2object_tuple>
+	void operator()(index2object_tuple& i2o_tup, std::size_t n) const
+	{
+		auto& i2o = std::get<
+			tuple::container_idx_from_tuple<0, index2object_tuple, std::reference_wrapper<const T>>::value
+		>(i2o_tup);
+
+		while (i2o.size() > n)
+			i2o.pop_back();
+	}
+};
+
 template<class T>
 struct update_keys_functor_2w
 {
@@ -808,1764 +1651,5709 @@ struct update_keys_functor_2w
 		const auto& old_key = i2o.at(old_idx);
 		const auto& new_key = i2o.at(new_idx);
 
-		const auto old_it = o2i.find(old_key);
-		assert(old_it != o2i.end());
-
-		if (old_key == new_key)
-			o2i.emplace_hint(old_it, new_key, new_idx); // NB use the hint
-		else
-			o2i.emplace(new_key, new_idx);
-
-		// NB remove the old key only after the hint was used
-		o2i.erase(old_it);
+		// NB the old key is removed first, the new one is usually equal
+		// to it and wouldn't be inserted to a unique map
+		const auto range = o2i.equal_range(old_key);
+		for (auto it = range.first; it != range.second; ++it)
+		{
+			if (&it->first.get() == &old_key)
+			{
+				o2i.erase(it);
+				break;
+			}
+		}
+		o2i.emplace(new_key, new_idx);
 	}
 };
 
-namespace thread_safe
+// rewrites the object of the row idx, i2o only
+template<class T>
+struct assign_functor
 {
+	template<
+		class Index,
+		class index2object_tuple,
+		class value_tuple
+	>
+	void operator()(index2object_tuple& i2o_tup, value_tuple&& tup, Index idx) const
+	{
+		auto& i2o = std::get<
+			tuple::container_idx_from_tuple<0, index2object_tuple, T>::value
+		>(i2o_tup);
 
-template<
-	template<class, class> class Object2IndexT,
-	template<class> class Index2ObjectT,
-	class Index,
-	class TwoWayObjects,
-	class OneWayObjects,
-	class Mutex
->
-class type;
+		i2o.at(idx) = std::get<T>(std::forward<value_tuple>(tup));
+	}
+};
 
-template<class Index, class RefTuple, class ValTuple>
-class reference_type
-	: protected tuple::helper<RefTuple>::template prepend<marker::type<marker::index_marker, Index>>
+template<class T>
+struct reserve_functor_2w
 {
 	template<
-		template<class, class> class _Object2IndexT,
-		template<class> class _Index2ObjectT,
-		class _Index,
-		class _TwoWayObjects,
-		class _OneWayObjects,
-		class _Mutex
+		class object2index_tuple,
+		class index2object_tuple
 	>
-	friend class multi_way_object_indexer::thread_safe::type;
-
-	using base = typename tuple::helper<RefTuple>::template prepend<marker::type<marker::index_marker, Index>>;
-
-	template<class _Index, class _RefTuple, class _ValTuple>
-	friend std::ostream& operator<<(std::ostream& out, const reference_type<_Index, _RefTuple, _ValTuple>& val);
-	
-	using index_value_type = Index;
-
-public:
-	reference_type() : reference_type(index_marker_type{}, tuple::helper<RefTuple>::zero_ref_tuple()) {}
-	
-	reference_type(const reference_type&) = delete;
-
-	reference_type(reference_type&&) = default;
-	
-	using index_marker_type = marker::type<marker::index_marker, Index>;
-	
-	explicit reference_type(const index_marker_type& idx, const RefTuple& tup)
-		: base(std::tuple_cat(std::make_tuple(idx), tup))
-	{}
-
-	reference_type& operator=(const reference_type&) = delete;
-	
-	reference_type& operator=(reference_type&&) = default;
-	
-	operator value_type<Index, ValTuple>() const
+	void operator()(object2index_tuple& o2i_tup, index2object_tuple& i2o_tup, std::size_t n) const
 	{
-		using v_type = value_type<Index, ValTuple>;
-		
-		return v_type(this->index(), tuple::helper<typename v_type::base>::copy(*this));
-	}
-	
-	bool operator==(const reference_type& o) const
-	{
-		if (this->is_no_value() || o.is_no_value())
-			return this->is_no_value() && o.is_no_value();
-		else 
-			return tuple::helper<base>::comparator::equal(*this, o);
-	}
+		auto& o2i = std::get<tuple::container_idx_from_tuple<0, object2index_tuple, T>::value>(o2i_tup);
+		auto& i2o = std::get<
+			tuple::container_idx_from_tuple<0, index2object_tuple, std::reference_wrapper<const T>>::value
+		>(i2o_tup);
 
-	// TODO left val, right ref
-	bool operator==(const value_type<Index, ValTuple>& o) const
-	{
-		using val_type = value_type<Index, ValTuple>;
-		
-		if (this->is_no_value() || o.is_no_value())
-			return this->is_no_value() && o.is_no_value();
-		else 
-			return tuple::comparator<base, typename val_type::base, 0>::equal(static_cast<const base& >(*this), static_cast<const typename val_type::base& >(o));
+		reserve_if_possible(i2o, n);
+		reserve_if_possible(o2i, n);
 	}
+};
 
-	index_marker_type index() const 
+template<class T>
+struct reserve_functor_1w
+{
+	template<class index2object_tuple>
+	void operator()(index2object_tuple& i2o_tup, std::size_t n) const
 	{
-		return index_marker_type{std::get<0>(*this)};
+		auto& i2o = std::get<tuple::container_idx_from_tuple<0, index2object_tuple, T>::value>(i2o_tup);
+
+		reserve_if_possible(i2o, n);
 	}
+};
 
+// true if each type of the Row tuple is a type of ValTuple (see value_type::make_value_tuple)
+template<class Row, class ValTuple>
+struct row_fits {};
+
+template<class Row, class... Vs>
+struct row_fits<Row, std::tuple<Vs...>>
+	: std::integral_constant<
+		bool,
+		tuple::recursive_helper<
+			tuple::type_mod_for_each_t<types::remove_cvref_t<Row>, std::decay>,
+			0
+		>::template each_among_types<Vs...>()
+	>
+{};
+
+// Fills a column (and its o2i map) from the range of row tuples.
+// The work is started by std::async(policy, ...), the future is appended to futures
+template<class T>
+struct bulk_push_functor_2w
+{
 	template<
-		class T,
-		typename std::enable_if<!std::is_const<T>::value, bool>::type = false
+		class Index,
+		class object2index_tuple,
+		class index2object_tuple,
+		class It
 	>
-	T& by_type()
+	void operator()(
+		object2index_tuple& o2i_tup,
+		index2object_tuple& i2o_tup,
+		It first,
+		It last,
+		Index start_idx,
+		std::launch policy,
+		std::vector<std::future<void>>& futures
+	) const
 	{
-		return tuple::recursive_helper<base, 0>::template get_by_unref_type<T>(static_cast<base&>(*this));
+		auto& o2i = std::get<
+			tuple::container_idx_from_tuple<0, object2index_tuple, T>::value
+		>(o2i_tup);
+		
+		auto& i2o = std::get<
+			tuple::container_idx_from_tuple<
+				0,
+				index2object_tuple,
+				std::reference_wrapper<const T>>::value
+		>(i2o_tup);
+
+		futures.push_back(std::async(policy, [&o2i, &i2o, first, last, start_idx]() {
+			using row_type = types::remove_cvref_t<decltype(*first)>;
+			using helper = tuple::recursive_helper<tuple::type_mod_for_each_t<row_type, std::decay>, 0>;
+
+			for (It it = first; it != last; ++it)
+				i2o.emplace_back(helper::template get_or_default<T>(*it));
+
+			reserve_if_possible(o2i, o2i.size() + (i2o.size() - start_idx));
+			for (std::size_t idx = start_idx; idx < i2o.size(); ++idx)
+				o2i.emplace(i2o[idx], (Index) idx);
+			// NB: ignore the result of this insertion
+		}));
 	}
+};
 
+template<class T>
+struct bulk_push_functor_1w
+{
 	template<
-		class T
+		class index2object_tuple,
+		class It
 	>
-	const T& by_type() const
+	void operator()(
+		index2object_tuple& i2o_tup,
+		It first,
+		It last,
+		std::launch policy,
+		std::vector<std::future<void>>& futures
+	) const
 	{
-		return tuple::recursive_helper<base, 0>::template get_by_unref_type<T>(static_cast<const base&>(*this));
-	}
+		auto& i2o = std::get<
+			tuple::container_idx_from_tuple<0, index2object_tuple, T>::value
+		>(i2o_tup);
 
-	static reference_type no_value()
-	{
-		return reference_type{};
-	}
+		futures.push_back(std::async(policy, [&i2o, first, last]() {
+			using row_type = types::remove_cvref_t<decltype(*first)>;
+			using helper = tuple::recursive_helper<tuple::type_mod_for_each_t<row_type, std::decay>, 0>;
 
-	bool is_no_value() const
-	{
-		return index() == index_marker_type{}; /* || &base::second.get() == nullptr;*/
+			for (It it = first; it != last; ++it)
+				i2o.emplace_back(helper::template get_or_default<T>(*it));
+		}));
 	}
 };
 
-template<class Index, class ValTuple>
-std::ostream& operator<<(std::ostream& out, const value_type<Index, ValTuple>& val)
+template<class T>
+struct bind_functor_2w
 {
-	using val_type = value_type<Index, ValTuple>;
-	using tuple_type = typename val_type::base;
-	
-	out << "value_type{";
-	tuple::recursive_helper<tuple_type, 0>::out(out, (const tuple_type&)val);
-	out << '}';
-	return out;
-}
+	template<
+		class object2index_tuple,
+		class index2object_tuple
+	>
+	void operator()(object2index_tuple& o2i_tup, const index2object_tuple& i2o_tup) const
+	{
+		auto& o2i = std::get<tuple::container_idx_from_tuple<0, object2index_tuple, T>::value>(o2i_tup);
+		const auto& i2o = std::get<
+			tuple::container_idx_from_tuple<0, index2object_tuple, std::reference_wrapper<const T>>::value
+		>(i2o_tup);
 
-template<class Index, class RefTuple, class ValTuple>
-std::ostream& operator<<(std::ostream& out, const reference_type<Index, RefTuple, ValTuple>& val)
-{
-	using ref_type = reference_type<Index, RefTuple, ValTuple>;
-	using tuple_type = typename ref_type::base;
-	
-	out << "value_type{";
-	tuple::recursive_helper<tuple_type, 0>::out(out, (const tuple_type&)val);
-	out << '}';
-	return out;
-}
+		bind_column(o2i, i2o);
+	}
+};
 
-template<class Index, class Index2ObjectsTuple, class Mutex>
-class iterator
+// Rebuilds the o2i map of T after its column moved the elements (a map
+// keeps references to them). The same indexes as before are indexed.
+template<class T>
+struct reindex_functor_2w
 {
 	template<
-		template<class, class> class _Object2IndexT,
-		template<class> class _Index2ObjectT,
-		class _Index,
-		class _TwoWayObjects,
-		class _OneWayObjects,
-		class _Mutex
+		class object2index_tuple,
+		class index2object_tuple
 	>
-	friend class multi_way_object_indexer::thread_safe::type;
+	void operator()(object2index_tuple& o2i_tup, const index2object_tuple& i2o_tup) const
+	{
+		auto& o2i = std::get<tuple::container_idx_from_tuple<0, object2index_tuple, T>::value>(o2i_tup);
+		const auto& i2o = std::get<
+			tuple::container_idx_from_tuple<0, index2object_tuple, std::reference_wrapper<const T>>::value
+		>(i2o_tup);
 
-	using index_type = Index;
-	using index_marker_type = marker::type<marker::index_marker, Index>;
-	using index2object = Index2ObjectsTuple;
-	using unique_lock = std::unique_lock<Mutex>;
+		using index_type = typename std::decay_t<decltype(o2i)>::mapped_type;
+		std::vector<index_type> indexes;
+		indexes.reserve(o2i.size());
+		for (auto it = o2i.begin(); it != o2i.end(); ++it)
+			indexes.push_back(it->second); // the keys may dangle
 
-	index2object* _i2o;
-	index_type _idx;
-	std::reference_wrapper<const unique_lock> _lock;
-	
-	constexpr iterator(
-		const unique_lock& lock,
-		index2object* i2o,
-		index_type idx = types::no_value_value<index_marker_type>()
-	)
-		: _i2o(i2o), _idx(idx), _lock(lock)
-	{}
+		o2i.clear();
+		bind_column(o2i, i2o);
+		for (index_type idx : indexes)
+			o2i.emplace(i2o[idx], idx);
+	}
+};
 
-	static iterator no_value()
+template<class Index, class Index2ObjectsTuple>
+class snapshot;
+
+// gives maps_image.h access to the columns and maps
+struct image_access;
+
+// Statistics policies, the Stats parameter of type and thread_safe::type.
+// no_stats compiles to nothing, count_stats counts the lookups of each
+// 2-way column and (for thread_safe::type) the mutex acquisitions.
+struct no_stats {};
+struct count_stats {};
+
+// the counters returned by stats()
+struct stats_snapshot
+{
+	struct column
 	{
-		return types::zero_ref<index2object>::value();
+		std::uint64_t lookups = 0;
+		std::uint64_t hits = 0;
+		std::uint64_t misses = 0;
+		std::uint64_t probes = 0; // see map::counted_find_as()
+
+		double average_probe_length() const
+		{
+			return (lookups != 0) ? (double) probes / lookups : 0;
+		}
 	};
-	
+
+	std::vector<column> columns; // in the order of TwoWayObjects
+	std::size_t erased = 0; // the holes left by erase()
+	std::uint64_t lock_acquisitions = 0;
+	std::chrono::nanoseconds lock_wait{0};
+};
+
+// A mutex which counts its acquisitions and the time spent waiting for
+// them (only the acquisitions which were not immediate are timed)
+template<class Mutex>
+class counting_mutex
+{
 public:
-	using iterator_category = std::random_access_iterator_tag;
-	using size_type = std::size_t;
-	using difference_type = std::ptrdiff_t;
-	using cont_tuple_helper = tuple::cont_helper<Index2ObjectsTuple>;
-	using ref_tuple = typename cont_tuple_helper::containers2ref_tuple;
-	using cref_tuple = typename cont_tuple_helper::containers2cref_tuple;
-	using val_tuple = typename cont_tuple_helper::containers2val_tuple;
-	using value_type = multi_way_object_indexer::value_type<Index, val_tuple>;
-	using reference = multi_way_object_indexer::thread_safe::reference_type<Index, ref_tuple, val_tuple>;
-	using const_reference = multi_way_object_indexer::thread_safe::reference_type<Index, cref_tuple, val_tuple>;
-	using pointer = void;
+	void lock()
+	{
+		if (!_mutex.try_lock())
+		{
+			const auto start = std::chrono::steady_clock::now();
+			_mutex.lock();
+			waited(std::chrono::steady_clock::now() - start);
+		}
+		_acquisitions.fetch_add(1, std::memory_order_relaxed);
+	}
 
-	~iterator()
+	bool try_lock()
 	{
-		assert(_lock.get().owns_lock()); // the iterator should be destroyed before the lock
+		const bool res = _mutex.try_lock();
+		_acquisitions.fetch_add(res, std::memory_order_relaxed);
+		return res;
 	}
-	
-	// iterators are compatible if they point to the same collection and both are valid values
-	bool is_compatible(const iterator& o) const
+
+	void unlock()
 	{
-		return &_i2o.get() == &o._i2o.get() && !is_no_value();
+		_mutex.unlock();
 	}
-	
-	bool operator==(const iterator& o) const
+
+	template<class M = Mutex>
+	auto lock_shared() -> decltype(std::declval<M&>().lock_shared())
 	{
-		return _idx == o._idx;
+		if (!_mutex.try_lock_shared())
+		{
+			const auto start = std::chrono::steady_clock::now();
+			_mutex.lock_shared();
+			waited(std::chrono::steady_clock::now() - start);
+		}
+		_acquisitions.fetch_add(1, std::memory_order_relaxed);
 	}
 
-	bool operator!=(const iterator& o) const
+	template<class M = Mutex>
+	auto try_lock_shared() -> decltype(std::declval<M&>().try_lock_shared())
 	{
-		return !operator==(o);
+		const bool res = _mutex.try_lock_shared();
+		_acquisitions.fetch_add(res, std::memory_order_relaxed);
+		return res;
 	}
 
-	iterator& operator++()
+	template<class M = Mutex>
+	auto unlock_shared() -> decltype(std::declval<M&>().unlock_shared())
 	{
-		++_idx;
+		_mutex.unlock_shared();
 	}
- 
-	iterator operator++(int)
+
+	std::uint64_t acquisitions() const noexcept
 	{
-		iterator copy = *this;
-		operator++();
-		return copy;
+		return _acquisitions.load(std::memory_order_relaxed);
 	}
 
-	iterator& operator+=(difference_type k)
+	std::chrono::nanoseconds wait_time() const noexcept
 	{
-		_idx += k;
-		return *this;
+		return std::chrono::nanoseconds(_wait_ns.load(std::memory_order_relaxed));
 	}
 
-	iterator operator+(difference_type k)
+	void reset_counters() noexcept
 	{
-		iterator res = *this;
-		return res += k;
+		_acquisitions.store(0, std::memory_order_relaxed);
+		_wait_ns.store(0, std::memory_order_relaxed);
 	}
 
-	iterator& operator--()
+private:
+	template<class Duration>
+	void waited(Duration d)
 	{
-		--_idx;
-		return *this;
+		_wait_ns.fetch_add(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(d).count(),
+			std::memory_order_relaxed
+		);
 	}
- 
-	iterator operator--(int)
+
+	Mutex _mutex;
+	std::atomic<std::uint64_t> _acquisitions{0};
+	std::atomic<std::int64_t> _wait_ns{0};
+};
+
+template<class Mutex>
+void add_lock_stats(const Mutex&, stats_snapshot&)
+{
+}
+
+template<class Mutex>
+void add_lock_stats(const counting_mutex<Mutex>& m, stats_snapshot& res)
+{
+	res.lock_acquisitions = m.acquisitions();
+	res.lock_wait = m.wait_time();
+}
+
+template<class Mutex>
+void reset_lock_stats(Mutex&)
+{
+}
+
+template<class Mutex>
+void reset_lock_stats(counting_mutex<Mutex>& m)
+{
+	m.reset_counters();
+}
+
+// The lookup counters of Columns 2-way columns by the Stats policy
+template<class Stats, std::size_t Columns>
+class stats_counters;
+
+template<std::size_t Columns>
+class stats_counters<no_stats, Columns>
+{
+public:
+	template<class Mutex>
+	using mutex = Mutex;
+
+	static constexpr bool counts_probes = false;
+
+	template<std::size_t Column>
+	void lookup(bool, std::size_t) const noexcept
 	{
-		iterator copy = *this;
-		operator--();
-		return copy;
 	}
 
-	iterator& operator-=(difference_type k)
+	// the index of key in the o2i map m
+	template<std::size_t Column, class Object, class Map, class Key>
+	bool find(const Map& m, const Key& key, typename Map::mapped_type& idx) const
 	{
-		_idx -= k;
-		return *this;
+		const auto it = ::map::find_as<Object>(m, key);
+		if (it == m.end())
+			return false;
+
+		idx = it->second;
+		return true;
 	}
 
-	iterator operator-(difference_type k)
+	template<std::size_t Column, class IndexMarker, class Map, class ForwardIt, class OutputIt>
+	OutputIt find_many(const Map& m, ForwardIt first, ForwardIt last, OutputIt out) const
 	{
-		iterator res = *this;
-		return res -= k;
+		return find_indexes<IndexMarker>(m, first, last, out);
 	}
 
-	iterator operator-(const iterator& it)
+	stats_snapshot get() const
 	{
-		if (is_compatible(it))
-			return *this -= it._idx;
-		else
-			return no_value();
+		stats_snapshot res;
+		res.columns.resize(Columns);
+		return res;
 	}
 
-	reference operator*()
+	void reset() const noexcept
 	{
-		if (is_no_value())
-			return reference{};
-		else
-			return reference(marker::index(_idx), cont_tuple_helper::ref_vector_at(*_i2o, _idx));
 	}
+};
 
-	const_reference operator*() const
+template<std::size_t Columns>
+class stats_counters<count_stats, Columns>
+{
+	struct column
 	{
-		if (is_no_value())
-			return reference{};
-		else
-			return const_reference(marker::index(_idx), cont_tuple_helper::cref_vector_at(*_i2o, _idx));
+		std::atomic<std::uint64_t> lookups{0};
+		std::atomic<std::uint64_t> hits{0};
+		std::atomic<std::uint64_t> probes{0};
+	};
+
+public:
+	template<class Mutex>
+	using mutex = counting_mutex<Mutex>;
+
+	static constexpr bool counts_probes = true;
+
+	stats_counters() {}
+
+	// the counters belong to an object, they are not copied with it
+	stats_counters(const stats_counters&) {}
+
+	stats_counters& operator=(const stats_counters&)
+	{
+		return *this;
 	}
 
-	reference operator[](difference_type k)
+	// relaxed, only the totals matter
+	template<std::size_t Column>
+	void lookup(bool hit, std::size_t probes) const
 	{
-		return *(*this + k);
+		column& c = std::get<Column>(_columns);
+		c.lookups.fetch_add(1, std::memory_order_relaxed);
+		c.hits.fetch_add(hit, std::memory_order_relaxed);
+		c.probes.fetch_add(probes, std::memory_order_relaxed);
 	}
 
-	const_reference operator[](difference_type k) const
+	// the lookup counts its own probes, the map is searched once
+	template<std::size_t Column, class Object, class Map, class Key>
+	bool find(const Map& m, const Key& key, typename Map::mapped_type& idx) const
 	{
-		return *(*this + k);
+		std::size_t probes = 0;
+		const bool hit = ::map::counted_find_as<Object>(m, key, idx, probes);
+		lookup<Column>(hit, probes);
+		return hit;
 	}
 
-	bool operator<(const iterator& it) const
+	// NB the counted lookups are not batched
+	template<std::size_t Column, class IndexMarker, class Map, class ForwardIt, class OutputIt>
+	OutputIt find_many(const Map& m, ForwardIt first, ForwardIt last, OutputIt out) const
 	{
-		if (is_no_value())
+		using Object = typename std::iterator_traits<ForwardIt>::value_type;
+		for (; first != last; ++first)
 		{
-			if (it.is_no_value())
-				return false;
-			else
-				return true; // no_value is lesser than everything except another no_value
+			typename Map::mapped_type idx;
+			*out++ = find<Column, Object>(m, *first, idx) ? IndexMarker{idx} : IndexMarker{};
 		}
-		else if (it.is_no_value())
-			return false;
-		else
-			return _idx < it._idx; // NB: ignore _i2o part here
+		return out;
 	}
 
-	bool operator>(const iterator& it) const
+	stats_snapshot get() const
 	{
-		if (is_no_value())
+		stats_snapshot res;
+		for (const column& c : _columns)
 		{
-			if (it.is_no_value())
-				return false;
-			else
-				return false; // bottom is lesser than everything except another bottom
+			stats_snapshot::column r;
+			r.lookups = c.lookups.load(std::memory_order_relaxed);
+			r.hits = c.hits.load(std::memory_order_relaxed);
+			r.misses = r.lookups - r.hits;
+			r.probes = c.probes.load(std::memory_order_relaxed);
+			res.columns.push_back(r);
 		}
-		else if (it.is_no_value())
-			return true;
-		else
-			return _idx > it._idx; // NB: ignore _i2o part here
+		return res;
+	}
+
+	void reset() const noexcept
+	{
+		for (column& c : _columns)
+		{
+			c.lookups.store(0, std::memory_order_relaxed);
+			c.hits.store(0, std::memory_order_relaxed);
+			c.probes.store(0, std::memory_order_relaxed);
+		}
+	}
+
+private:
+	mutable std::array<column, Columns> _columns;
+};
+
+namespace thread_safe
+{
+
+template<
+	template<class, class> class Object2IndexT,
+	template<class> class Index2ObjectT,
+	class Index,
+	class TwoWayObjects,
+	class OneWayObjects,
+	class Mutex,
+	class Stats
+>
+class type;
+
+template<class Index, class RefTuple, class ValTuple>
+class reference_type
+	: protected tuple::helper<RefTuple>::template prepend<marker::type<marker::index_marker, Index>>
+{
+	template<
+		template<class, class> class _Object2IndexT,
+		template<class> class _Index2ObjectT,
+		class _Index,
+		class _TwoWayObjects,
+		class _OneWayObjects,
+		class _Mutex,
+		class _Stats
+	>
+	friend class multi_way_object_indexer::thread_safe::type;
+
+	using base = typename tuple::helper<RefTuple>::template prepend<marker::type<marker::index_marker, Index>>;
+
+	template<class _Index, class _RefTuple, class _ValTuple>
+	friend std::ostream& operator<<(std::ostream& out, const reference_type<_Index, _RefTuple, _ValTuple>& val);
+	
+	using index_value_type = Index;
+
+public:
+	reference_type() : reference_type(index_marker_type{}, tuple::helper<RefTuple>::zero_ref_tuple()) {}
+	
+	reference_type(const reference_type&) = delete;
+
+	reference_type(reference_type&&) = default;
+	
+	using index_marker_type = marker::type<marker::index_marker, Index>;
+	
+	explicit reference_type(const index_marker_type& idx, const RefTuple& tup)
+		: base(std::tuple_cat(std::make_tuple(idx), tup))
+	{}
+
+	reference_type& operator=(const reference_type&) = delete;
+	
+	reference_type& operator=(reference_type&&) = default;
+	
+	operator value_type<Index, ValTuple>() const
+	{
+		using v_type = value_type<Index, ValTuple>;
+		
+		return v_type(this->index(), tuple::helper<typename v_type::base>::copy(*this));
+	}
+	
+	bool operator==(const reference_type& o) const
+	{
+		if (this->is_no_value() || o.is_no_value())
+			return this->is_no_value() && o.is_no_value();
+		else 
+			return tuple::helper<base>::comparator::equal(*this, o);
+	}
+
+	// TODO left val, right ref
+	bool operator==(const value_type<Index, ValTuple>& o) const
+	{
+		using val_type = value_type<Index, ValTuple>;
+		
+		if (this->is_no_value() || o.is_no_value())
+			return this->is_no_value() && o.is_no_value();
+		else 
+			return tuple::comparator<base, typename val_type::base, 0>::equal(static_cast<const base& >(*this), static_cast<const typename val_type::base& >(o));
+	}
+
+	index_marker_type index() const 
+	{
+		return index_marker_type{std::get<0>(*this)};
+	}
+
+	template<
+		class T,
+		typename std::enable_if<!std::is_const<T>::value, bool>::type = false
+	>
+	T& by_type()
+	{
+		return tuple::recursive_helper<base, 0>::template get_by_unref_type<T>(static_cast<base&>(*this));
+	}
+
+	template<
+		class T
+	>
+	const T& by_type() const
+	{
+		return tuple::recursive_helper<base, 0>::template get_by_unref_type<T>(static_cast<const base&>(*this));
+	}
+
+	static reference_type no_value()
+	{
+		return reference_type{};
+	}
+
+	bool is_no_value() const
+	{
+		return index() == index_marker_type{}; /* || &base::second.get() == nullptr;*/
+	}
+};
+
+template<class Index, class ValTuple>
+std::ostream& operator<<(std::ostream& out, const value_type<Index, ValTuple>& val)
+{
+	using val_type = value_type<Index, ValTuple>;
+	using tuple_type = typename val_type::base;
+	
+	out << "value_type{";
+	tuple::recursive_helper<tuple_type, 0>::out(out, (const tuple_type&)val);
+	out << '}';
+	return out;
+}
+
+template<class Index, class RefTuple, class ValTuple>
+std::ostream& operator<<(std::ostream& out, const reference_type<Index, RefTuple, ValTuple>& val)
+{
+	using ref_type = reference_type<Index, RefTuple, ValTuple>;
+	using tuple_type = typename ref_type::base;
+	
+	out << "value_type{";
+	tuple::recursive_helper<tuple_type, 0>::out(out, (const tuple_type&)val);
+	out << '}';
+	return out;
+}
+
+// a mutex which allows shared (reader) ownership, like std::shared_timed_mutex
+template<class Mutex, class Enable = void>
+struct is_shared_mutex : std::false_type {};
+
+template<class Mutex>
+struct is_shared_mutex<Mutex, types::void_t<decltype(std::declval<Mutex&>().lock_shared())>>
+	: std::true_type
+{};
+
+// Lock is std::unique_lock or std::shared_lock which is held during the iterator life
+template<class Index, class Index2ObjectsTuple, class Lock>
+class iterator
+{
+	template<
+		template<class, class> class _Object2IndexT,
+		template<class> class _Index2ObjectT,
+		class _Index,
+		class _TwoWayObjects,
+		class _OneWayObjects,
+		class _Mutex,
+		class _Stats
+	>
+	friend class multi_way_object_indexer::thread_safe::type;
+
+	using index_type = Index;
+	using index_marker_type = marker::type<marker::index_marker, Index>;
+	using index2object = Index2ObjectsTuple;
+	using lock_type = Lock;
+
+	index2object* _i2o;
+	index_type _idx;
+	std::reference_wrapper<const lock_type> _lock;
+	
+	constexpr iterator(
+		const lock_type& lock,
+		index2object* i2o,
+		index_type idx = types::no_value_value<index_marker_type>()
+	)
+		: _i2o(i2o), _idx(idx), _lock(lock)
+	{}
+
+	static iterator no_value()
+	{
+		return types::zero_ref<index2object>::value();
+	};
+	
+public:
+	using iterator_category = std::random_access_iterator_tag;
+	using size_type = std::size_t;
+	using difference_type = std::ptrdiff_t;
+	using cont_tuple_helper = tuple::cont_helper<Index2ObjectsTuple>;
+	using ref_tuple = typename cont_tuple_helper::containers2ref_tuple;
+	using cref_tuple = typename cont_tuple_helper::containers2cref_tuple;
+	using val_tuple = typename cont_tuple_helper::containers2val_tuple;
+	using value_type = multi_way_object_indexer::value_type<Index, val_tuple>;
+	using reference = multi_way_object_indexer::thread_safe::reference_type<Index, ref_tuple, val_tuple>;
+	using const_reference = multi_way_object_indexer::thread_safe::reference_type<Index, cref_tuple, val_tuple>;
+	using pointer = void;
+
+	~iterator()
+	{
+		assert(_lock.get().owns_lock()); // the iterator should be destroyed before the lock
+	}
+	
+	// iterators are compatible if they point to the same collection and both are valid values
+	bool is_compatible(const iterator& o) const
+	{
+		return &_i2o.get() == &o._i2o.get() && !is_no_value();
+	}
+	
+	bool operator==(const iterator& o) const
+	{
+		return _idx == o._idx;
+	}
+
+	bool operator!=(const iterator& o) const
+	{
+		return !operator==(o);
+	}
+
+	iterator& operator++()
+	{
+		++_idx;
+		return *this;
+	}
+ 
+	iterator operator++(int)
+	{
+		iterator copy = *this;
+		operator++();
+		return copy;
+	}
+
+	iterator& operator+=(difference_type k)
+	{
+		_idx += k;
+		return *this;
+	}
+
+	iterator operator+(difference_type k)
+	{
+		iterator res = *this;
+		return res += k;
+	}
+
+	iterator& operator--()
+	{
+		--_idx;
+		return *this;
+	}
+ 
+	iterator operator--(int)
+	{
+		iterator copy = *this;
+		operator--();
+		return copy;
+	}
+
+	iterator& operator-=(difference_type k)
+	{
+		_idx -= k;
+		return *this;
+	}
+
+	iterator operator-(difference_type k)
+	{
+		iterator res = *this;
+		return res -= k;
+	}
+
+	iterator operator-(const iterator& it)
+	{
+		if (is_compatible(it))
+			return *this -= it._idx;
+		else
+			return no_value();
+	}
+
+	reference operator*()
+	{
+		if (is_no_value())
+			return reference{};
+		else
+			return reference(marker::index(_idx), cont_tuple_helper::ref_vector_at(*_i2o, _idx));
+	}
+
+	const_reference operator*() const
+	{
+		if (is_no_value())
+			return const_reference{};
+		else
+			return const_reference(marker::index(_idx), cont_tuple_helper::cref_vector_at(*_i2o, _idx));
+	}
+
+	reference operator[](difference_type k)
+	{
+		return *(*this + k);
+	}
+
+	const_reference operator[](difference_type k) const
+	{
+		return *(*this + k);
+	}
+
+	bool operator<(const iterator& it) const
+	{
+		if (is_no_value())
+		{
+			if (it.is_no_value())
+				return false;
+			else
+				return true; // no_value is lesser than everything except another no_value
+		}
+		else if (it.is_no_value())
+			return false;
+		else
+			return _idx < it._idx; // NB: ignore _i2o part here
+	}
+
+	bool operator>(const iterator& it) const
+	{
+		if (is_no_value())
+		{
+			if (it.is_no_value())
+				return false;
+			else
+				return false; // bottom is lesser than everything except another bottom
+		}
+		else if (it.is_no_value())
+			return true;
+		else
+			return _idx > it._idx; // NB: ignore _i2o part here
+	}
+
+	bool operator>=(const iterator& it) const
+	{
+		return !(*this < it);
+	}
+
+	bool operator<=(const iterator& it) const
+	{
+		return !(*this > it);
+	}
+
+	bool is_no_value() const
+	{
+		return types::has_no_value(index_marker_type{_idx});
+	}
+};
+
+/**
+ * Maintains an indexed list of objects with ability to search a
+ * object by an index and an index by a object.
+ *
+ * When Mutex is a shared mutex (std::shared_timed_mutex) lookups
+ * are done under a shared lock and proceed in parallel, only
+ * modifications take the exclusive ownership. The non-const lookups
+ * of a table with copy on write columns are modifications too (see
+ * reference_lock).
+ *
+ * With Stats = count_stats the lookups and the mutex acquisitions are
+ * counted (see stats()).
+ */
+template<
+	template<class, class> class Object2IndexT,
+	template<class> class Index2ObjectT,
+	class Index,
+	class TwoWayObjects,
+	class OneWayObjects,
+	class Mutex = std::mutex,
+	class Stats = no_stats
+>
+class type
+{
+	using all_objects_tuple = typename tuple::helper<TwoWayObjects>::template cat<OneWayObjects>;
+	using tuple_helper_all = tuple::helper<all_objects_tuple>;
+	using tuple_helper_1w = tuple::helper<OneWayObjects>;
+	using tuple_helper_2w = tuple::helper<TwoWayObjects>;
+
+	// 2w objects are RO, 1w - RW
+	using index2objects_tuple = typename tuple::helper<typename tuple_helper_2w::template tuple_of_containers<Index2ObjectT>>::template cat<
+		typename tuple_helper_1w::template tuple_of_containers<Index2ObjectT>
+	>;
+	using index2objects_tuple_const = typename tuple::addconst<index2objects_tuple>::type;
+	
+	using objects2index_tuple = typename tuple_helper_2w::template tuple_of_cref_maps<Object2IndexT, Index>;
+
+	using stats_counters_type = stats_counters<Stats, std::tuple_size<TwoWayObjects>::value>;
+
+	// the position of the 2-way column T
+	template<class T>
+	using column_of = tuple::container_idx_from_tuple<0, index2objects_tuple, T>;
+public:
+	using stats_type = Stats;
+	using mutex_type = typename stats_counters_type::template mutex<Mutex>;
+	using lock_guard = std::lock_guard<mutex_type>;
+	using unique_lock = std::unique_lock<mutex_type>;
+	using shared_lock = std::shared_lock<mutex_type>;
+
+	// the lock used for lookups
+	using read_lock = std::conditional_t<is_shared_mutex<mutex_type>::value, shared_lock, unique_lock>;
+
+	// the lock of the non-const lookups, a non-const access to a column
+	// which copies on write (see basic_cow_chunked_vector) writes it
+	using reference_lock = std::conditional_t<
+		has_stable_columns<index2objects_tuple>::value,
+		read_lock,
+		unique_lock
+	>;
+
+	// Lock is unique_lock or (for a shared mutex) shared_lock
+	template<class Lock>
+	using enable_if_lock = std::enable_if_t<
+		std::is_same<Lock, unique_lock>::value || std::is_same<Lock, read_lock>::value,
+		bool
+	>;
+
+	// the non-const iterators need an exclusive lock, a shared lock
+	// selects the const overloads
+	template<class Lock>
+	using enable_if_unique_lock = std::enable_if_t<std::is_same<Lock, unique_lock>::value, bool>;
+
+	using index_type = Index;
+	using index_marker_type = marker::type<marker::index_marker, Index>;
+
+	template<class Lock>
+	using basic_iterator = multi_way_object_indexer::thread_safe::iterator<Index, index2objects_tuple, Lock>;
+
+	template<class Lock>
+	using basic_const_iterator = multi_way_object_indexer::thread_safe::iterator<Index, const index2objects_tuple_const, Lock>;
+
+	using iterator = basic_iterator<unique_lock>;
+	using const_iterator = basic_const_iterator<unique_lock>;
+	
+	using difference_type = typename iterator::difference_type;
+	using size_type = typename iterator::size_type;
+	using value_type = typename iterator::value_type;
+	using value_tuple = typename value_type::value_tuple;
+	using reference = typename iterator::reference;
+	using const_reference = typename iterator::const_reference;
+	
+	// NB no pointers declared
+
+	using reverse_iterator = std::reverse_iterator<iterator>;
+	using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+	using snapshot_type = multi_way_object_indexer::snapshot<Index, index2objects_tuple>;
+	using snapshot_ptr = std::shared_ptr<const snapshot_type>;
+
+	mutable mutex_type _mutex;
+	
+	type()
+	{
+		bind_columns();
+	}
+
+	// see multi_way_object_indexer::type::type(std::allocator_arg_t, Alloc&&)
+	template<class Alloc>
+	type(std::allocator_arg_t, Alloc&& alloc)
+		: _object2index_tuple(std::allocator_arg, alloc),
+		  _index2object_tuple(std::allocator_arg, alloc)
+	{
+		bind_columns();
+	}
+
+	template<class... Ts>
+	type(std::initializer_list<std::tuple<Ts...>> objs)
+	{
+		bind_columns();
+		for (auto it = objs.begin(); it != objs.end(); ++it)
+			push_back(*it);
+	}
+
+	// allows to construct a container from different types of arguments
+	template<class Arg0, class... Args>
+	type(Arg0&& obj0, Args&&... objs)
+	{
+		bind_columns();
+		push_back_seq(std::forward<Arg0>(obj0), std::forward<Args>(objs)...);
+	}
+
+	reference front()
+	{
+		reference_lock lock(_mutex);
+		
+		return *begin_int(lock);
+	}
+	
+	const_reference front() const
+	{
+		read_lock lock(_mutex);
+		
+		return *begin(lock);
+	}
+	
+	reference back()
+	{
+		reference_lock lock(_mutex);
+		
+		auto it = end_int(lock);
+		--it;
+		return *it;
+	}
+
+	const_reference back() const
+	{
+		read_lock lock(_mutex);
+		
+		auto it = end(lock);
+		--it;
+		return *it;
+	}
+
+#if 0
+	// the version compatible with std::back_insert_iterator
+	void push_back(value_type&& v)
+	{
+		lock_guard lock(_mutex);
+
+		push_back_int(std::move(v));
+	}
+#else
+	template<class T>
+	void push_back(T&& v)
+	{
+		lock_guard lock(_mutex);
+
+		push_back_int(value_type::make_value_tuple(std::move(v)));
+	}
+#endif
+
+	// see multi_way_object_indexer::type::emplace_back()
+	template<class... Tuples>
+	void emplace_back(std::piecewise_construct_t, Tuples&&... args)
+	{
+		static_assert(
+			sizeof...(Tuples) == std::tuple_size<value_tuple>::value,
+			"emplace_back: one arguments tuple per column is expected"
+		);
+
+		lock_guard lock(_mutex);
+
+		auto argss = std::forward_as_tuple(std::forward<Tuples>(args)...);
+		tuple_helper_2w::template for_each_no_result_forward_args<piecewise_functor_2w>(
+			_object2index_tuple,
+			_index2object_tuple,
+			std::move(argss),
+			_end_idx
+		);
+		tuple_helper_1w::template for_each_no_result_forward_args<piecewise_functor_1w>(
+			_index2object_tuple,
+			std::move(argss),
+			_end_idx
+		);
+
+		++_end_idx;
+		_snapshot.reset();
+	}
+
+	template<class T0, class... Ts>
+	void push_back_seq(T0&& v0, Ts&&... vs)
+	{
+		push_back(std::forward<T0>(v0));
+		push_back_seq(std::forward<Ts>(vs)...);
+	}
+
+	void push_back_seq()
+	{
+	}
+
+	// reserve space for n rows in all containers which support it
+	void reserve(size_type n)
+	{
+		lock_guard lock(_mutex);
+
+		reserve_int(n);
+	}
+
+	template<class Lock, enable_if_unique_lock<Lock> = false>
+	basic_iterator<Lock> begin(const Lock& lock) noexcept
+	{
+		return begin_int(lock);
+	}
+	
+	template<class Lock, enable_if_lock<Lock> = false>
+	basic_const_iterator<Lock> begin(const Lock& lock) const noexcept
+	{
+		if (!owns(lock))
+		{
+			assert(false);
+			return basic_const_iterator<Lock>(lock, const_index2object_tuple());
+		}
+		
+		return basic_const_iterator<Lock>(lock, const_index2object_tuple(), 0);
+	}
+	
+	template<class Lock, enable_if_unique_lock<Lock> = false>
+	basic_iterator<Lock> end(const Lock& lock) noexcept
+	{
+		return end_int(lock);
+	}
+	
+	template<class Lock, enable_if_lock<Lock> = false>
+	basic_const_iterator<Lock> end(const Lock& lock) const noexcept
+	{
+		if (!owns(lock))
+		{
+			assert(false);
+			return basic_const_iterator<Lock>(lock, const_index2object_tuple());
+		}
+		
+		assert(_end_idx >= 0);
+		return basic_const_iterator<Lock>(lock, const_index2object_tuple(), _end_idx);
+	}
+	
+	template<class Lock, enable_if_lock<Lock> = false>
+	basic_const_iterator<Lock> cbegin(const Lock& lock) const noexcept
+	{
+		return begin(lock);
+	}
+	
+	template<class Lock, enable_if_lock<Lock> = false>
+	basic_const_iterator<Lock> cend(const Lock& lock) const noexcept
+	{
+		return end(lock);
+	}
+
+	reverse_iterator rbegin(const unique_lock& lock) noexcept
+	{
+		return std::reverse_iterator<iterator>(end(lock));
+	}
+	
+	reverse_iterator rend(const unique_lock& lock) noexcept
+	{
+		return std::reverse_iterator<iterator>(begin(lock));
+	}
+	
+	const_reverse_iterator crbegin(const unique_lock& lock) const noexcept
+	{
+		return std::reverse_iterator<const_iterator>(end(lock));
+	}
+	
+	const_reverse_iterator crend(const unique_lock& lock) const noexcept
+	{
+		return std::reverse_iterator<const_iterator>(begin(lock));
+	}
+
+	bool operator==(const type& o) const noexcept
+	{
+		std::lock(_mutex, o._mutex);
+		unique_lock lock(_mutex, std::adopt_lock);
+		unique_lock o_lock(o._mutex, std::adopt_lock);
+		
+		return std::equal(begin(lock), end(lock), o.begin(o_lock), o.end(o_lock));
+	}
+
+	bool operator!=(const type& o) const noexcept
+	{
+		return !(*this == o);
+	}
+
+	void swap(type& o)
+	{
+		using std::swap;
+
+		std::lock(_mutex, o._mutex);
+		unique_lock lock(_mutex, std::adopt_lock);
+		unique_lock o_lock(o._mutex, std::adopt_lock);
+
+		swap(_end_idx, o._end_idx);
+		_snapshot.reset();
+		o._snapshot.reset();
+
+		if (!equal_allocators(_index2object_tuple, o._index2object_tuple)
+			|| !equal_allocators(_object2index_tuple, o._object2index_tuple))
+		{
+			impl_::move_swap(_object2index_tuple, o._object2index_tuple);
+			impl_::move_swap(_index2object_tuple, o._index2object_tuple);
+			reindex();
+			o.reindex();
+			return;
+		}
+
+		swap(_object2index_tuple, o._object2index_tuple);
+		swap(_index2object_tuple, o._index2object_tuple);
+
+		bind_columns();
+		o.bind_columns();
+	}
+
+	size_type size() const noexcept
+	{
+		assert(_end_idx >= 0);
+		return _end_idx;
+	}
+
+	size_type empty() const noexcept
+	{
+		return size() == 0;
+	}
+
+	template<class Lock, enable_if_unique_lock<Lock> = false>
+	basic_iterator<Lock> find(index_marker_type idx_marker, const Lock& lock)
+	{
+		return find_int(idx_marker, lock);
+	}
+
+	template<class Lock, enable_if_lock<Lock> = false>
+	basic_const_iterator<Lock> find(index_marker_type idx_marker, const Lock& lock) const
+	{
+		if (!owns(lock))
+		{
+			assert(false);
+			return basic_const_iterator<Lock>(lock, const_index2object_tuple());
+		}
+		
+		auto idx = idx_marker._value;
+		
+		if (idx >= std::get<0>(_index2object_tuple).size() || idx < 0)
+			return end(lock);
+
+		return begin(lock) + idx;
+	}
+
+	template<class T, class Lock, enable_if_unique_lock<Lock> = false>
+	basic_iterator<Lock> find(const T& obj, const Lock& lock)
+	{
+		return find_int(obj, lock);
+	}
+
+	template<class T, class Lock, enable_if_lock<Lock> = false>
+	basic_const_iterator<Lock> find(const T& obj, const Lock& lock) const
+	{
+		if (!owns(lock))
+		{
+			assert(false);
+			return basic_const_iterator<Lock>(lock, const_index2object_tuple());
+		}
+
+		index_type idx;
+		if (!_stats.template find<column_of<T>::value, T>(object2index<T>(), obj, idx))
+			return end(lock);
+
+		return begin(lock) + idx;
+	}
+
+	template<class T>
+	reference operator[](const T& obj)
+	{
+		reference_lock lock(_mutex);
+		
+		auto it = find_int(obj, lock);
+		if (it < begin_int(lock) || it >= end_int(lock))
+			return reference{};
+		else
+			return *it;
+	}
+	
+	template<class T>
+	const_reference operator[](const T& obj) const
+	{
+		read_lock lock(_mutex);
+		
+		auto it = find(obj, lock);
+		if (it < begin(lock) || it >= end(lock))
+			return const_reference{};
+		else
+			return *it;
+	}
+	
+	
+	template<class T>
+	reference at(const T& obj)
+	{
+		reference_lock lock(_mutex);
+		
+		auto it = find_int(obj, lock);
+		if (it < begin_int(lock) || it >= end_int(lock))
+			throw std::out_of_range("two_way_object_indexer at()");
+		else
+			return *it;
+	}
+
+	template<class T>
+	const_reference at(const T& obj) const
+	{
+		read_lock lock(_mutex);
+		
+		auto it = find(obj, lock);
+		if (it < begin(lock) || it >= end(lock))
+			throw std::out_of_range("two_way_object_indexer at()");
+		else
+			return *it;
+	}
+
+	// see multi_way_object_indexer::type::find_many()
+	template<class ForwardIt, class OutputIt>
+	OutputIt find_many(ForwardIt first, ForwardIt last, OutputIt out) const
+	{
+		read_lock lock(_mutex);
+
+		using T = typename std::iterator_traits<ForwardIt>::value_type;
+		return _stats.template find_many<column_of<T>::value, index_marker_type>(object2index<T>(), first, last, out);
+	}
+
+	// The counters of Stats (zeros for no_stats), the lock counters
+	// include the locks taken by the iterators
+	stats_snapshot stats() const
+	{
+		stats_snapshot res = _stats.get();
+		add_lock_stats(_mutex, res);
+		return res;
+	}
+
+	void reset_stats()
+	{
+		_stats.reset();
+		reset_lock_stats(_mutex);
+	}
+
+	// see multi_way_object_indexer::type::scan()
+	template<class T, class Pred>
+	selection scan(Pred pred) const
+	{
+		read_lock lock(_mutex);
+
+		selection res(size());
+		scan_column(index2object<T>(), size(), pred, res.words());
+		return res;
+	}
+
+	// Returns the last published snapshot or publishes a new one if the
+	// table was changed since (see multi_way_object_indexer::snapshot). NB
+	// changes through references returned by iterators and operator[]
+	// are not tracked.
+	snapshot_ptr snapshot() const
+	{
+		read_lock lock(_mutex);
+
+		snapshot_ptr res = std::atomic_load(&_snapshot);
+		if (!res)
+		{
+			res = std::make_shared<const snapshot_type>(_index2object_tuple, _end_idx);
+			std::atomic_store(&_snapshot, res);
+		}
+		return res;
+	}
+
+	template<class Key, class... Pars>
+	std::pair<reference, bool> update_or_insert(const Key& key, Pars&&... pars)
+	{
+		unique_lock lock(_mutex);
+
+		const auto res = emplace_int<true>(key, std::forward<Pars>(pars)...);
+		auto it = begin(lock) + res.first;
+		assert((*it).template by_type<const Key>() == key);
+		return std::make_pair(*it, res.second);
+	}
+
+	// see multi_way_object_indexer::type::try_emplace()
+	template<class Key, class... Pars>
+	std::pair<reference, bool> try_emplace(const Key& key, Pars&&... pars)
+	{
+		unique_lock lock(_mutex);
+
+		const auto res = emplace_int<false>(key, std::forward<Pars>(pars)...);
+		return std::make_pair(*(begin(lock) + res.first), res.second);
+	}
+
+protected:
+	// the iterators of the non-const lookups, the references returned
+	// by front(), operator[] etc. outlive the lock anyway
+	template<class Lock>
+	basic_iterator<Lock> begin_int(const Lock& lock) noexcept
+	{
+		if (!owns(lock))
+		{
+			assert(false);
+			return basic_iterator<Lock>(lock, &_index2object_tuple);
+		}
+		
+		return basic_iterator<Lock>(lock, &_index2object_tuple, 0);
+	}
+	
+	// see begin_int()
+	template<class Lock>
+	basic_iterator<Lock> end_int(const Lock& lock) noexcept
+	{
+		if (!owns(lock))
+		{
+			assert(false);
+			return basic_iterator<Lock>(lock, &_index2object_tuple);
+		}
+		
+		assert(_end_idx >= 0);
+		return basic_iterator<Lock>(lock, &_index2object_tuple, _end_idx);
+	}
+	
+
+	// see begin_int()
+	template<class Lock>
+	basic_iterator<Lock> find_int(index_marker_type idx_marker, const Lock& lock)
+	{
+		if (!owns(lock))
+		{
+			assert(false);
+			return basic_iterator<Lock>(lock, &_index2object_tuple);
+		}
+		
+		typename index_marker_type::value_type idx;
+		if (!types::get_value(idx_marker, idx))
+			return end_int(lock);
+		
+		if (idx >= std::get<0>(_index2object_tuple).size())
+			return end_int(lock);
+
+		return begin_int(lock) + idx;
+	}
+
+	// see begin_int()
+	template<class T, class Lock>
+	basic_iterator<Lock> find_int(const T& obj, const Lock& lock)
+	{
+		if (!owns(lock))
+		{
+			assert(false);
+			return basic_iterator<Lock>(lock, &_index2object_tuple);
+		}
+
+		index_type idx;
+		if (!_stats.template find<column_of<T>::value, T>(object2index<T>(), obj, idx))
+			return end_int(lock);
+
+		return begin_int(lock) + idx;
+	}
+
+	// see multi_way_object_indexer::type::emplace_int(), returns the row
+	// index
+	template<bool Update, class Key, class... Pars>
+	std::pair<index_type, bool> emplace_int(const Key& key, Pars&&... pars)
+	{
+		static_assert(
+			row_fits<std::tuple<Key, Pars...>, value_tuple>::value,
+			"source tuple contains type not used in the destination tuple"
+		);
+		using probe = single_probe<
+			Object2IndexT<std::reference_wrapper<const Key>, Index>,
+			stats_counters_type::counts_probes
+		>;
+
+		auto& o2i = object2index<Key>();
+		const auto pos = probe::find(o2i, key);
+		const bool found = probe::found(o2i, pos, key);
+		_stats.template lookup<column_of<Key>::value>(found, probe::probes(pos));
+		if (found)
+		{
+			const index_type idx = probe::mapped(o2i, pos);
+			if (Update)
+			{
+				update_int(std::integral_constant<bool, Update>(), idx, std::forward<Pars>(pars)...);
+				_snapshot.reset();
+			}
+			return std::make_pair(idx, false);
+		}
+
+		// a tuple of references, each column takes only its own object
+		auto args = std::forward_as_tuple(key, std::forward<Pars>(pars)...);
+		tuple_helper_2w::template for_each_no_result_forward_args<emplace_functor_2w>(
+			_object2index_tuple,
+			_index2object_tuple,
+			std::move(args),
+			_end_idx,
+			&key
+		);
+		tuple_helper_1w::template for_each_no_result_forward_args<emplace_functor_1w>(
+			_index2object_tuple,
+			std::move(args),
+			_end_idx
+		);
+		probe::emplace(o2i, pos, index2object<Key>().back(), _end_idx);
+
+		_snapshot.reset();
+		return std::make_pair(_end_idx++, true);
+	}
+
+	template<class... Pars>
+	void update_int(std::true_type, index_type idx, Pars&&... pars)
+	{
+		tuple::helper<std::tuple<Pars...>>::template for_each_no_result_forward_args<protect<TwoWayObjects>::template rewrite_functor_1w>(
+			_index2object_tuple,
+			std::forward_as_tuple(std::forward<Pars>(pars)...),
+			index_marker_type{idx}
+		);
+	}
+
+	template<class... Pars>
+	void update_int(std::false_type, index_type, Pars&&...)
+	{
+	}
+
+	template<class Lock>
+	bool owns(const Lock& lock) const
+	{
+		return lock.mutex() == &_mutex && lock.owns_lock();
+	}
+
+	const index2objects_tuple_const* const_index2object_tuple() const
+	{
+		return reinterpret_cast<const index2objects_tuple_const*>(&_index2object_tuple);
+	}
+
+	void push_back_int(value_tuple&& tup)
+	{
+		// 2 way objects
+		
+		tuple_helper_2w::template for_each_no_result_forward_args<push_functor_2w>(
+			_object2index_tuple,
+			_index2object_tuple,
+			std::move(tup),
+			_end_idx
+		);
+
+		// 1 way objects
+
+		tuple_helper_1w::template for_each_no_result_forward_args<push_functor_1w>(
+			_index2object_tuple,
+			std::move(tup),
+			_end_idx
+		);
+
+		++_end_idx;
+		_snapshot.reset();
+	}
+
+	void reserve_int(size_type n)
+	{
+		tuple_helper_2w::template for_each_no_result_forward_args<reserve_functor_2w>(
+			_object2index_tuple,
+			_index2object_tuple,
+			n
+		);
+		tuple_helper_1w::template for_each_no_result_forward_args<reserve_functor_1w>(
+			_index2object_tuple,
+			n
+		);
+	}
+
+	// must be called each time the columns change their address
+	void bind_columns()
+	{
+		tuple_helper_2w::template for_each_no_result_forward_args<bind_functor_2w>(
+			_object2index_tuple,
+			_index2object_tuple
+		);
+	}
+
+	// must be called each time the columns move their elements
+	void reindex()
+	{
+		tuple_helper_2w::template for_each_no_result_forward_args<reindex_functor_2w>(
+			_object2index_tuple,
+			_index2object_tuple
+		);
+	}
+	
+	template<class T>
+	Object2IndexT<std::reference_wrapper<const T>, Index>& object2index()
+	{
+		static_assert(
+			tuple::among_tuple_types<T, TwoWayObjects>::value,
+			"Unable to index the collection by the type not specified in TwoWayObjects"
+		);
+		return std::get<Object2IndexT<std::reference_wrapper<const T>, Index>>(_object2index_tuple);
+	}
+
+	template<class T>
+	const Object2IndexT<std::reference_wrapper<const T>, Index>& object2index() const
+	{
+		static_assert(
+			tuple::among_tuple_types<T, TwoWayObjects>::value,
+			"Unable to index the collection by the type not specified in TwoWayObjects"
+		);
+		return std::get<Object2IndexT<std::reference_wrapper<const T>, Index>>(_object2index_tuple);
+	}
+
+	template<class T>
+	Index2ObjectT<T>& index2object()
+	{
+		return std::get<Index2ObjectT<T>>(_index2object_tuple);
+	}
+
+	template<class T>
+	const Index2ObjectT<T>& index2object() const
+	{
+		return std::get<Index2ObjectT<T>>(_index2object_tuple);
+	}
+
+private:
+	objects2index_tuple _object2index_tuple;
+	index2objects_tuple _index2object_tuple;
+	index_type _end_idx = 0;
+	mutable snapshot_ptr _snapshot; // the last published, reset by changes
+	stats_counters_type _stats;
+};
+
+} // namespace thread_safe
+ 
+template<
+	template<class, class> class Object2IndexT,
+	template<class> class Index2ObjectT,
+	class Index,
+	class TwoWayObjects,
+	class OneWayObjects,
+	class Stats
+>
+class type;
+
+template<class Index, class RefTuple, class ValTuple>
+class reference_type
+#if 0
+	: protected
+#else
+  : public
+#endif
+tuple::helper<RefTuple>::template prepend<marker::type<marker::index_marker, Index>>
+{
+	template<
+		template<class, class> class _Object2IndexT,
+		template<class> class _Index2ObjectT,
+		class _Index,
+		class _TwoWayObjects,
+		class _OneWayObjects,
+		class _Stats
+	>
+	friend class multi_way_object_indexer::type;
+
+	using base = typename tuple::helper<RefTuple>::template prepend<marker::type<marker::index_marker, Index>>;
+
+	template<class _Index, class _RefTuple, class _ValTuple>
+	friend std::ostream& operator<<(std::ostream& out, const reference_type<_Index, _RefTuple, _ValTuple>& val);
+	
+	using index_value_type = Index;
+
+public:
+	reference_type() : reference_type(index_marker_type{}, tuple::helper<RefTuple>::zero_ref_tuple()) {}
+
+	reference_type(const reference_type&) = delete;
+
+	reference_type(reference_type&&) = default;
+	
+	using index_marker_type = marker::type<marker::index_marker, Index>;
+	
+	explicit reference_type(const index_marker_type& idx, const RefTuple& tup)
+		: base(std::tuple_cat(std::make_tuple(idx), tup))
+	{}
+
+	reference_type& operator=(const reference_type&) = delete;
+	
+	reference_type& operator=(reference_type&&) = default;
+
+	template<class... Ts>
+	reference_type& operator=(std::tuple<Ts...>&& t)
+	{
+		int a = t;
+	}
+	
+	template<class... Ts>
+	reference_type& operator|=(std::tuple<Ts...>&& t)
+	{
+		int a = t;
+	}
+	
+	explicit operator value_type<Index, ValTuple>() const
+	{
+ 		using v_type = value_type<Index, ValTuple>;
+		using helper = tuple::helper<ValTuple>;
+
+		//ValTuple result;
+		v_type result;
+
+		helper::template for_each_no_result_forward_args<select_functor>(
+			result,
+			static_cast<const base&>(*this)
+		);
+		return result; //v_type(index(), std::move(result));
+	}
+
+	value_type<Index, ValTuple> value() const
+	{
+		return (value_type<Index, ValTuple>)*this;
+	}
+	
+	bool operator==(const reference_type& o) const
+	{
+		if (this->is_no_value() || o.is_no_value())
+			return this->is_no_value() && o.is_no_value();
+		else 
+			return tuple::helper<base>::comparator::equal(*this, o);
+	}
+
+	// TODO left val, right ref
+	bool operator==(const value_type<Index, ValTuple>& o) const
+	{
+		using val_type = value_type<Index, ValTuple>;
+		
+		if (this->is_no_value() || o.is_no_value())
+			return this->is_no_value() && o.is_no_value();
+		else 
+			return tuple::comparator<base, typename val_type::base, 0>::equal(static_cast<const base& >(*this), static_cast<const typename val_type::base& >(o));
+	}
+
+	index_marker_type index() const 
+	{
+		return index_marker_type{std::get<0>(*this)};
+	}
+
+	template<
+		class T,
+		typename std::enable_if<!std::is_const<T>::value, bool>::type = false
+	>
+	T& by_type()
+	{
+		if (!is_no_value())
+			return tuple::recursive_helper<base, 0>::template get_by_unref_type<T>(static_cast<base&>(*this));
+		else
+		{
+			assert(false);
+			static T no_value{types::no_value<T>()};
+			return no_value;
+		}
+	}
+
+	template<
+		class T
+	>
+	const T& by_type() const
+	{
+		if (!is_no_value())
+			return tuple::recursive_helper<base, 0>::template get_by_unref_type<T>(static_cast<const base&>(*this));
+		else
+		{
+			//assert(false);
+			static T no_value{types::no_value<T>()};
+			return no_value;
+		}
+	}
+
+	static reference_type no_value()
+	{
+		return reference_type{};
+	}
+
+	bool is_no_value() const
+	{
+		return index() == index_marker_type{} || tuple::some_element_is_zero_ref(*this);
+	}
+	
+	bool is_no_value_strong() const
+	{
+		return is_no_value() || types::has_no_value(value().get_value_tuple());
+	}
+};
+
+template<class Index, class ValTuple>
+std::ostream& operator<<(std::ostream& out, const value_type<Index, ValTuple>& val)
+{
+	using val_type = value_type<Index, ValTuple>;
+	using tuple_type = typename val_type::base;
+	
+	out << "value_type{";
+	tuple::recursive_helper<tuple_type, 0>::out(out, (const tuple_type&)val);
+	out << '}';
+	return out;
+}
+
+template<class Index, class RefTuple, class ValTuple>
+std::ostream& operator<<(std::ostream& out, const reference_type<Index, RefTuple, ValTuple>& val)
+{
+	using ref_type = reference_type<Index, RefTuple, ValTuple>;
+	using tuple_type = typename ref_type::base;
+	
+	out << "value_type{";
+	tuple::recursive_helper<tuple_type, 0>::out(out, (const tuple_type&)val);
+	out << '}';
+	return out;
+}
+
+template<class Index, class Index2ObjectsTuple>
+class iterator
+{
+	template<
+		template<class, class> class _Object2IndexT,
+		template<class> class _Index2ObjectT,
+		class _Index,
+		class _TwoWayObjects,
+		class _OneWayObjects,
+		class _Stats
+	>
+	friend class multi_way_object_indexer::type;
+
+	template<class _Index, class _Index2ObjectsTuple>
+	friend class multi_way_object_indexer::snapshot;
+
+	using index_type = Index;
+	using index_marker_type = marker::type<marker::index_marker, Index>;
+	using index2object = Index2ObjectsTuple;
+
+	index2object* _i2o = nullptr;
+	index_type _idx;
+	
+	constexpr iterator(
+		index2object* i2o,
+		index_type idx = index_marker_type::no_value()._value
+	)
+		: _i2o(i2o), _idx(idx)
+	{}
+
+	static iterator no_value()
+	{
+		return types::zero_ref<index2object>::value();
+	};
+	
+public:
+	using iterator_category = std::random_access_iterator_tag;
+	using size_type = std::size_t;
+	using difference_type = std::ptrdiff_t;
+	using cont_tuple_helper = tuple::cont_helper<Index2ObjectsTuple>;
+	using ref_tuple = typename cont_tuple_helper::containers2ref_tuple;
+	using cref_tuple = typename cont_tuple_helper::containers2cref_tuple;
+	using val_tuple = typename cont_tuple_helper::containers2val_tuple;
+	using value_type = multi_way_object_indexer::value_type<Index, val_tuple>;
+	using reference = multi_way_object_indexer::reference_type<Index, ref_tuple, val_tuple>;
+	using const_reference = multi_way_object_indexer::reference_type<Index, cref_tuple, val_tuple>;
+	using pointer = void;
+
+	// iterators are compatible if they point to the same collection and both are valid values
+	bool is_compatible(const iterator& o) const
+	{
+		return &_i2o.get() == &o._i2o.get() && !is_no_value();
+	}
+	
+	bool operator==(const iterator& o) const
+	{
+		return _idx == o._idx;
+	}
+
+	bool operator!=(const iterator& o) const
+	{
+		return !operator==(o);
+	}
+
+	iterator& operator++()
+	{
+		++_idx;
+		return *this;
+	}
+ 
+	iterator operator++(int)
+	{
+		iterator copy = *this;
+		operator++();
+		return copy;
+	}
+
+	iterator& operator+=(difference_type k)
+	{
+		_idx += k;
+		return *this;
+	}
+
+	iterator operator+(difference_type k)
+	{
+		iterator res = *this;
+		return res += k;
+	}
+
+	iterator& operator--()
+	{
+		--_idx;
+		return *this;
+	}
+ 
+	iterator operator--(int)
+	{
+		iterator copy = *this;
+		operator--();
+		return copy;
+	}
+
+	iterator& operator-=(difference_type k)
+	{
+		_idx -= k;
+		return *this;
+	}
+
+	iterator operator-(difference_type k)
+	{
+		iterator res = *this;
+		return res -= k;
+	}
+
+	iterator operator-(const iterator& it)
+	{
+		if (is_compatible(it))
+			return *this -= it._idx;
+		else
+			return no_value();
+	}
+
+	reference operator*()
+	{
+		if (is_no_value())
+			return reference{};
+		else
+			return reference(marker::index(_idx), cont_tuple_helper::ref_vector_at(*_i2o, _idx));
+	}
+
+	const_reference operator*() const
+	{
+		if (is_no_value())
+			return const_reference{};
+		else
+			return const_reference(marker::index(_idx), cont_tuple_helper::cref_vector_at(*_i2o, _idx));
+	}
+
+	reference operator[](difference_type k)
+	{
+		return *(*this + k);
+	}
+
+	const_reference operator[](difference_type k) const
+	{
+		return *(*this + k);
+	}
+
+	bool operator<(const iterator& it) const
+	{
+		if (is_no_value())
+		{
+			if (it.is_no_value())
+				return false;
+			else
+				return true; // no_value is lesser than everything except another no_value
+		}
+		else if (it.is_no_value())
+			return false;
+		else
+			return _idx < it._idx; // NB: ignore _i2o part here
+	}
+
+	bool operator>(const iterator& it) const
+	{
+		if (is_no_value())
+		{
+			if (it.is_no_value())
+				return false;
+			else
+				return false; // bottom is lesser than everything except another bottom
+		}
+		else if (it.is_no_value())
+			return true;
+		else
+			return _idx > it._idx; // NB: ignore _i2o part here
 	}
 
 	bool operator>=(const iterator& it) const
 	{
-		return !(*this < it);
+		return !(*this < it);
+	}
+
+	bool operator<=(const iterator& it) const
+	{
+		return !(*this > it);
+	}
+
+	bool is_no_value() const
+	{
+		return types::has_no_value(index_marker_type{_idx}) || _i2o == nullptr;
+	}
+};
+
+/**
+ * An immutable copy of the indexer columns made by type::snapshot(). It is
+ * read without locks and supports only the access by an index (no lookups
+ * by objects). Columns of cow_chunked_vector type share unchanged chunks
+ * with the indexer, others are copied.
+ */
+template<class Index, class Index2ObjectsTuple>
+class snapshot
+{
+	using index2objects_tuple_const = typename tuple::addconst<Index2ObjectsTuple>::type;
+
+public:
+	using index_type = Index;
+	using index_marker_type = marker::type<marker::index_marker, Index>;
+	using const_iterator = multi_way_object_indexer::iterator<Index, const index2objects_tuple_const>;
+	using iterator = const_iterator;
+	using size_type = typename const_iterator::size_type;
+	using value_type = typename const_iterator::value_type;
+	using const_reference = typename const_iterator::const_reference;
+	using reference = const_reference;
+
+	snapshot(const Index2ObjectsTuple& columns, index_type end_idx)
+		: _index2object_tuple(columns), _end_idx(end_idx)
+	{}
+
+	size_type size() const noexcept
+	{
+		assert(_end_idx >= 0);
+		return _end_idx;
+	}
+
+	bool empty() const noexcept
+	{
+		return size() == 0;
+	}
+
+	const_iterator begin() const noexcept
+	{
+		return const_iterator(index2object_tuple(), 0);
+	}
+
+	const_iterator end() const noexcept
+	{
+		return const_iterator(index2object_tuple(), _end_idx);
+	}
+
+	const_reference operator[](index_marker_type idx) const
+	{
+		index_type idx_int;
+		if (!types::get_value(idx, idx_int) || idx_int < 0 || idx_int >= _end_idx)
+			return const_reference{};
+
+		return *const_iterator(index2object_tuple(), idx_int);
+	}
+
+	// see type::scan()
+	template<class T, class Pred>
+	selection scan(Pred pred) const
+	{
+		selection res(size());
+		scan_column(
+			std::get<
+				tuple::container_idx_from_tuple<0, Index2ObjectsTuple, std::reference_wrapper<const T>>::value
+			>(_index2object_tuple),
+			size(),
+			pred,
+			res.words()
+		);
+		return res;
+	}
+
+protected:
+	const index2objects_tuple_const* index2object_tuple() const
+	{
+		return reinterpret_cast<const index2objects_tuple_const*>(&_index2object_tuple);
+	}
+
+private:
+	const Index2ObjectsTuple _index2object_tuple;
+	const index_type _end_idx;
+};
+
+// Keeps a row superseded by type::push_back_as_update() from being
+// reclaimed by type::vacuum() until the pin is released (see type::pin())
+template<class Index>
+class row_pin
+{
+	template<
+		template<class, class> class _Object2IndexT,
+		template<class> class _Index2ObjectT,
+		class _Index,
+		class _TwoWayObjects,
+		class _OneWayObjects,
+		class _Stats
+	>
+	friend class multi_way_object_indexer::type;
+
+	using pin_set = std::unordered_multiset<Index>;
+
+	row_pin(std::shared_ptr<pin_set> pins, Index idx) : _pins(std::move(pins)), _idx(idx)
+	{
+		_pins->insert(_idx);
+	}
+
+public:
+	using index_marker_type = marker::type<marker::index_marker, Index>;
+
+	row_pin() {}
+
+	row_pin(const row_pin&) = delete;
+
+	row_pin(row_pin&& o) noexcept : _pins(std::move(o._pins)), _idx(o._idx) {}
+
+	~row_pin()
+	{
+		release();
+	}
+
+	row_pin& operator=(const row_pin&) = delete;
+
+	row_pin& operator=(row_pin&& o) noexcept
+	{
+		if (this != &o)
+		{
+			release();
+			_pins = std::move(o._pins);
+			_idx = o._idx;
+		}
+		return *this;
+	}
+
+	void release()
+	{
+		if (!_pins)
+			return;
+
+		_pins->erase(_pins->find(_idx));
+		_pins.reset();
+	}
+
+	// no value for a released pin
+	index_marker_type index() const
+	{
+		return _pins ? index_marker_type{_idx} : index_marker_type{};
+	}
+
+private:
+	std::shared_ptr<pin_set> _pins;
+	Index _idx = Index();
+};
+
+/**
+ * Maintains an indexed list of objects with ability to search a
+ * object by an index and an index by a object.
+ *
+ * With Stats = count_stats the lookups are counted (see stats()).
+ *
+ * Rows superseded by push_back_as_update() stay readable by their
+ * indexes until vacuum() (or, with set_auto_vacuum(true), the following
+ * updates) erases them. pin() keeps such a row until it is released.
+ */
+template<
+	template<class, class> class Object2IndexT,
+	template<class> class Index2ObjectT,
+	class Index,
+	class TwoWayObjects,
+	class OneWayObjects,
+	class Stats = no_stats
+>
+class type
+{
+	using all_objects_tuple = typename tuple::helper<TwoWayObjects>::template cat<OneWayObjects>;
+	using tuple_helper_all = tuple::helper<all_objects_tuple>;
+	using tuple_helper_1w = tuple::helper<OneWayObjects>;
+	using tuple_helper_2w = tuple::helper<TwoWayObjects>;
+
+	// 2w objects are RO, 1w - RW
+	using index2objects_tuple = typename tuple::helper<typename tuple_helper_2w::template tuple_of_containers<Index2ObjectT>>::template cat<
+		typename tuple_helper_1w::template tuple_of_containers<Index2ObjectT>
+	>;
+	using index2objects_tuple_const = typename tuple::addconst<index2objects_tuple>::type;
+	
+	using objects2index_tuple = typename tuple_helper_2w::template tuple_of_cref_maps<Object2IndexT, Index>;
+
+	using stats_counters_type = stats_counters<Stats, std::tuple_size<TwoWayObjects>::value>;
+
+	// the position of the 2-way column T
+	template<class T>
+	using column_of = tuple::container_idx_from_tuple<0, index2objects_tuple, T>;
+public:
+	using stats_type = Stats;
+	using index_type = Index;
+	using index_marker_type = marker::type<marker::index_marker, Index>;
+	using iterator = multi_way_object_indexer::iterator<Index, index2objects_tuple>;
+	using const_iterator = multi_way_object_indexer::iterator<Index, const index2objects_tuple_const>;
+	
+	using difference_type = typename iterator::difference_type;
+	using size_type = typename iterator::size_type;
+	using value_type = typename iterator::value_type;
+	using value_tuple = typename value_type::value_tuple;
+	using reference = typename iterator::reference;
+	using const_reference = typename iterator::const_reference;
+	
+	// NB no pointers declared
+
+	using reverse_iterator = std::reverse_iterator<iterator>;
+	using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+	using snapshot_type = multi_way_object_indexer::snapshot<Index, index2objects_tuple>;
+	using snapshot_ptr = std::shared_ptr<const snapshot_type>;
+
+	type()
+	{
+		bind_columns();
+	}
+
+	// Constructs the columns and the maps which are allocator aware (see
+	// map::pmr) with alloc, others are default constructed. NB copies use
+	// the default allocator (polymorphic_allocator isn't propagated). A
+	// move assignment or a swap with a table of another memory resource
+	// moves the rows one by one and rebuilds the o2i maps.
+	template<class Alloc>
+	type(std::allocator_arg_t, Alloc&& alloc)
+		: _object2index_tuple(std::allocator_arg, alloc),
+		  _index2object_tuple(std::allocator_arg, alloc)
+	{
+		bind_columns();
+	}
+
+	type(const type& o)
+		: _object2index_tuple(o._object2index_tuple),
+		  _index2object_tuple(o._index2object_tuple),
+		  _end_idx(o._end_idx),
+		  _erased(o._erased),
+		  _superseded(o._superseded),
+		  _superseded_rows(o._superseded_rows),
+		  _auto_vacuum(o._auto_vacuum)
+	{
+		bind_columns();
+	}
+
+	type(type&& o)
+		: _object2index_tuple(std::move(o._object2index_tuple)),
+		  _index2object_tuple(std::move(o._index2object_tuple)),
+		  _end_idx(o._end_idx),
+		  _erased(std::move(o._erased)),
+		  _superseded(std::move(o._superseded)),
+		  _superseded_rows(std::move(o._superseded_rows)),
+		  _pins(std::move(o._pins)),
+		  _auto_vacuum(o._auto_vacuum)
+	{
+		bind_columns();
+	}
+	
+	template<class... Ts>
+	type(std::initializer_list<std::tuple<Ts...>> objs)
+	{
+		bind_columns();
+		for (auto it = objs.begin(); it != objs.end(); ++it)
+			push_back(*it);
+	}
+
+	// allows to construct a container from different types of arguments
+	template<class Arg0, class... Args>
+	type(Arg0&& obj0, Args&&... objs)
+	{
+		bind_columns();
+		push_back_seq(std::forward<Arg0>(obj0), std::forward<Args>(objs)...);
+	}
+
+	type& operator=(const type& o)
+	{
+		_object2index_tuple = o._object2index_tuple;
+		_index2object_tuple = o._index2object_tuple;
+		_end_idx = o._end_idx;
+		_erased = o._erased;
+		_superseded = o._superseded;
+		_superseded_rows = o._superseded_rows;
+		_pins.reset(); // the pins of o don't pin our rows
+		_auto_vacuum = o._auto_vacuum;
+		bind_columns();
+		return *this;
+	}
+
+	type& operator=(type&& o)
+	{
+		const bool moves_storage = equal_allocators(_index2object_tuple, o._index2object_tuple);
+		_object2index_tuple = std::move(o._object2index_tuple);
+		_index2object_tuple = std::move(o._index2object_tuple);
+		_end_idx = o._end_idx;
+		_erased = std::move(o._erased);
+		_superseded = std::move(o._superseded);
+		_superseded_rows = std::move(o._superseded_rows);
+		_pins = std::move(o._pins);
+		_auto_vacuum = o._auto_vacuum;
+		if (moves_storage)
+			bind_columns();
+		else
+			reindex();
+		return *this;
+	}
+
+	reference front()
+	{
+		return *begin();
+	}
+	
+	const_reference front() const
+	{
+		return *begin();
+	}
+	
+	reference back()
+	{
+		auto it = end();
+		--it;
+		return *it;
+	}
+
+	const_reference back() const
+	{
+		auto it = end();
+		--it;
+		return *it;
+	}
+
+	template<class... Ts>
+	iterator push_back(std::tuple<Ts...>&& v)
+	{
+		return push_back_int(value_type::make_value_tuple(std::move(v)));
+	}
+	
+	template<class T>
+	auto push_back(T&& v)
+		-> std::enable_if_t<!tuple::has_tuple_as_base<T>::value, iterator>
+	{
+		return push_back_int(value_type::make_value_tuple(std::forward_as_tuple(std::move(v))));
+	}
+
+	// Constructs each object of the new row in place from its arguments
+	// tuple, one tuple per column in the order of TwoWayObjects then
+	// OneWayObjects, e.g.
+	// emplace_back(std::piecewise_construct, std::forward_as_tuple(3, 'a'), std::make_tuple(), ...)
+	template<class... Tuples>
+	iterator emplace_back(std::piecewise_construct_t, Tuples&&... args)
+	{
+		static_assert(
+			sizeof...(Tuples) == std::tuple_size<value_tuple>::value,
+			"emplace_back: one arguments tuple per column is expected"
+		);
+
+		auto argss = std::forward_as_tuple(std::forward<Tuples>(args)...);
+		tuple_helper_2w::template for_each_no_result_forward_args<piecewise_functor_2w>(
+			_object2index_tuple,
+			_index2object_tuple,
+			std::move(argss),
+			_end_idx
+		);
+		tuple_helper_1w::template for_each_no_result_forward_args<piecewise_functor_1w>(
+			_index2object_tuple,
+			std::move(argss),
+			_end_idx
+		);
+
+		return iterator(&_index2object_tuple, _end_idx++);
+	}
+	
+	template<class T0, class... Ts>
+	void push_back_seq(T0&& v0, Ts&&... vs)
+	{
+		push_back(std::forward<T0>(v0));
+		push_back_seq(std::forward<Ts>(vs)...);
+	}
+
+	void push_back_seq()
+	{
+	}
+
+	template<class... Ts>
+	iterator push_in_hole(std::tuple<Ts...>&& v)
+	{
+		return push_in_hole_int(value_type::make_value_tuple(std::move(v)));
+	}
+
+	// reserve space for n rows in all containers which support it
+	void reserve(size_type n)
+	{
+		reserve_int(n);
+	}
+
+	// Appends rows (tuples like for push_back) from [first, last)
+	// column by column, each o2i map is built in one pass after its
+	// column. With std::launch::async columns are filled in parallel.
+	// Use std::move_iterator to move objects from the range.
+	// Returns the iterator to the first appended row.
+	template<class ForwardIt>
+	iterator push_back_range(ForwardIt first, ForwardIt last, std::launch policy = std::launch::deferred)
+	{
+		static_assert(
+			row_fits<decltype(*first), value_tuple>::value,
+			"source tuple contains type not used in the destination tuple"
+		);
+
+		const index_type start_idx = _end_idx;
+		const size_type n = std::distance(first, last);
+		reserve_int(size() + n);
+
+		std::vector<std::future<void>> futures;
+		tuple_helper_2w::template for_each_no_result_forward_args<bulk_push_functor_2w>(
+			_object2index_tuple,
+			_index2object_tuple,
+			first,
+			last,
+			start_idx,
+			policy,
+			futures
+		);
+		tuple_helper_1w::template for_each_no_result_forward_args<bulk_push_functor_1w>(
+			_index2object_tuple,
+			first,
+			last,
+			policy,
+			futures
+		);
+		for (auto& f : futures)
+			f.get();
+
+		_end_idx += (index_type) n;
+		return iterator(&_index2object_tuple, start_idx);
+	}
+
+	// replaces the content by rows from [first, last), see push_back_range
+	template<class ForwardIt>
+	void assign(ForwardIt first, ForwardIt last, std::launch policy = std::launch::deferred)
+	{
+		clear();
+		push_back_range(first, last, policy);
+	}
+	
+	iterator begin() noexcept
+	{
+		return iterator(&_index2object_tuple, 0);
+	}
+	
+	const_iterator begin() const noexcept
+	{
+		return const_iterator(reinterpret_cast<const index2objects_tuple_const*>(&_index2object_tuple), 0);
+	}
+	
+	iterator end() noexcept
+	{
+		assert(_end_idx >= 0);
+		return iterator(&_index2object_tuple, _end_idx);
+	}
+	
+	const_iterator end() const noexcept
+	{
+		assert(_end_idx >= 0);
+		return const_iterator(reinterpret_cast<const index2objects_tuple_const*>(&_index2object_tuple), _end_idx);
+	}
+	
+	const_iterator cbegin() const noexcept
+	{
+		return begin();
+	}
+	
+	const_iterator cend() const noexcept
+	{
+		return end();
+	}
+
+	reverse_iterator rbegin() noexcept
+	{
+		return std::reverse_iterator<iterator>(end());
+	}
+	
+	reverse_iterator rend() noexcept
+	{
+		return std::reverse_iterator<iterator>(begin());
+	}
+	
+	const_reverse_iterator crbegin() const noexcept
+	{
+		return std::reverse_iterator<const_iterator>(end());
+	}
+	
+	const_reverse_iterator crend() const noexcept
+	{
+		return std::reverse_iterator<const_iterator>(begin());
+	}
+
+	bool operator==(const type& o) const noexcept
+	{
+		return std::equal(begin(), end(), o.begin(), o.end());
+	}
+
+	bool operator!=(const type& o) const noexcept
+	{
+		return !(*this == o);
+	}
+
+	void swap(type& o)
+	{
+		using std::swap;
+
+		if (!equal_allocators(_index2object_tuple, o._index2object_tuple)
+			|| !equal_allocators(_object2index_tuple, o._object2index_tuple))
+		{
+			type tmp(std::move(o));
+			o = std::move(*this);
+			*this = std::move(tmp);
+			return;
+		}
+
+		swap(_object2index_tuple, o._object2index_tuple);
+		swap(_index2object_tuple, o._index2object_tuple);
+		swap(_end_idx, o._end_idx);
+		swap(_erased, o._erased);
+		swap(_superseded, o._superseded);
+		swap(_superseded_rows, o._superseded_rows);
+		swap(_pins, o._pins);
+		swap(_auto_vacuum, o._auto_vacuum);
+
+		bind_columns();
+		o.bind_columns();
+	}
+
+	size_type size() const noexcept
+	{
+		assert(_end_idx >= 0);
+		return _end_idx;
+	}
+
+	size_type empty() const noexcept
+	{
+		return size() == 0;
+	}
+
+	void clear()
+	{
+		*this = type{};
+	}
+	
+	iterator find(index_marker_type idx_marker)
+	{
+		using i2o_size_type = decltype(std::get<0>(_index2object_tuple).size());
+		
+		auto idx = idx_marker._value;
+		
+		if ((i2o_size_type) idx >= std::get<0>(_index2object_tuple).size() || idx < 0)
+			return end();
+
+		return begin() + idx;
+	}
+
+	const_iterator find(index_marker_type idx_marker) const
+	{
+		auto idx = idx_marker._value;
+		
+		if (idx >= std::get<0>(_index2object_tuple).size() || idx < 0)
+			return end();
+
+		return begin() + idx;
+	}
+
+	template<class T>
+	iterator find(const T& obj)
+	{
+		index_type idx;
+		if (!_stats.template find<column_of<T>::value, T>(object2index<T>(), obj, idx))
+			return end();
+
+		return begin() + idx;
+	}
+
+	template<class T>
+	const_iterator find(const T& obj) const
+	{
+		index_type idx;
+		if (!_stats.template find<column_of<T>::value, T>(object2index<T>(), obj, idx))
+			return end();
+
+		return begin() + idx;
+	}
+
+	// Finds by a key of other type than T (e.g. const char* or string_view
+	// for std::string objects). T is not constructed if Object2IndexT
+	// supports heterogeneous lookups (flat_unordered_map, flat_map,
+	// map::map).
+	template<class T, class Key, std::enable_if_t<!std::is_same<T, Key>::value, bool> = false>
+	iterator find(const Key& key)
+	{
+		index_type idx;
+		if (!_stats.template find<column_of<T>::value, T>(object2index<T>(), key, idx))
+			return end();
+
+		return begin() + idx;
+	}
+
+	template<class T, class Key, std::enable_if_t<!std::is_same<T, Key>::value, bool> = false>
+	const_iterator find(const Key& key) const
+	{
+		index_type idx;
+		if (!_stats.template find<column_of<T>::value, T>(object2index<T>(), key, idx))
+			return end();
+
+		return begin() + idx;
+	}
+
+	// Writes the indexes of objects [first, last) to out (no value for
+	// missing and erased objects). Big batches of independent lookups are
+	// faster than by find() if Object2IndexT has a batched find_many()
+	// (flat_unordered_map).
+	template<class ForwardIt, class OutputIt>
+	OutputIt find_many(ForwardIt first, ForwardIt last, OutputIt out) const
+	{
+		using T = typename std::iterator_traits<ForwardIt>::value_type;
+		return _stats.template find_many<column_of<T>::value, index_marker_type>(object2index<T>(), first, last, out);
+	}
+
+	// the counters of Stats (zeros for no_stats)
+	stats_snapshot stats() const
+	{
+		stats_snapshot res = _stats.get();
+		res.erased = holes();
+		return res;
+	}
+
+	void reset_stats()
+	{
+		_stats.reset();
+	}
+
+	template<class T>
+	iterator strict_find(const T& obj)
+	{
+		return (types::has_no_value(obj)) ? iterator{} : find(obj);
+	}
+
+	template<class T>
+	const_iterator strict_find(const T& obj) const
+	{
+		return (types::has_no_value(obj)) ? iterator{} : find(obj);
+	}
+
+	template<class T>
+	auto lower_bound(const T& obj) const
+	{
+		return object2index<T>().lower_bound(obj);
+	}
+
+	template<class T>
+	auto upper_bound(const T& obj) const
+	{
+		return object2index<T>().upper_bound(obj);
+	}
+
+	template<class T>
+	auto equal_range(const T& obj) const
+	{
+		return object2index<T>().equal_range(obj);
+	}
+
+	// Selects rows where pred(value of the T column) is true. Walks the
+	// column only (doesn't build rows). Columns stored in contiguous chunks
+	// (chunked_vector) are scanned with vectorized comparisons for
+	// arithmetic and fixed_t types.
+	template<class T, class Pred>
+	selection scan(Pred pred) const
+	{
+		selection res(size());
+		scan_column(index2object<T>(), size(), pred, res.words());
+		for (index_type idx : _erased)
+			res.reset(idx);
+		return res;
+	}
+
+	// An immutable copy of the columns to be read without locks (see
+	// multi_way_object_indexer::snapshot)
+	snapshot_ptr snapshot() const
+	{
+		return std::make_shared<const snapshot_type>(_index2object_tuple, _end_idx);
+	}
+
+	reference operator[](index_marker_type idx)
+	{
+		index_type idx_int;
+		if (!types::get_value(idx, idx_int))
+			return reference{};
+		
+		auto it = begin() + idx_int;
+		if (it >= end())
+			return reference{};
+		else
+			return *it;
+	}
+	
+	const_reference operator[](index_marker_type idx) const
+	{
+		index_type idx_int;
+		if (!types::get_value(idx, idx_int))
+			return const_reference{};
+		
+		auto it = begin() + idx_int;
+		if (it >= end())
+			return const_reference{};
+		else
+			return *it;
+	}
+	
+	template<class T>
+	reference operator[](const T& obj)
+	{
+		auto it = find(obj);
+		if (it < begin() || it >= end())
+			return reference{};
+		else
+			return *it;
+	}
+	
+	template<
+		class T,
+		std::enable_if_t<!std::is_same<T, index_marker_type>::value, bool> = false
+	>
+	const_reference operator[](const T& obj) const
+	{
+		auto it = find(obj);
+		if (it < begin() || it >= end())
+			return const_reference{};
+		else
+			return *it;
+	}
+	
+	
+	template<class T>
+	reference at(const T& obj)
+	{
+		auto it = find(obj);
+		if (it < begin() || it >= end())
+			throw std::out_of_range("two_way_object_indexer at()");
+		else
+			return *it;
+	}
+
+	template<class T>
+	const_reference at(const T& obj) const
+	{
+		auto it = find(obj);
+		if (it < begin() || it >= end())
+			throw std::out_of_range("two_way_object_indexer at()");
+		else
+			return *it;
+	}
+
+	void erase(const iterator& it)
+	{
+		if (it.is_no_value())
+			return; // false;
+
+		if (it < begin() || it >= end())
+			return; // false;
+
+		// its entry in _superseded is skipped by vacuum()
+		_superseded_rows.erase(it._idx);
+		erase_int(it._idx);
+	}
+
+	// the number of erased rows not reused yet by push_in_hole
+	size_type holes() const noexcept
+	{
+		return _erased.size();
+	}
+
+	// Moves the last rows into the holes left by erase() and shrinks
+	// the columns. Returns old index -> new index map (no value for
+	// erased rows); indexes not mentioned there (>= the returned size) are
+	// invalid. Pinned rows (see pin()) and rows before them are not
+	// moved, the holes among them stay.
+	std::vector<index_marker_type> compact()
+	{
+		assert(_end_idx >= 0);
+		std::vector<index_marker_type> remap;
+		remap.reserve(_end_idx);
+		for (index_type idx = 0; idx < _end_idx; ++idx)
+			remap.push_back(index_marker_type{idx});
+
+		std::sort(_erased.begin(), _erased.end());
+		_erased.erase(std::unique(_erased.begin(), _erased.end()), _erased.end());
+
+		for (index_type hole : _erased)
+			remap[hole] = index_marker_type{};
+
+		// rows before a pinned one are not moved
+		index_type pinned_end = 0;
+		if (_pins)
+			for (index_type idx : *_pins)
+				if (idx < _end_idx)
+					pinned_end = std::max(pinned_end, idx + 1);
+
+		// fill the first holes from the end
+		auto hole = _erased.begin();
+		auto last_hole = _erased.end();
+		index_type last = _end_idx - 1;
+		while (hole != last_hole && last >= pinned_end)
+		{
+			if (last == *(last_hole - 1))
+			{
+				--last_hole; // the last row is a hole itself
+				--last;
+				continue;
+			}
+
+			assert(*hole < last);
+			tuple_helper_2w::template for_each_no_result_forward_args<move_row_functor_2w>(
+				_object2index_tuple,
+				_index2object_tuple,
+				last,
+				*hole
+			);
+			tuple_helper_1w::template for_each_no_result_forward_args<move_row_functor_1w>(
+				_index2object_tuple,
+				last,
+				*hole
+			);
+			remap[last] = index_marker_type{*hole};
+			++hole;
+			--last;
+		}
+
+		// the holes before pinned rows stay
+		const auto filled = hole - _erased.begin();
+		_erased.erase(last_hole, _erased.end());
+		_erased.erase(_erased.begin(), _erased.begin() + filled);
+
+		_end_idx = last + 1;
+		tuple_helper_all::template for_each_no_result_forward_args<truncate_functor>(
+			_index2object_tuple,
+			(std::size_t) _end_idx
+		);
+
+		// drop the entries of erased rows
+		std::deque<index_type> superseded;
+		std::unordered_set<index_type> superseded_rows;
+		for (index_type idx : _superseded)
+		{
+			if (_superseded_rows.erase(idx) == 0)
+				continue;
+
+			types::get_value(remap[idx], idx);
+			superseded.push_back(idx);
+			superseded_rows.insert(idx);
+		}
+		_superseded = std::move(superseded);
+		_superseded_rows = std::move(superseded_rows);
+		return remap;
+	}
+
+#if 1
+	// Rewrites 1-way objects of the row found by key or inserts a new row.
+	// The key is looked up once (see emplace_int()).
+	template<class Key, class... Pars>
+	std::pair<reference, bool> update_or_insert(const Key& key, Pars&&... pars)
+	{
+		auto res = emplace_int<true>(key, std::forward<Pars>(pars)...);
+		assert((*res.first).template by_type<const Key>() == key);
+		return std::make_pair(*res.first, res.second);
+	}
+
+	// Inserts a row if there is no row with key, like std::map::try_emplace
+	// doesn't touch pars otherwise. Returns the row and true if inserted.
+	template<class Key, class... Pars>
+	std::pair<iterator, bool> try_emplace(const Key& key, Pars&&... pars)
+	{
+		return emplace_int<false>(key, std::forward<Pars>(pars)...);
+	}
+
+	// this one should be used to modify 2-way objects
+	// it keeps the old i2o row but removes all key references to it
+	// (the old row is superseded, see vacuum())
+	// returns true if the old row was not found by `key` (so logically it is a new row)
+	// NB when a map containing `key` is a multimap be ready to call Houston
+	template<class Key, class... Pars>
+	bool push_back_as_update(const Key& key, Pars&&... pars)
+	{
+		const auto old_it = find(key);
+		if (old_it == end())
+		{
+			push_back(std::forward_as_tuple(key, std::forward<Pars>(pars)...));
+			return true; 
+		}
+
+		index_type old_idx;
+		if (!types::get_value((*old_it).index(), old_idx))
+		{
+			assert(false);
+			return false;
+		}
+
+		if (_auto_vacuum)
+			vacuum(auto_vacuum_step);
+
+		// insert a new row, i2o only yet
+		// NB both 1w and 2w objects
+		index_type new_idx = _end_idx;
+		if (_auto_vacuum && !_erased.empty())
+		{
+			new_idx = _erased.back();
+			_erased.pop_back();
+			tuple_helper_all::template for_each_no_result_forward_args<assign_functor>(
+				_index2object_tuple,
+				value_type::make_value_tuple(std::forward_as_tuple(key, std::forward<Pars>(pars)...)),
+				new_idx
+			);
+		}
+		else
+		{
+			tuple_helper_all::template for_each_no_result_forward_args<push_functor_1w>(
+				_index2object_tuple,
+				value_type::make_value_tuple(std::forward_as_tuple(key, std::forward<Pars>(pars)...)),
+				_end_idx
+			);
+			++_end_idx;
+		}
+
+		tuple_helper_2w::template for_each_no_result_forward_args<update_keys_functor_2w>(
+			_object2index_tuple,
+			_index2object_tuple,
+			old_idx,
+			new_idx
+		);
+		_superseded.push_back(old_idx);
+		_superseded_rows.insert(old_idx);
+		
+		return false;
+	}
+#endif
+
+	// the number of rows superseded by push_back_as_update() and not
+	// erased yet
+	size_type superseded() const noexcept
+	{
+		return _superseded_rows.size();
+	}
+
+	// Erases (up to max_rows) superseded rows which are not pinned, the
+	// oldest first. Their indexes are reused by push_in_hole() and by the
+	// following updates. Returns the number of erased rows.
+	size_type vacuum(size_type max_rows = std::numeric_limits<size_type>::max())
+	{
+		size_type n = 0;
+		for (size_type left = _superseded.size(); left > 0 && n < max_rows; --left)
+		{
+			const index_type idx = _superseded.front();
+			_superseded.pop_front();
+			if (_superseded_rows.count(idx) == 0)
+				continue; // erased by erase()
+
+			if (_pins && _pins->count(idx) != 0)
+			{
+				_superseded.push_back(idx); // try later
+				continue;
+			}
+
+			_superseded_rows.erase(idx);
+			erase_int(idx);
+			++n;
+		}
+		return n;
+	}
+
+	// With auto vacuum each push_back_as_update() erases up to
+	// auto_vacuum_step superseded rows and writes the new row to a hole,
+	// so rolling updates don't grow the columns
+	void set_auto_vacuum(bool on) noexcept
+	{
+		_auto_vacuum = on;
+	}
+
+	bool auto_vacuum() const noexcept
+	{
+		return _auto_vacuum;
+	}
+
+	static constexpr size_type auto_vacuum_step = 2;
+
+	// Keeps the row idx (superseded or not) from vacuum() until the pin
+	// is released. compact() doesn't move pinned rows. NB erase() ignores
+	// pins.
+	row_pin<Index> pin(index_marker_type idx)
+	{
+		index_type idx_int;
+		if (!types::get_value(idx, idx_int) || idx_int < 0 || idx_int >= _end_idx)
+			return row_pin<Index>{};
+
+		if (!_pins)
+			_pins = std::make_shared<typename row_pin<Index>::pin_set>();
+		return row_pin<Index>(_pins, idx_int);
+	}
+	
+protected:
+	iterator push_back_int(value_tuple&& tup)
+	{
+		// 2 way objects
+		
+		tuple_helper_2w::template for_each_no_result_forward_args<push_functor_2w>(
+			_object2index_tuple,
+			_index2object_tuple,
+			std::move(tup),
+			_end_idx
+		);
+
+		// 1 way objects
+
+		tuple_helper_1w::template for_each_no_result_forward_args<push_functor_1w>(
+			_index2object_tuple,
+			std::move(tup),
+			_end_idx
+		);
+
+		return iterator(&_index2object_tuple, _end_idx++);
+	}
+	
+	// The key is looked up once, on a miss its o2i map position is
+	// reused by the insert (see single_probe). The columns are constructed
+	// in place from key and pars, not through a value_tuple.
+	template<bool Update, class Key, class... Pars>
+	std::pair<iterator, bool> emplace_int(const Key& key, Pars&&... pars)
+	{
+		static_assert(
+			row_fits<std::tuple<Key, Pars...>, value_tuple>::value,
+			"source tuple contains type not used in the destination tuple"
+		);
+		using probe = single_probe<
+			Object2IndexT<std::reference_wrapper<const Key>, Index>,
+			stats_counters_type::counts_probes
+		>;
+
+		auto& o2i = object2index<Key>();
+		const auto pos = probe::find(o2i, key);
+		const bool found = probe::found(o2i, pos, key);
+		_stats.template lookup<column_of<Key>::value>(found, probe::probes(pos));
+		if (found)
+		{
+			const index_type idx = probe::mapped(o2i, pos);
+			update_int(std::integral_constant<bool, Update>(), idx, std::forward<Pars>(pars)...);
+			return std::make_pair(begin() + idx, false);
+		}
+
+		// a tuple of references, each column takes only its own object
+		auto args = std::forward_as_tuple(key, std::forward<Pars>(pars)...);
+		tuple_helper_2w::template for_each_no_result_forward_args<emplace_functor_2w>(
+			_object2index_tuple,
+			_index2object_tuple,
+			std::move(args),
+			_end_idx,
+			&key
+		);
+		tuple_helper_1w::template for_each_no_result_forward_args<emplace_functor_1w>(
+			_index2object_tuple,
+			std::move(args),
+			_end_idx
+		);
+		probe::emplace(o2i, pos, index2object<Key>().back(), _end_idx);
+
+		return std::make_pair(iterator(&_index2object_tuple, _end_idx++), true);
+	}
+
+	template<class... Pars>
+	void update_int(std::true_type, index_type idx, Pars&&... pars)
+	{
+		tuple::helper<std::tuple<Pars...>>::template for_each_no_result_forward_args<protect<TwoWayObjects>::template rewrite_functor_1w>(
+			_index2object_tuple,
+			std::forward_as_tuple(std::forward<Pars>(pars)...),
+			index_marker_type{idx}
+		);
+	}
+
+	template<class... Pars>
+	void update_int(std::false_type, index_type, Pars&&...)
+	{
+	}
+
+	void erase_int(index_type idx)
+	{
+		_erased.push_back(idx);
+		
+		tuple_helper_2w::template for_each_no_result_forward_args<erase_functor_2w>(
+			_object2index_tuple,
+			_index2object_tuple,
+			idx
+		);
+		tuple_helper_1w::template for_each_no_result_forward_args<erase_functor_1w>(
+			_index2object_tuple,
+			idx
+		);
+	}
+
+	iterator push_in_hole_int(value_tuple&& tup)
+	{
+		if (_erased.empty()) { // there is no hole, push back
+			return push_back_int(std::move(tup));
+		}
+		
+		const index_type idx = _erased.back();
+		_erased.pop_back();
+
+		tuple_helper_2w::template for_each_no_result_forward_args<rewrite_functor_2w>(
+			_object2index_tuple,
+			_index2object_tuple,
+			std::move(tup),
+			idx
+		);
+
+		// 1 way objects
+
+		tuple_helper_1w::template for_each_no_result_forward_args<protect<TwoWayObjects>::template rewrite_functor_1w>(
+			_index2object_tuple,
+			std::move(tup),
+			index_marker_type{idx}
+		);
+
+		return iterator(&_index2object_tuple, idx);
+	}
+
+	void reserve_int(size_type n)
+	{
+		tuple_helper_2w::template for_each_no_result_forward_args<reserve_functor_2w>(
+			_object2index_tuple,
+			_index2object_tuple,
+			n
+		);
+		tuple_helper_1w::template for_each_no_result_forward_args<reserve_functor_1w>(
+			_index2object_tuple,
+			n
+		);
+	}
+
+	// must be called each time the columns change their address
+	void bind_columns()
+	{
+		tuple_helper_2w::template for_each_no_result_forward_args<bind_functor_2w>(
+			_object2index_tuple,
+			_index2object_tuple
+		);
+	}
+
+	// must be called each time the columns move their elements
+	void reindex()
+	{
+		tuple_helper_2w::template for_each_no_result_forward_args<reindex_functor_2w>(
+			_object2index_tuple,
+			_index2object_tuple
+		);
+	}
+	
+	template<class T>
+	Object2IndexT<std::reference_wrapper<const T>, Index>& object2index()
+	{
+		static_assert(
+			tuple::among_tuple_types<T, TwoWayObjects>::value,
+			"Unable to index the collection by the type not specified in TwoWayObjects"
+		);
+		return std::get<Object2IndexT<std::reference_wrapper<const T>, Index>>(_object2index_tuple);
+	}
+
+	template<class T>
+	const Object2IndexT<std::reference_wrapper<const T>, Index>& object2index() const
+	{
+		static_assert(
+			tuple::among_tuple_types<T, TwoWayObjects>::value,
+			"Unable to index the collection by the type not specified in TwoWayObjects"
+		);
+		return std::get<Object2IndexT<std::reference_wrapper<const T>, Index>>(_object2index_tuple);
+	}
+
+	template<class T>
+	Index2ObjectT<T>& index2object()
+	{
+		return std::get<Index2ObjectT<T>>(_index2object_tuple);
+	}
+
+	template<class T>
+	const Index2ObjectT<T>& index2object() const
+	{
+		return std::get<Index2ObjectT<T>>(_index2object_tuple);
+	}
+
+private:
+	friend struct image_access;
+
+	objects2index_tuple _object2index_tuple;
+	index2objects_tuple _index2object_tuple;
+	index_type _end_idx = 0;
+	std::vector<index_type> _erased; // the free list
+	std::deque<index_type> _superseded; // by push_back_as_update, the oldest first
+	std::unordered_set<index_type> _superseded_rows; // the rows of _superseded not erased yet
+	std::shared_ptr<typename row_pin<Index>::pin_set> _pins; // created by the first pin()
+	bool _auto_vacuum = false;
+	stats_counters_type _stats;
+};
+
+template<
+	template<class, class> class O2I,
+	template<class> class I2O,
+	class I,
+	class TWO,
+	class OWO,
+	class S
+>
+constexpr typename type<O2I, I2O, I, TWO, OWO, S>::size_type type<O2I, I2O, I, TWO, OWO, S>::auto_vacuum_step;
+
+namespace sharded
+{
+
+/**
+ * A concurrent indexer which partitions rows among Shards
+ * multi_way_object_indexer::type instances by the hash of the primary
+ * (the first 2-way) object. Each shard has its own mutex, so inserts
+ * into different shards don't block each other.
+ *
+ * The index returned is local_index * Shards + shard, so a lookup by
+ * the index is O(1). A lookup by the primary object visits one shard,
+ * by other 2-way objects - all shards.
+ *
+ * Other 2-way objects are unique among all shards: an insert of a row
+ * having one already indexed in any shard is rejected (push_back and
+ * update_or_insert return no value). They are registered in Shards
+ * stripes selected by their hashes, an insert locks its shard and only
+ * the stripes of its objects, so inserts into different shards still run
+ * in parallel.
+ *
+ * Rows are returned by value (copied under the shard lock).
+ */
+template<
+	template<class, class> class Object2IndexT,
+	template<class> class Index2ObjectT,
+	class Index,
+	class TwoWayObjects,
+	class OneWayObjects,
+	std::size_t Shards = 16,
+	class Mutex = std::shared_timed_mutex
+>
+class type
+{
+	static_assert(Shards > 0, "sharded::type: no shards");
+
+	using shard_type = multi_way_object_indexer::type<
+		Object2IndexT,
+		Index2ObjectT,
+		Index,
+		TwoWayObjects,
+		OneWayObjects
+	>;
+
+public:
+	using index_type = Index;
+	using index_marker_type = marker::type<marker::index_marker, Index>;
+	using primary_type = std::tuple_element_t<0, TwoWayObjects>;
+	using value_type = typename shard_type::value_type;
+	using value_tuple = typename shard_type::value_tuple;
+	using const_reference = typename shard_type::const_reference;
+	using size_type = typename shard_type::size_type;
+
+	using mutex_type = Mutex;
+	using unique_lock = std::unique_lock<mutex_type>;
+	using read_lock = std::conditional_t<
+		thread_safe::is_shared_mutex<mutex_type>::value,
+		std::shared_lock<mutex_type>,
+		unique_lock
+	>;
+
+	static constexpr std::size_t shards = Shards;
+
+	type() {}
+
+	type(const type&) = delete;
+
+	type& operator=(const type&) = delete;
+
+	// returns no value if a non-primary 2-way object of v is already
+	// indexed (see the class description)
+	template<class... Ts>
+	index_marker_type push_back(std::tuple<Ts...>&& v)
+	{
+		value_tuple tup = value_type::make_value_tuple(std::move(v));
+		const std::size_t s = shard_of(std::get<primary_type>(tup));
+
+		unique_lock lock(_shards[s].mutex);
+		return push_back_int(s, std::move(tup));
+	}
+
+	template<class Key, class... Pars>
+	std::pair<index_marker_type, bool> update_or_insert(const Key& key, Pars&&... pars)
+	{
+		static_assert(
+			std::is_same<Key, primary_type>::value,
+			"sharded::type: update_or_insert is possible only by the primary object"
+		);
+		const std::size_t s = shard_of(key);
+		unique_lock lock(_shards[s].mutex);
+		shard_type& data = _shards[s].data;
+
+		// a full shard inserts only through push_back_int() which throws
+		if ((!has_secondaries && has_index_space(s)) || data.find(key) != data.end())
+		{
+			// 2-way objects are not updated
+			auto res = data.update_or_insert(key, std::forward<Pars>(pars)...);
+			return std::make_pair(global_index(s, res.first.index()), res.second);
+		}
+
+		const index_marker_type idx = push_back_int(
+			s,
+			value_type::make_value_tuple(std::make_tuple(key, std::forward<Pars>(pars)...))
+		);
+		return std::make_pair(idx, idx != index_marker_type{});
+	}
+
+	void erase(index_marker_type idx)
+	{
+		std::size_t s;
+		index_marker_type local;
+		if (!split_index(idx, s, local))
+			return;
+
+		unique_lock lock(_shards[s].mutex);
+		shard_type& data = _shards[s].data;
+		const auto it = data.find(local);
+		if (has_secondaries && it != data.end())
+		{
+			const value_tuple tup = (*it).value().get_value_tuple();
+			const auto locks = lock_stripes(tup);
+			unregister_secondaries(tup, secondary_sequence());
+		}
+		data.erase(it);
+	}
+
+	// returns no value if obj is not found
+	template<class T>
+	index_marker_type find(const T& obj) const
+	{
+		index_marker_type result;
+		visit_shards_for(obj, [&](std::size_t s, const shard_type& data) {
+			const auto it = data.find(obj);
+			if (it == data.end())
+				return false;
+
+			result = global_index(s, (*it).index());
+			return true;
+		});
+		return result;
+	}
+
+	value_type operator[](index_marker_type idx) const
+	{
+		std::size_t s;
+		index_marker_type local;
+		if (!split_index(idx, s, local))
+			return value_type{};
+
+		read_lock lock(_shards[s].mutex);
+		return copy_row(s, _shards[s].data[local]);
+	}
+
+	template<
+		class T,
+		std::enable_if_t<!std::is_same<T, index_marker_type>::value, bool> = false
+	>
+	value_type operator[](const T& obj) const
+	{
+		value_type result;
+		visit_shards_for(obj, [&](std::size_t s, const shard_type& data) {
+			const auto it = data.find(obj);
+			if (it == data.end())
+				return false;
+
+			result = copy_row(s, *it);
+			return true;
+		});
+		return result;
+	}
+
+	template<class T>
+	value_type at(const T& obj) const
+	{
+		value_type result = operator[](obj);
+		if (result.is_no_value())
+			throw std::out_of_range("sharded::type at()");
+		return result;
+	}
+
+	// calls fun(index_marker_type, const_reference) for each row,
+	// shard by shard, each shard is read-locked during the call
+	template<class Fun>
+	void for_each(Fun fun) const
+	{
+		for (std::size_t s = 0; s < Shards; ++s)
+		{
+			read_lock lock(_shards[s].mutex);
+			const shard_type& data = _shards[s].data;
+			for (auto it = data.begin(); it != data.end(); ++it)
+			{
+				const auto row = *it;
+				if (!row.is_no_value())
+					fun(global_index(s, row.index()), row);
+			}
+		}
+	}
+
+	// NB it is only a snapshot when other threads insert rows
+	size_type size() const
+	{
+		size_type result = 0;
+		for (std::size_t s = 0; s < Shards; ++s)
+		{
+			read_lock lock(_shards[s].mutex);
+			result += _shards[s].data.size();
+		}
+		return result;
+	}
+
+	static std::size_t shard_of(const primary_type& obj)
+	{
+		return slot_of(obj);
+	}
+
+protected:
+	struct shard
+	{
+		mutable mutex_type mutex;
+		shard_type data;
+	};
+
+	static constexpr std::size_t secondaries = std::tuple_size<TwoWayObjects>::value - 1;
+	static constexpr bool has_secondaries = secondaries > 0;
+
+	using secondary_sequence = std::make_index_sequence<secondaries>;
+
+	template<std::size_t I>
+	using secondary_t = std::tuple_element_t<I + 1, TwoWayObjects>;
+
+	template<class Tuple>
+	struct object_sets;
+
+	template<class... Ts>
+	struct object_sets<std::tuple<Ts...>>
+	{
+		using type = std::tuple<std::unordered_set<Ts, marker::hash<Ts>>...>;
+	};
+
+	// registers non-primary 2-way objects of all shards having the same
+	// slot_of(), the set of the primary object is not used
+	struct stripe
+	{
+		std::mutex mutex;
+		typename object_sets<TwoWayObjects>::type objects;
+	};
+
+	using stripe_locks = std::array<std::unique_lock<std::mutex>, secondaries>;
+
+	template<class T>
+	static std::size_t slot_of(const T& obj)
+	{
+		// fibonacci hashing, std::hash of integers is identity
+		const std::uint64_t h = static_cast<std::uint64_t>(marker::hash<T>()(obj)) * 0x9E3779B97F4A7C15ull;
+		return static_cast<std::size_t>(h >> 32) % Shards;
+	}
+
+	// the shard s should be locked, returns no value if a non-primary
+	// 2-way object of tup is already indexed
+	index_marker_type push_back_int(std::size_t s, value_tuple&& tup)
+	{
+		if (!has_index_space(s))
+			throw std::length_error("sharded::type: too many rows");
+
+		const auto locks = lock_stripes(tup);
+		if (is_indexed_secondary(tup, secondary_sequence()))
+			return index_marker_type{};
+
+		register_secondaries(tup, secondary_sequence());
+		return global_index(s, (*_shards[s].data.push_back(std::move(tup))).index());
+	}
+
+	// locks the stripes of non-primary 2-way objects of tup, always
+	// after the shard lock and in the stripe order, so there are no
+	// deadlocks
+	stripe_locks lock_stripes(const value_tuple& tup)
+	{
+		return lock_stripes(tup, secondary_sequence());
+	}
+
+	template<std::size_t... I>
+	stripe_locks lock_stripes(const value_tuple& tup, std::index_sequence<I...>)
+	{
+		std::array<std::size_t, secondaries> slots = {{ slot_of(std::get<secondary_t<I>>(tup))... }};
+		std::sort(slots.begin(), slots.end());
+
+		stripe_locks locks;
+		for (std::size_t k = 0; k < secondaries; ++k)
+			if (k == 0 || slots[k] != slots[k - 1])
+				locks[k] = std::unique_lock<std::mutex>(_stripes[slots[k]].mutex);
+		return locks;
+	}
+
+	// the stripes of tup should be locked
+	template<std::size_t... I>
+	bool is_indexed_secondary(const value_tuple& tup, std::index_sequence<I...>) const
+	{
+		const bool indexed[] = {
+			false,
+			(std::get<I + 1>(stripe_for<I>(tup).objects).count(std::get<secondary_t<I>>(tup)) > 0)...
+		};
+		return std::find(std::begin(indexed), std::end(indexed), true) != std::end(indexed);
+	}
+
+	template<std::size_t... I>
+	void register_secondaries(const value_tuple& tup, std::index_sequence<I...>)
+	{
+		const int dummy[] = {
+			0,
+			(std::get<I + 1>(stripe_for<I>(tup).objects).insert(std::get<secondary_t<I>>(tup)), 0)...
+		};
+		(void) dummy;
+	}
+
+	template<std::size_t... I>
+	void unregister_secondaries(const value_tuple& tup, std::index_sequence<I...>)
+	{
+		const int dummy[] = {
+			0,
+			(std::get<I + 1>(stripe_for<I>(tup).objects).erase(std::get<secondary_t<I>>(tup)), 0)...
+		};
+		(void) dummy;
+	}
+
+	template<std::size_t I>
+	stripe& stripe_for(const value_tuple& tup) const
+	{
+		return _stripes[slot_of(std::get<secondary_t<I>>(tup))];
+	}
+
+	// the greatest global index, it is not the no value of index_marker_type
+	static index_type max_global_index()
+	{
+		const index_type max = std::numeric_limits<index_type>::max();
+		return (types::no_value_value<index_marker_type>() == max) ? max - 1 : max;
+	}
+
+	// true if the local index of a new row of the shard s has a global index,
+	// the shard s should be locked
+	bool has_index_space(std::size_t s) const
+	{
+		const auto local = _shards[s].data.size();
+		return local <= (typename shard_type::size_type) ((max_global_index() - (index_type) s) / (index_type) Shards);
+	}
+
+	static index_marker_type global_index(std::size_t s, index_marker_type local)
+	{
+		index_type local_int;
+		if (!types::get_value(local, local_int))
+			return index_marker_type{};
+
+		if (local_int < 0 || local_int > (max_global_index() - (index_type) s) / (index_type) Shards)
+			throw std::length_error("sharded::type: too many rows");
+
+		return index_marker_type{static_cast<index_type>(local_int * (index_type) Shards + (index_type) s)};
+	}
+
+	static bool split_index(index_marker_type idx, std::size_t& s, index_marker_type& local)
+	{
+		index_type idx_int;
+		if (!types::get_value(idx, idx_int) || idx_int < 0)
+			return false;
+
+		s = static_cast<std::size_t>(idx_int % (index_type) Shards);
+		local = index_marker_type{static_cast<index_type>(idx_int / (index_type) Shards)};
+		return true;
+	}
+
+	template<class Ref>
+	static value_type copy_row(std::size_t s, const Ref& row)
+	{
+		if (row.is_no_value())
+			return value_type{};
+
+		return value_type(global_index(s, row.index()), row.value().get_value_tuple());
+	}
+
+	// the primary object selects one shard
+	template<class Fun>
+	void visit_shards_for(const primary_type& obj, Fun fun) const
+	{
+		const std::size_t s = shard_of(obj);
+		read_lock lock(_shards[s].mutex);
+		fun(s, _shards[s].data);
+	}
+
+	// any other object visits all shards until fun returns true
+	template<class T, class Fun>
+	void visit_shards_for(const T&, Fun fun) const
+	{
+		for (std::size_t s = 0; s < Shards; ++s)
+		{
+			read_lock lock(_shards[s].mutex);
+			if (fun(s, _shards[s].data))
+				return;
+		}
 	}
 
-	bool operator<=(const iterator& it) const
-	{
-		return !(*this > it);
-	}
+private:
+	std::array<shard, Shards> _shards;
+	mutable std::array<stripe, has_secondaries ? Shards : 0> _stripes;
+};
+
+template<
+	template<class, class> class O2I,
+	template<class> class I2O,
+	class I,
+	class TWO,
+	class OWO,
+	std::size_t Shards,
+	class M
+>
+constexpr std::size_t type<O2I, I2O, I, TWO, OWO, Shards, M>::shards;
+
+template<
+	template<class, class> class O2I,
+	template<class> class I2O,
+	class I,
+	class TWO,
+	class OWO,
+	std::size_t Shards,
+	class M
+>
+constexpr std::size_t type<O2I, I2O, I, TWO, OWO, Shards, M>::secondaries;
+
+template<
+	template<class, class> class O2I,
+	template<class> class I2O,
+	class I,
+	class TWO,
+	class OWO,
+	std::size_t Shards,
+	class M
+>
+constexpr bool type<O2I, I2O, I, TWO, OWO, Shards, M>::has_secondaries;
+
+} // namespace sharded
+
+} // namespace multi_way_object_indexer
+
+// Strings and string markers are hashed and compared by their views, so
+// maps of them can be searched by any object which has a view
+// (const char*, std::string, string_view) without constructing the key.
+inline string_view lookup_view(string_view s)
+{
+	return s;
+}
+
+template<class M, class T>
+auto lookup_view(const marker::type<M, T>& m) -> decltype(lookup_view(m._value))
+{
+	return lookup_view(m._value);
+}
+
+template<class T>
+auto lookup_view(std::reference_wrapper<T> r) -> decltype(lookup_view(r.get()))
+{
+	return lookup_view(r.get());
+}
+
+namespace impl_
+{
+
+template<class T, class Enable = void>
+struct has_lookup_view : std::false_type {};
+
+template<class T>
+struct has_lookup_view<T, types::void_t<decltype(lookup_view(std::declval<const T&>()))>> : std::true_type {};
+
+template<class K, class Enable = void>
+struct ref_hash
+{
+	using hash = marker::hash<K>;
+
+	std::size_t operator()(const K& k) const { return hash()(k); }
+};
+
+template<class K>
+struct ref_hash<K, std::enable_if_t<has_lookup_view<K>::value>>
+{
+	using is_transparent = void;
+
+	template<class U>
+	std::size_t operator()(const U& u) const { return std::hash<string_view>()(lookup_view(u)); }
+};
+
+template<class T, class Enable = void>
+struct ref_less
+{
+	using less = std::less<T>;
+
+	bool operator()(const T& a, const T& b) const { return less()(a, b); }
+};
+
+template<class T>
+struct ref_less<T, std::enable_if_t<has_lookup_view<T>::value>>
+{
+	using is_transparent = void;
+
+	template<class A, class B>
+	bool operator()(const A& a, const B& b) const { return lookup_view(a) < lookup_view(b); }
+};
 
-	bool is_no_value() const
-	{
-		return types::has_no_value(index_marker_type{_idx});
-	}
+template<class T, class Enable = void>
+struct ref_equal_to
+{
+	using equal_to = std::equal_to<T>;
+
+	bool operator()(const T& a, const T& b) const { return equal_to()(a, b); }
+};
+
+template<class T>
+struct ref_equal_to<T, std::enable_if_t<has_lookup_view<T>::value>>
+{
+	using is_transparent = void;
+
+	template<class A, class B>
+	bool operator()(const A& a, const B& b) const { return lookup_view(a) == lookup_view(b); }
+};
+
+} // namespace impl_
+
+template<class Key>
+struct ref_hash : marker::hash<Key> {};
+
+template<class K>
+struct ref_hash<std::reference_wrapper<K>> : impl_::ref_hash<std::remove_const_t<K>> {};
+
+template<class K>
+struct ref_hash<std::reference_wrapper<const K>> : impl_::ref_hash<K> {};
+
+template<class T>
+struct ref_less : std::less<T> {};
+
+template<class T>
+struct ref_less<T&> : impl_::ref_less<std::remove_const_t<T>> {};
+
+template<class T>
+struct ref_less<std::reference_wrapper<T>> : impl_::ref_less<std::remove_const_t<T>> {};
+
+template<class T>
+struct ref_equal_to : std::equal_to<T> {};
+
+template<class T>
+struct ref_equal_to<std::reference_wrapper<T>> : impl_::ref_equal_to<std::remove_const_t<T>> {};
+
+// all default parameters except Key and Value
+template<class Key, class T>
+using map = std::map<Key, T, ref_less<Key>>;
+
+template<class Key, class T>
+using multimap = std::multimap<Key, T, ref_less<Key>>;
+
+template<class Key, class T>
+using unordered_map = std::unordered_map<Key, T, ref_hash<Key>, ref_equal_to<Key>>;
+
+// Don't use vector! (we should guarantee constant memory position with elements)
+template<class T>
+using deque = std::deque<T>;
+
+// The containers above with polymorphic allocators. An indexer of them
+// constructed by type(std::allocator_arg, alloc) allocates all rows and
+// nodes from the memory resource of alloc, e.g. an arena dropped at once.
+namespace pmr
+{
+
+#if __cplusplus >= 201703L
+using std::pmr::memory_resource;
+using std::pmr::polymorphic_allocator;
+using std::pmr::get_default_resource;
+#else
+using std::experimental::pmr::memory_resource;
+using std::experimental::pmr::polymorphic_allocator;
+using std::experimental::pmr::get_default_resource;
+#endif
+
+template<class Key, class T>
+using map = std::map<Key, T, ref_less<Key>, polymorphic_allocator<std::pair<const Key, T>>>;
+
+template<class Key, class T>
+using multimap = std::multimap<Key, T, ref_less<Key>, polymorphic_allocator<std::pair<const Key, T>>>;
+
+template<class Key, class T>
+using unordered_map = std::unordered_map<
+	Key,
+	T,
+	ref_hash<Key>,
+	ref_equal_to<Key>,
+	polymorphic_allocator<std::pair<const Key, T>>
+>;
+
+template<class T>
+using deque = std::deque<T, polymorphic_allocator<T>>;
+
+} // namespace pmr
+
+// A random access iterator over a container with operator[] (Value is
+// const for const iterators)
+template<class Container, class Value>
+class index_iterator
+{
+	friend Container;
+
+	template<class C, class V>
+	friend class index_iterator;
+
+	using container = std::conditional_t<std::is_const<Value>::value, const Container, Container>;
+	using size_type = typename Container::size_type;
+
+	container* _c = nullptr;
+	size_type _idx = 0;
+
+	index_iterator(container* c, size_type idx) : _c(c), _idx(idx) {}
+
+public:
+	using iterator_category = std::random_access_iterator_tag;
+	using value_type = std::remove_const_t<Value>;
+	using difference_type = std::ptrdiff_t;
+	using reference = Value&;
+	using pointer = Value*;
+
+	index_iterator() {}
+
+	// iterator -> const_iterator
+	template<class V, std::enable_if_t<std::is_same<const V, Value>::value, bool> = false>
+	index_iterator(const index_iterator<Container, V>& o) : _c(o._c), _idx(o._idx) {}
+
+	reference operator*() const { return (*_c)[_idx]; }
+
+	pointer operator->() const { return &(*_c)[_idx]; }
+
+	reference operator[](difference_type k) const { return (*_c)[_idx + k]; }
+
+	index_iterator& operator++() { ++_idx; return *this; }
+
+	index_iterator operator++(int) { index_iterator copy = *this; ++_idx; return copy; }
+
+	index_iterator& operator--() { --_idx; return *this; }
+
+	index_iterator operator--(int) { index_iterator copy = *this; --_idx; return copy; }
+
+	index_iterator& operator+=(difference_type k) { _idx += k; return *this; }
+
+	index_iterator& operator-=(difference_type k) { _idx -= k; return *this; }
+
+	index_iterator operator+(difference_type k) const { return index_iterator(_c, _idx + k); }
+
+	index_iterator operator-(difference_type k) const { return index_iterator(_c, _idx - k); }
+
+	difference_type operator-(const index_iterator& o) const { return (difference_type) _idx - (difference_type) o._idx; }
+
+	bool operator==(const index_iterator& o) const { return _idx == o._idx; }
+
+	bool operator!=(const index_iterator& o) const { return _idx != o._idx; }
+
+	bool operator<(const index_iterator& o) const { return _idx < o._idx; }
+
+	bool operator>(const index_iterator& o) const { return _idx > o._idx; }
+
+	bool operator<=(const index_iterator& o) const { return _idx <= o._idx; }
+
+	bool operator>=(const index_iterator& o) const { return _idx >= o._idx; }
 };
 
 /**
- * Maintains an indexed list of objects with ability to search a
- * object by an index and an index by a object.
+ * A vector of fixed size chunks of 2^ChunkBits elements. Like std::deque it
+ * never moves elements (so can be used as Index2ObjectT), but the element
+ * access is just index >> ChunkBits and index & mask, the space can be
+ * reserved and each chunk is a contiguous array (see chunk_data()).
+ *
+ * NB each chunk is allocated at once, don't use big chunks for small tables.
  */
-template<
-	template<class, class> class Object2IndexT,
-	template<class> class Index2ObjectT,
-	class Index,
-	class TwoWayObjects,
-	class OneWayObjects,
-	class Mutex = std::mutex
->
-class type
+template<class T, std::size_t ChunkBits = 10>
+class basic_chunked_vector
 {
-	using all_objects_tuple = typename tuple::helper<TwoWayObjects>::template cat<OneWayObjects>;
-	using tuple_helper_all = tuple::helper<all_objects_tuple>;
-	using tuple_helper_1w = tuple::helper<OneWayObjects>;
-	using tuple_helper_2w = tuple::helper<TwoWayObjects>;
-
-	// 2w objects are RO, 1w - RW
-	using index2objects_tuple = typename tuple::helper<typename tuple_helper_2w::template tuple_of_containers<Index2ObjectT>>::template cat<
-		typename tuple_helper_1w::template tuple_of_containers<Index2ObjectT>
-	>;
-	
-	using objects2index_tuple = typename tuple_helper_2w::template tuple_of_cref_maps<Object2IndexT, Index>;
 public:
-	using index_type = Index;
-	using index_marker_type = marker::type<marker::index_marker, Index>;
-	using iterator = multi_way_object_indexer::thread_safe::iterator<Index, index2objects_tuple, Mutex>;
-	using const_iterator = multi_way_object_indexer::thread_safe::iterator<Index, const index2objects_tuple, Mutex>;
-	
-	using difference_type = typename iterator::difference_type;
-	using size_type = typename iterator::size_type;
-	using value_type = typename iterator::value_type;
-	using value_tuple = typename value_type::value_tuple;
-	using reference = typename iterator::reference;
-	using const_reference = typename iterator::const_reference;
-	
-	using mutex_type = Mutex;
-	using lock_guard = std::lock_guard<mutex_type>;
-	using unique_lock = std::unique_lock<mutex_type>;
-	
-	// NB no pointers declared
+	using value_type = T;
+	using size_type = std::size_t;
+	using difference_type = std::ptrdiff_t;
+	using reference = T&;
+	using const_reference = const T&;
+	using pointer = T*;
+	using const_pointer = const T*;
+	using iterator = index_iterator<basic_chunked_vector, T>;
+	using const_iterator = index_iterator<basic_chunked_vector, const T>;
 
-	using reverse_iterator = std::reverse_iterator<iterator>;
-	using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+	static constexpr size_type chunk_capacity = size_type(1) << ChunkBits;
+	static constexpr size_type chunk_mask = chunk_capacity - 1;
 
-	mutable mutex_type _mutex;
-	
-	type() {}
+	basic_chunked_vector() {}
 
-	template<class... Ts>
-	type(std::initializer_list<std::tuple<Ts...>> objs)
+	basic_chunked_vector(const basic_chunked_vector& o)
 	{
-		for (auto it = objs.begin(); it != objs.end(); ++it)
-			push_back(*it);
+		reserve(o.size());
+		for (const T& v : o)
+			emplace_back(v);
 	}
 
-	// allows to construct a container from different types of arguments
-	template<class Arg0, class... Args>
-	type(Arg0&& obj0, Args&&... objs)
+	basic_chunked_vector(basic_chunked_vector&& o) noexcept
+		: _chunks(std::move(o._chunks)), _size(o._size)
 	{
-		push_back_seq(std::forward<Arg0>(obj0), std::forward<Args>(objs)...);
+		o._chunks.clear();
+		o._size = 0;
 	}
 
-	reference front()
+	~basic_chunked_vector()
 	{
-		unique_lock lock(_mutex);
-		
-		return *begin(lock);
+		clear();
+		for (T* c : _chunks)
+			std::allocator<T>().deallocate(c, chunk_capacity);
 	}
-	
-	const_reference front() const
+
+	basic_chunked_vector& operator=(const basic_chunked_vector& o)
 	{
-		unique_lock lock(_mutex);
-		
-		return *begin(lock);
+		if (this != &o)
+		{
+			basic_chunked_vector copy(o);
+			swap(copy);
+		}
+		return *this;
 	}
-	
-	reference back()
+
+	basic_chunked_vector& operator=(basic_chunked_vector&& o) noexcept
 	{
-		unique_lock lock(_mutex);
-		
-		auto it = end(lock);
-		--it;
-		return *it;
+		basic_chunked_vector moved(std::move(o));
+		swap(moved);
+		return *this;
 	}
 
-	const_reference back() const
+	size_type size() const noexcept
 	{
-		unique_lock lock(_mutex);
-		
-		auto it = end(lock);
-		--it;
-		return *it;
+		return _size;
 	}
 
-#if 0
-	// the version compatible with std::back_insert_iterator
-	void push_back(value_type&& v)
+	bool empty() const noexcept
 	{
-		lock_guard lock(_mutex);
+		return _size == 0;
+	}
 
-		push_back_int(std::move(v));
+	constexpr size_type max_size() const noexcept
+	{
+		return std::numeric_limits<difference_type>::max() / sizeof(T);
 	}
-#else
-	template<class T>
-	void push_back(T&& v)
+
+	size_type capacity() const noexcept
 	{
-		lock_guard lock(_mutex);
+		return _chunks.size() * chunk_capacity;
+	}
 
-		push_back_int(value_type::make_value_tuple(std::move(v)));
+	// allocates chunks for n elements, NB never frees chunks
+	void reserve(size_type n)
+	{
+		const size_type chunks = (n + chunk_mask) >> ChunkBits;
+		_chunks.reserve(chunks);
+		while (_chunks.size() < chunks)
+			_chunks.push_back(std::allocator<T>().allocate(chunk_capacity));
 	}
-#endif
 
-	template<class T0, class... Ts>
-	void push_back_seq(T0&& v0, Ts&&... vs)
+	template<class... Args>
+	reference emplace_back(Args&&... args)
 	{
-		push_back(std::forward<T0>(v0));
-		push_back_seq(std::forward<Ts>(vs)...);
+		if (_size == capacity())
+			reserve(_size + 1);
+
+		T* p = _chunks[_size >> ChunkBits] + (_size & chunk_mask);
+		::new ((void*) p) T(std::forward<Args>(args)...);
+		++_size;
+		return *p;
 	}
 
-	void push_back_seq()
+	void push_back(const T& v)
 	{
+		emplace_back(v);
 	}
 
-	iterator begin(const unique_lock& lock) noexcept
+	void push_back(T&& v)
 	{
-		if (lock.mutex() != &_mutex || !lock.owns_lock())
-		{
-			assert(false);
-			return iterator(lock, &_index2object_tuple);
-		}
-		
-		return iterator(lock, &_index2object_tuple, 0);
+		emplace_back(std::move(v));
 	}
-	
-	const_iterator begin(const unique_lock& lock) const noexcept
+
+	void pop_back()
 	{
-		if (lock.mutex() != &_mutex || !lock.owns_lock())
-		{
-			assert(false);
-			return const_iterator(lock, &_index2object_tuple);
-		}
-		
-		return const_iterator(lock, &_index2object_tuple, 0);
+		assert(_size > 0);
+		--_size;
+		(*this)[_size].~T();
 	}
-	
-	iterator end(const unique_lock& lock) noexcept
+
+	void clear() noexcept
 	{
-		if (lock.mutex() != &_mutex || !lock.owns_lock())
-		{
-			assert(false);
-			return iterator(lock, &_index2object_tuple);
-		}
-		
-		assert(_end_idx >= 0);
-		return iterator(lock, &_index2object_tuple, _end_idx);
+		while (_size > 0)
+			pop_back();
 	}
-	
-	const_iterator end(const unique_lock& lock) const noexcept
+
+	reference operator[](size_type i)
 	{
-		if (lock.mutex() != &_mutex || !lock.owns_lock())
-		{
-			assert(false);
-			return const_iterator(lock, &_index2object_tuple);
-		}
-		
-		assert(_end_idx >= 0);
-		return const_iterator(lock, &_index2object_tuple, _end_idx);
+		return _chunks[i >> ChunkBits][i & chunk_mask];
 	}
-	
-	const_iterator cbegin(const unique_lock& lock) const noexcept
+
+	const_reference operator[](size_type i) const
 	{
-		return begin(lock);
+		return _chunks[i >> ChunkBits][i & chunk_mask];
 	}
-	
-	const_iterator cend(const unique_lock& lock) const noexcept
+
+	reference at(size_type i)
 	{
-		return end(lock);
+		if (i >= _size)
+			throw std::out_of_range("chunked_vector at()");
+		return (*this)[i];
 	}
 
-	reverse_iterator rbegin(const unique_lock& lock) noexcept
+	const_reference at(size_type i) const
 	{
-		return std::reverse_iterator<iterator>(end(lock));
+		if (i >= _size)
+			throw std::out_of_range("chunked_vector at()");
+		return (*this)[i];
 	}
-	
-	reverse_iterator rend(const unique_lock& lock) noexcept
+
+	reference front()
 	{
-		return std::reverse_iterator<iterator>(begin(lock));
+		return (*this)[0];
 	}
-	
-	const_reverse_iterator crbegin(const unique_lock& lock) const noexcept
+
+	const_reference front() const
 	{
-		return std::reverse_iterator<const_iterator>(end(lock));
+		return (*this)[0];
 	}
-	
-	const_reverse_iterator crend(const unique_lock& lock) const noexcept
+
+	reference back()
+	{
+		return (*this)[_size - 1];
+	}
+
+	const_reference back() const
+	{
+		return (*this)[_size - 1];
+	}
+
+	iterator begin() noexcept
 	{
-		return std::reverse_iterator<const_iterator>(begin(lock));
+		return iterator(this, 0);
 	}
 
-	bool operator==(const type& o) const noexcept
+	iterator end() noexcept
 	{
-		std::lock(_mutex, o._mutex);
-		unique_lock lock(_mutex, std::adopt_lock);
-		unique_lock o_lock(o._mutex, std::adopt_lock);
-		
-		return std::equal(begin(lock), end(lock), o.begin(o_lock), o.end(o_lock));
+		return iterator(this, _size);
 	}
 
-	bool operator!=(const type& o) const noexcept
+	const_iterator begin() const noexcept
 	{
-		return !(*this == o);
+		return const_iterator(this, 0);
 	}
 
-	void swap(type& o)
+	const_iterator end() const noexcept
 	{
-		using std::swap;
+		return const_iterator(this, _size);
+	}
 
-		std::lock(_mutex, o._mutex);
-		unique_lock lock(_mutex, std::adopt_lock);
-		unique_lock o_lock(o._mutex, std::adopt_lock);
+	const_iterator cbegin() const noexcept
+	{
+		return begin();
+	}
 
-		swap(_object2index_tuple, o._object2index_tuple);
-		swap(_index2object_tuple, o._index2object_tuple);
-		swap(_end_idx, o._end_idx);
+	const_iterator cend() const noexcept
+	{
+		return end();
 	}
 
-	size_type size() const noexcept
+	// the number of chunks containing elements
+	size_type chunk_count() const noexcept
 	{
-		assert(_end_idx >= 0);
-		return _end_idx;
+		return (_size + chunk_mask) >> ChunkBits;
 	}
 
-	size_type empty() const noexcept
+	// the contiguous array of chunk_length(k) elements
+	pointer chunk_data(size_type k) noexcept
 	{
-		return size() == 0;
+		return _chunks[k];
 	}
 
-	iterator find(index_marker_type idx_marker, const unique_lock& lock)
+	const_pointer chunk_data(size_type k) const noexcept
 	{
-		if (lock.mutex() != &_mutex || !lock.owns_lock())
-		{
-			assert(false);
-			return iterator(lock, &_index2object_tuple);
-		}
-		
-		typename index_marker_type::value_type idx;
-		if (!types::get_value(idx_marker, idx))
-			return end(lock);
-		
-		if (idx >= std::get<0>(_index2object_tuple).size())
-			return end(lock);
+		return _chunks[k];
+	}
 
-		return begin(lock) + idx;
+	size_type chunk_length(size_type k) const noexcept
+	{
+		return std::min(chunk_capacity, _size - (k << ChunkBits));
 	}
 
-	const_iterator find(index_marker_type idx_marker, const unique_lock& lock) const
+	void swap(basic_chunked_vector& o) noexcept
 	{
-		if (lock.mutex() != &_mutex || !lock.owns_lock())
-		{
-			assert(false);
-			return const_iterator(lock, &_index2object_tuple);
-		}
-		
-		auto idx = idx_marker._value;
-		
-		if (idx >= std::get<0>(_index2object_tuple).size() || idx < 0)
-			return end(lock);
+		using std::swap;
 
-		return begin(lock) + idx;
+		swap(_chunks, o._chunks);
+		swap(_size, o._size);
 	}
 
-	template<class T>
-	iterator find(const T& obj, const unique_lock& lock)
-	{
-		if (lock.mutex() != &_mutex || !lock.owns_lock())
-		{
-			assert(false);
-			return iterator(lock, &_index2object_tuple);
-		}
+private:
+	std::vector<T*> _chunks;
+	size_type _size = 0;
+};
 
-		auto& o2i = object2index<T>();
-		
-		const auto it = o2i.find(obj);
-		if (it == o2i.end())
-			return end(lock);
+template<class T, std::size_t ChunkBits>
+constexpr typename basic_chunked_vector<T, ChunkBits>::size_type basic_chunked_vector<T, ChunkBits>::chunk_capacity;
 
-		return begin(lock) + it->second;
-	}
+template<class T, std::size_t ChunkBits>
+constexpr typename basic_chunked_vector<T, ChunkBits>::size_type basic_chunked_vector<T, ChunkBits>::chunk_mask;
 
-	template<class T>
-	const_iterator find(const T& obj, const unique_lock& lock) const
-	{
-		if (lock.mutex() != &_mutex || !lock.owns_lock())
-		{
-			assert(false);
-			return const_iterator(lock, &_index2object_tuple);
-		}
+template<class T, std::size_t ChunkBits>
+void swap(basic_chunked_vector<T, ChunkBits>& a, basic_chunked_vector<T, ChunkBits>& b) noexcept
+{
+	a.swap(b);
+}
 
-		auto& o2i = object2index<T>();
-		
-		const auto it = o2i.find(obj);
-		if (it == o2i.end())
-			return end(lock);
+namespace impl_
+{
 
-		return begin(lock) + it->second;
+// Scans the chunks as contiguous arrays (each chunk is an integral number
+// of selection words).
+template<std::size_t ChunkBits, class Column, class Pred>
+void scan_chunks(const Column& column, std::size_t n, Pred& pred, std::uint64_t* bits)
+{
+	static_assert(ChunkBits >= 6, "a chunk should contain whole selection words");
+	assert(n <= column.size());
+	for (std::size_t k = 0; (k << ChunkBits) < n; ++k)
+	{
+		auto p = column.chunk_data(k);
+		const std::size_t len = std::min(column.chunk_length(k), n - (k << ChunkBits));
+		for (std::size_t first = 0; first < len; first += 64)
+			*bits++ = scan_word(p, std::min<std::size_t>(64, len - first), pred);
 	}
+}
 
-	template<class T>
-	reference operator[](const T& obj)
+} // namespace impl_
+
+template<
+	class T,
+	std::size_t ChunkBits,
+	class Pred,
+	std::enable_if_t<(ChunkBits >= 6), bool> = false
+>
+void scan_column(const basic_chunked_vector<T, ChunkBits>& column, std::size_t n, Pred& pred, std::uint64_t* bits)
+{
+	impl_::scan_chunks<ChunkBits>(column, n, pred, bits);
+}
+
+// the drop-in replacement of map::deque as Index2ObjectT
+template<class T>
+using chunked_vector = basic_chunked_vector<T>;
+
+/**
+ * A chunked vector which shares chunks between copies (copy-on-write). A copy
+ * takes O(chunk_count()), a chunk is copied by the first non-const access
+ * to it after the container was copied.
+ *
+ * NB a write moves the elements of a shared chunk, so only the maps which
+ * store indexes (flat_unordered_map, flat_map) can index such columns.
+ */
+template<class T, std::size_t ChunkBits = 10>
+class basic_cow_chunked_vector
+{
+	using chunk = std::vector<T>;
+
+public:
+	using value_type = T;
+	using size_type = std::size_t;
+	using difference_type = std::ptrdiff_t;
+	using reference = T&;
+	using const_reference = const T&;
+	using pointer = T*;
+	using const_pointer = const T*;
+	// NB no non-const iterator, each access would copy a shared chunk
+	using const_iterator = index_iterator<basic_cow_chunked_vector, const T>;
+	using iterator = const_iterator;
+
+	static constexpr size_type chunk_capacity = size_type(1) << ChunkBits;
+	static constexpr size_type chunk_mask = chunk_capacity - 1;
+
+	size_type size() const noexcept
 	{
-		unique_lock lock(_mutex);
-		
-		auto it = find(obj, lock);
-		if (it < begin(lock) || it >= end(lock))
-			return reference{};
-		else
-			return *it;
+		return _size;
 	}
-	
-	template<class T>
-	const_reference operator[](const T& obj) const
+
+	bool empty() const noexcept
 	{
-		unique_lock lock(_mutex);
-		
-		auto it = find(obj, lock);
-		if (it < begin(lock) || it >= end(lock))
-			return const_reference{};
-		else
-			return *it;
+		return _size == 0;
 	}
-	
-	
-	template<class T>
-	reference at(const T& obj)
+
+	constexpr size_type max_size() const noexcept
 	{
-		unique_lock lock(_mutex);
-		
-		auto it = find(obj, lock);
-		if (it < begin(lock) || it >= end(lock))
-			throw std::out_of_range("two_way_object_indexer at()");
-		else
-			return *it;
+		return std::numeric_limits<difference_type>::max() / sizeof(T);
 	}
 
-	template<class T>
-	const_reference at(const T& obj) const
+	// reserves the chunk table only, chunks are allocated on demand
+	void reserve(size_type n)
 	{
-		unique_lock lock(_mutex);
-		
-		auto it = find(obj, lock);
-		if (it < begin(lock) || it >= end(lock))
-			throw std::out_of_range("two_way_object_indexer at()");
-		else
-			return *it;
+		_chunks.reserve((n + chunk_mask) >> ChunkBits);
 	}
 
-	template<class Key, class... Pars>
-	std::pair<reference, bool> update_or_insert(const Key& key, Pars&&... pars)
+	template<class... Args>
+	reference emplace_back(Args&&... args)
 	{
-		unique_lock lock(_mutex);
-		bool insert = false;
-		
-		auto it = find(key, lock);
-		if (it == end(lock))
+		if ((_size & chunk_mask) == 0)
 		{
-			push_back_int(value_type::make_value_tuple(std::forward_as_tuple(key, std::forward<Pars>(pars)...)));
-			it = end(lock) - 1;
-			insert = true;
+			_chunks.push_back(std::make_shared<chunk>());
+			_chunks.back()->reserve(chunk_capacity);
 		}
-		else
-		{
-			tuple::helper<std::tuple<Pars...>>::template for_each_no_result_forward_args<protect<TwoWayObjects>::template rewrite_functor_1w>(
-				_index2object_tuple,
-				std::forward_as_tuple(std::forward<Pars>(pars)...),
-				(*it).template by_type<const index_marker_type>()
-			);
-		}
-		assert((*it).template by_type<const Key>() == key);
-		return std::make_pair(*it, insert);
+
+		chunk& c = writable(_chunks.size() - 1);
+		c.emplace_back(std::forward<Args>(args)...);
+		++_size;
+		return c.back();
 	}
 
-protected:
-	void push_back_int(value_tuple&& tup)
+	void push_back(const T& v)
 	{
-		// 2 way objects
-		
-		tuple_helper_2w::template for_each_no_result_forward_args<push_functor_2w>(
-			_object2index_tuple,
-			_index2object_tuple,
-			std::move(tup),
-			_end_idx
-		);
-
-		// 1 way objects
-
-		tuple_helper_1w::template for_each_no_result_forward_args<push_functor_1w>(
-			_index2object_tuple,
-			std::move(tup),
-			_end_idx
-		);
-
-		++_end_idx;
+		emplace_back(v);
 	}
-	
-	template<class T>
-	Object2IndexT<std::reference_wrapper<const T>, Index>& object2index()
+
+	void push_back(T&& v)
 	{
-		static_assert(
-			tuple::among_tuple_types<T, TwoWayObjects>::value,
-			"Unable to index the collection by the type not specified in TwoWayObjects"
-		);
-		return std::get<Object2IndexT<std::reference_wrapper<const T>, Index>>(_object2index_tuple);
+		emplace_back(std::move(v));
 	}
 
-	template<class T>
-	const Object2IndexT<std::reference_wrapper<const T>, Index>& object2index() const
+	void pop_back()
 	{
-		static_assert(
-			tuple::among_tuple_types<T, TwoWayObjects>::value,
-			"Unable to index the collection by the type not specified in TwoWayObjects"
-		);
-		return std::get<Object2IndexT<std::reference_wrapper<const T>, Index>>(_object2index_tuple);
+		assert(_size > 0);
+		--_size;
+		if ((_size & chunk_mask) == 0)
+			_chunks.pop_back();
+		else
+			writable(_chunks.size() - 1).pop_back();
 	}
 
-	template<class T>
-	Index2ObjectT<T>& index2object()
+	void clear() noexcept
 	{
-		return std::get<Index2ObjectT<T>>(_index2object_tuple);
+		_chunks.clear();
+		_size = 0;
 	}
 
-	template<class T>
-	const Index2ObjectT<T>& index2object() const
+	reference operator[](size_type i)
 	{
-		return std::get<Index2ObjectT<T>>(_index2object_tuple);
+		return writable(i >> ChunkBits)[i & chunk_mask];
 	}
 
-private:
-	objects2index_tuple _object2index_tuple;
-	index2objects_tuple _index2object_tuple;
-	index_type _end_idx = 0;
-};
-
-} // namespace thread_safe
- 
-template<
-	template<class, class> class Object2IndexT,
-	template<class> class Index2ObjectT,
-	class Index,
-	class TwoWayObjects,
-	class OneWayObjects
->
-class type;
-
-template<class Index, class RefTuple, class ValTuple>
-class reference_type
-#if 0
-	: protected
-#else
-  : public
-#endif
-tuple::helper<RefTuple>::template prepend<marker::type<marker::index_marker, Index>>
-{
-	template<
-		template<class, class> class _Object2IndexT,
-		template<class> class _Index2ObjectT,
-		class _Index,
-		class _TwoWayObjects,
-		class _OneWayObjects
-	>
-	friend class multi_way_object_indexer::type;
-
-	using base = typename tuple::helper<RefTuple>::template prepend<marker::type<marker::index_marker, Index>>;
-
-	template<class _Index, class _RefTuple, class _ValTuple>
-	friend std::ostream& operator<<(std::ostream& out, const reference_type<_Index, _RefTuple, _ValTuple>& val);
-	
-	using index_value_type = Index;
-
-public:
-	reference_type() : reference_type(index_marker_type{}, tuple::helper<RefTuple>::zero_ref_tuple()) {}
-
-	reference_type(const reference_type&) = delete;
+	const_reference operator[](size_type i) const
+	{
+		return (*_chunks[i >> ChunkBits])[i & chunk_mask];
+	}
 
-	reference_type(reference_type&&) = default;
-	
-	using index_marker_type = marker::type<marker::index_marker, Index>;
-	
-	explicit reference_type(const index_marker_type& idx, const RefTuple& tup)
-		: base(std::tuple_cat(std::make_tuple(idx), tup))
-	{}
+	reference at(size_type i)
+	{
+		if (i >= _size)
+			throw std::out_of_range("cow_chunked_vector at()");
+		return (*this)[i];
+	}
 
-	reference_type& operator=(const reference_type&) = delete;
-	
-	reference_type& operator=(reference_type&&) = default;
+	const_reference at(size_type i) const
+	{
+		if (i >= _size)
+			throw std::out_of_range("cow_chunked_vector at()");
+		return (*this)[i];
+	}
 
-	template<class... Ts>
-	reference_type& operator=(std::tuple<Ts...>&& t)
+	reference front()
 	{
-		int a = t;
+		return (*this)[0];
 	}
-	
-	template<class... Ts>
-	reference_type& operator|=(std::tuple<Ts...>&& t)
+
+	const_reference front() const
 	{
-		int a = t;
+		return (*this)[0];
 	}
-	
-	explicit operator value_type<Index, ValTuple>() const
+
+	reference back()
 	{
- 		using v_type = value_type<Index, ValTuple>;
-		using helper = tuple::helper<ValTuple>;
+		return (*this)[_size - 1];
+	}
 
-		//ValTuple result;
-		v_type result;
+	const_reference back() const
+	{
+		return (*this)[_size - 1];
+	}
 
-		helper::template for_each_no_result_forward_args<select_functor>(
-			result,
-			static_cast<const base&>(*this)
-		);
-		return result; //v_type(index(), std::move(result));
+	const_iterator begin() const noexcept
+	{
+		return const_iterator(this, 0);
 	}
 
-	value_type<Index, ValTuple> value() const
+	const_iterator end() const noexcept
 	{
-		return (value_type<Index, ValTuple>)*this;
+		return const_iterator(this, _size);
 	}
-	
-	bool operator==(const reference_type& o) const
+
+	const_iterator cbegin() const noexcept
 	{
-		if (this->is_no_value() || o.is_no_value())
-			return this->is_no_value() && o.is_no_value();
-		else 
-			return tuple::helper<base>::comparator::equal(*this, o);
+		return begin();
 	}
 
-	// TODO left val, right ref
-	bool operator==(const value_type<Index, ValTuple>& o) const
+	const_iterator cend() const noexcept
 	{
-		using val_type = value_type<Index, ValTuple>;
-		
-		if (this->is_no_value() || o.is_no_value())
-			return this->is_no_value() && o.is_no_value();
-		else 
-			return tuple::comparator<base, typename val_type::base, 0>::equal(static_cast<const base& >(*this), static_cast<const typename val_type::base& >(o));
+		return end();
 	}
 
-	index_marker_type index() const 
+	size_type chunk_count() const noexcept
 	{
-		return index_marker_type{std::get<0>(*this)};
+		return _chunks.size();
 	}
 
-	template<
-		class T,
-		typename std::enable_if<!std::is_const<T>::value, bool>::type = false
-	>
-	T& by_type()
+	const_pointer chunk_data(size_type k) const noexcept
 	{
-		if (!is_no_value())
-			return tuple::recursive_helper<base, 0>::template get_by_unref_type<T>(static_cast<base&>(*this));
-		else
-		{
-			assert(false);
-			static T no_value{types::no_value<T>()};
-			return no_value;
-		}
+		return _chunks[k]->data();
 	}
 
-	template<
-		class T
-	>
-	const T& by_type() const
+	size_type chunk_length(size_type k) const noexcept
 	{
-		if (!is_no_value())
-			return tuple::recursive_helper<base, 0>::template get_by_unref_type<T>(static_cast<const base&>(*this));
-		else
-		{
-			//assert(false);
-			static T no_value{types::no_value<T>()};
-			return no_value;
-		}
+		return _chunks[k]->size();
 	}
 
-	static reference_type no_value()
+	// whether the chunk k is shared with a copy
+	bool chunk_shared(size_type k) const noexcept
 	{
-		return reference_type{};
+		return _chunks[k].use_count() > 1;
 	}
 
-	bool is_no_value() const
+	void swap(basic_cow_chunked_vector& o) noexcept
 	{
-		return index() == index_marker_type{} || tuple::some_element_is_zero_ref(*this);
+		using std::swap;
+
+		swap(_chunks, o._chunks);
+		swap(_size, o._size);
 	}
-	
-	bool is_no_value_strong() const
+
+protected:
+	chunk& writable(size_type k)
 	{
-		return is_no_value() || types::has_no_value(value().get_value_tuple());
+		std::shared_ptr<chunk>& c = _chunks[k];
+		if (c.use_count() > 1)
+		{
+			auto copy = std::make_shared<chunk>();
+			copy->reserve(chunk_capacity);
+			copy->assign(c->begin(), c->end());
+			c = std::move(copy);
+		}
+		else
+		{
+			// see the reads of the last copy owner which released the chunk
+			std::atomic_thread_fence(std::memory_order_acquire);
+		}
+		return *c;
 	}
+
+private:
+	std::vector<std::shared_ptr<chunk>> _chunks;
+	size_type _size = 0;
 };
 
-template<class Index, class ValTuple>
-std::ostream& operator<<(std::ostream& out, const value_type<Index, ValTuple>& val)
+template<class T, std::size_t ChunkBits>
+constexpr typename basic_cow_chunked_vector<T, ChunkBits>::size_type basic_cow_chunked_vector<T, ChunkBits>::chunk_capacity;
+
+template<class T, std::size_t ChunkBits>
+constexpr typename basic_cow_chunked_vector<T, ChunkBits>::size_type basic_cow_chunked_vector<T, ChunkBits>::chunk_mask;
+
+template<class T, std::size_t ChunkBits>
+struct has_stable_elements<basic_cow_chunked_vector<T, ChunkBits>> : std::false_type {};
+
+template<class T, std::size_t ChunkBits>
+void swap(basic_cow_chunked_vector<T, ChunkBits>& a, basic_cow_chunked_vector<T, ChunkBits>& b) noexcept
 {
-	using val_type = value_type<Index, ValTuple>;
-	using tuple_type = typename val_type::base;
-	
-	out << "value_type{";
-	tuple::recursive_helper<tuple_type, 0>::out(out, (const tuple_type&)val);
-	out << '}';
-	return out;
+	a.swap(b);
 }
 
-template<class Index, class RefTuple, class ValTuple>
-std::ostream& operator<<(std::ostream& out, const reference_type<Index, RefTuple, ValTuple>& val)
+template<
+	class T,
+	std::size_t ChunkBits,
+	class Pred,
+	std::enable_if_t<(ChunkBits >= 6), bool> = false
+>
+void scan_column(const basic_cow_chunked_vector<T, ChunkBits>& column, std::size_t n, Pred& pred, std::uint64_t* bits)
 {
-	using ref_type = reference_type<Index, RefTuple, ValTuple>;
-	using tuple_type = typename ref_type::base;
-	
-	out << "value_type{";
-	tuple::recursive_helper<tuple_type, 0>::out(out, (const tuple_type&)val);
-	out << '}';
-	return out;
+	impl_::scan_chunks<ChunkBits>(column, n, pred, bits);
 }
 
-template<class Index, class Index2ObjectsTuple>
-class iterator
+// Index2ObjectT for snapshots (see multi_way_object_indexer::type::snapshot())
+template<class T>
+using cow_chunked_vector = basic_cow_chunked_vector<T>;
+
+/**
+ * Open addressing (linear probing) object -> index map. It can be used as
+ * Object2IndexT of multi_way_object_indexer.
+ *
+ * A slot contains only 32 bits of the hash and the index, objects are
+ * compared through the index -> object column the map is bound to by
+ * bind_column(). Key is std::reference_wrapper<const Object> (see
+ * tuple_of_cref_maps), Column is Index2ObjectT of the same indexer.
+ *
+ * The slot position is derived from the stored hash bits, so a rehash and an
+ * erase never touch objects. The capacity is limited by 2^32 slots.
+ */
+template<class Key, class T, template<class> class Column>
+class basic_flat_unordered_map
 {
-	template<
-		template<class, class> class _Object2IndexT,
-		template<class> class _Index2ObjectT,
-		class _Index,
-		class _TwoWayObjects,
-		class _OneWayObjects
-	>
-	friend class multi_way_object_indexer::type;
+public:
+	using key_type = Key;
+	using object_type = types::remove_cvrefw_t<Key>;
+	using mapped_type = T;
+	using value_type = std::pair<Key, T>;
+	using size_type = std::size_t;
+	using difference_type = std::ptrdiff_t;
+	using hasher = ref_hash<Key>;
+	using key_equal = ref_equal_to<Key>;
+	using column_type = Column<object_type>;
 
-	using index_type = Index;
-	using index_marker_type = marker::type<marker::index_marker, Index>;
-	using index2object = Index2ObjectsTuple;
+private:
+	struct slot
+	{
+		std::uint32_t fragment; // 0 means an empty slot
+		T index;
+	};
 
-	index2object* _i2o = nullptr;
-	index_type _idx;
-	
-	constexpr iterator(
-		index2object* i2o,
-		index_type idx = index_marker_type::no_value()._value
-	)
-		: _i2o(i2o), _idx(idx)
-	{}
+	static constexpr size_type min_capacity = 8;
 
-	static iterator no_value()
+public:
+	// see find_position()
+	struct position
 	{
-		return types::zero_ref<index2object>::value();
+		size_type pos;
+		std::uint32_t frag;
+		bool found;
+		size_type probes; // the slots inspected
 	};
-	
-public:
-	using iterator_category = std::random_access_iterator_tag;
-	using size_type = std::size_t;
-	using difference_type = std::ptrdiff_t;
-	using cont_tuple_helper = tuple::cont_helper<Index2ObjectsTuple>;
-	using ref_tuple = typename cont_tuple_helper::containers2ref_tuple;
-	using cref_tuple = typename cont_tuple_helper::containers2cref_tuple;
-	using val_tuple = typename cont_tuple_helper::containers2val_tuple;
-	using value_type = multi_way_object_indexer::value_type<Index, val_tuple>;
-	using reference = multi_way_object_indexer::reference_type<Index, ref_tuple, val_tuple>;
-	using const_reference = multi_way_object_indexer::reference_type<Index, cref_tuple, val_tuple>;
-	using pointer = void;
 
-	// iterators are compatible if they point to the same collection and both are valid values
-	bool is_compatible(const iterator& o) const
+	class iterator
 	{
-		return &_i2o.get() == &o._i2o.get() && !is_no_value();
+		friend class basic_flat_unordered_map;
+
+		struct arrow
+		{
+			value_type v;
+
+			const value_type* operator->() const { return &v; }
+		};
+
+		const basic_flat_unordered_map* _map = nullptr;
+		size_type _pos = 0;
+
+		iterator(const basic_flat_unordered_map* m, size_type pos) : _map(m), _pos(pos)
+		{
+			skip_empty();
+		}
+
+		void skip_empty()
+		{
+			while (_pos < _map->_slots.size() && _map->_slots[_pos].fragment == 0)
+				++_pos;
+		}
+
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = basic_flat_unordered_map::value_type;
+		using difference_type = std::ptrdiff_t;
+		using reference = value_type;
+		using pointer = arrow;
+
+		iterator() {}
+
+		reference operator*() const
+		{
+			return value_type(std::cref(_map->object_at(_pos)), _map->_slots[_pos].index);
+		}
+
+		pointer operator->() const
+		{
+			return arrow{**this};
+		}
+
+		iterator& operator++()
+		{
+			++_pos;
+			skip_empty();
+			return *this;
+		}
+
+		iterator operator++(int)
+		{
+			iterator copy = *this;
+			operator++();
+			return copy;
+		}
+
+		bool operator==(const iterator& o) const
+		{
+			return _pos == o._pos;
+		}
+
+		bool operator!=(const iterator& o) const
+		{
+			return !operator==(o);
+		}
+	};
+
+	using const_iterator = iterator;
+
+	basic_flat_unordered_map() {}
+
+	void bind_column(const column_type& column)
+	{
+		_column = &column;
 	}
-	
-	bool operator==(const iterator& o) const
+
+	iterator begin() const
 	{
-		return _idx == o._idx;
+		return iterator(this, 0);
 	}
 
-	bool operator!=(const iterator& o) const
+	iterator end() const
 	{
-		return !operator==(o);
+		return iterator(this, _slots.size());
 	}
 
-	iterator& operator++()
+	size_type size() const noexcept
 	{
-		++_idx;
-		return *this;
+		return _size;
+	}
+
+	bool empty() const noexcept
+	{
+		return _size == 0;
+	}
+
+	size_type bucket_count() const noexcept
+	{
+		return _slots.size();
+	}
+
+	void clear()
+	{
+		_slots.clear();
+		_size = 0;
+		_bits = 0;
+	}
+
+	// prepare for n elements without a rehash
+	void reserve(size_type n)
+	{
+		size_type cap = min_capacity;
+		while (cap - cap / 8 < n)
+			cap *= 2;
+
+		if (cap > _slots.size())
+			rehash(cap);
+	}
+
+	// Key may be any type supported by the (transparent) hasher and key_equal
+	template<class K>
+	iterator find(const K& obj) const
+	{
+		if (_size == 0)
+			return end();
+
+		return find(obj, fragment(obj));
+	}
+
+	// Batched find(): hashes up to find_batch_size objects and prefetches
+	// their home slots, then prefetches the objects of the home slots with
+	// matching fragments and only then probes, so the cache misses of a
+	// batch overlap.
+	template<class ForwardIt, class OutputIt>
+	OutputIt find_many(ForwardIt first, ForwardIt last, OutputIt out) const
+	{
+		if (_size == 0)
+		{
+			for (; first != last; ++first)
+				*out++ = end();
+			return out;
+		}
+
+		std::array<std::uint32_t, find_batch_size> frags;
+		while (first != last)
+		{
+			ForwardIt batch_last = first;
+			std::size_t n = 0;
+			for (; n < frags.size() && batch_last != last; ++n, ++batch_last)
+			{
+				frags[n] = fragment(*batch_last);
+				prefetch(&_slots[home(frags[n])]);
+			}
+
+			for (std::size_t i = 0; i < n; ++i)
+			{
+				const size_type pos = home(frags[i]);
+				if (_slots[pos].fragment == frags[i])
+					prefetch(&object_at(pos));
+			}
+
+			for (std::size_t i = 0; i < n; ++i, ++first)
+				*out++ = find(*first, frags[i]);
+		}
+		return out;
+	}
+
+	// find() which adds the number of slots it inspects to probes
+	template<class K>
+	iterator counted_find(const K& obj, std::size_t& probes) const
+	{
+		if (_size == 0)
+			return end();
+
+		const std::uint32_t frag = fragment(obj);
+		for (size_type pos = home(frag); ; pos = (pos + 1) & mask())
+		{
+			++probes;
+			const slot& s = _slots[pos];
+			if (s.fragment == 0)
+				return end();
+
+			if (s.fragment == frag && key_equal()(object_at(pos), obj))
+				return iterator(this, pos);
+		}
 	}
- 
-	iterator operator++(int)
+
+	size_type count(const object_type& obj) const
 	{
-		iterator copy = *this;
-		operator++();
-		return copy;
+		return find(obj) != end();
 	}
 
-	iterator& operator+=(difference_type k)
+	std::pair<iterator, iterator> equal_range(const object_type& obj) const
 	{
-		_idx += k;
-		return *this;
+		auto it = find(obj);
+		if (it == end())
+			return std::make_pair(it, it);
+
+		auto next = it;
+		return std::make_pair(it, ++next);
 	}
 
-	iterator operator+(difference_type k)
+	// NB objects are unique, the existing element is not replaced
+	std::pair<iterator, bool> emplace(const Key& key, T index)
 	{
-		iterator res = *this;
-		return res += k;
+		const position p = find_position(static_cast<const object_type&>(key));
+		if (p.found)
+			return std::make_pair(iterator_at(p), false);
+
+		return std::make_pair(emplace_at(p, index), true);
 	}
 
-	iterator& operator--()
+	// The slot of obj or the empty slot where obj goes. A missing obj
+	// reserves space for one more element (the table is probed again if
+	// it grows), so the position stays valid for emplace_at() until the
+	// next change of the map.
+	template<class K>
+	position find_position(const K& obj)
 	{
-		--_idx;
-		return *this;
+		const std::uint32_t frag = fragment(obj);
+		if (!_slots.empty())
+		{
+			const position p = probe(obj, frag);
+			if (p.found || _size < _slots.size() - _slots.size() / 8)
+				return p;
+		}
+
+		reserve(_size + 1);
+		return probe(obj, frag);
 	}
- 
-	iterator operator--(int)
+
+	iterator iterator_at(const position& p) const
 	{
-		iterator copy = *this;
-		operator--();
-		return copy;
+		return iterator(this, p.pos);
 	}
 
-	iterator& operator-=(difference_type k)
+	// inserts the object p was found for, the object is not hashed again
+	iterator emplace_at(const position& p, T index)
 	{
-		_idx -= k;
-		return *this;
+		assert(!p.found && _slots[p.pos].fragment == 0);
+
+		_slots[p.pos] = slot{p.frag, index};
+		++_size;
+		return iterator(this, p.pos);
 	}
 
-	iterator operator-(difference_type k)
+	iterator emplace_hint(const_iterator, const Key& key, T index)
 	{
-		iterator res = *this;
-		return res -= k;
+		return emplace(key, index).first;
 	}
 
-	iterator operator-(const iterator& it)
+	// backward shift deletion, no tombstones
+	void erase(const_iterator it)
 	{
-		if (is_compatible(it))
-			return *this -= it._idx;
-		else
-			return no_value();
+		assert(it._map == this && it._pos < _slots.size());
+
+		size_type hole = it._pos;
+		for (size_type next = (hole + 1) & mask(); _slots[next].fragment != 0; next = (next + 1) & mask())
+		{
+			const size_type next_home = home(_slots[next].fragment);
+			if (((next - next_home) & mask()) >= ((next - hole) & mask()))
+			{
+				_slots[hole] = _slots[next];
+				hole = next;
+			}
+		}
+		_slots[hole].fragment = 0;
+		--_size;
 	}
 
-	reference operator*()
+	size_type erase(const object_type& obj)
 	{
-		if (is_no_value())
-			return reference{};
-		else
-			return reference(marker::index(_idx), cont_tuple_helper::ref_vector_at(*_i2o, _idx));
+		auto it = find(obj);
+		if (it == end())
+			return 0;
+
+		erase(it);
+		return 1;
 	}
 
-	const_reference operator*() const
+	void swap(basic_flat_unordered_map& o)
 	{
-		if (is_no_value())
-			return const_reference{};
-		else
-			return const_reference(marker::index(_idx), cont_tuple_helper::cref_vector_at(*_i2o, _idx));
+		using std::swap;
+
+		swap(_slots, o._slots);
+		swap(_size, o._size);
+		swap(_bits, o._bits);
+		swap(_column, o._column);
 	}
 
-	reference operator[](difference_type k)
+protected:
+	const object_type& object_at(size_type pos) const
 	{
-		return *(*this + k);
+		assert(_column);
+		return (*_column)[_slots[pos].index];
 	}
 
-	const_reference operator[](difference_type k) const
+	template<class K>
+	static std::uint32_t fragment(const K& obj)
 	{
-		return *(*this + k);
+		return impl_::hash_fragment<hasher>(obj);
 	}
 
-	bool operator<(const iterator& it) const
+	template<class K>
+	iterator find(const K& obj, std::uint32_t frag) const
 	{
-		if (is_no_value())
+		for (size_type pos = home(frag); ; pos = (pos + 1) & mask())
 		{
-			if (it.is_no_value())
-				return false;
-			else
-				return true; // no_value is lesser than everything except another no_value
+			const slot& s = _slots[pos];
+			if (s.fragment == 0)
+				return end();
+
+			if (s.fragment == frag && key_equal()(object_at(pos), obj))
+				return iterator(this, pos);
 		}
-		else if (it.is_no_value())
-			return false;
-		else
-			return _idx < it._idx; // NB: ignore _i2o part here
 	}
 
-	bool operator>(const iterator& it) const
+	// see find_position()
+	template<class K>
+	position probe(const K& obj, std::uint32_t frag) const
 	{
-		if (is_no_value())
+		size_type pos = home(frag);
+		size_type n = 1;
+		for (; _slots[pos].fragment != 0; pos = (pos + 1) & mask(), ++n)
 		{
-			if (it.is_no_value())
-				return false;
-			else
-				return false; // bottom is lesser than everything except another bottom
+			if (_slots[pos].fragment == frag && key_equal()(object_at(pos), obj))
+				return position{pos, frag, true, n};
 		}
-		else if (it.is_no_value())
-			return true;
-		else
-			return _idx > it._idx; // NB: ignore _i2o part here
+		return position{pos, frag, false, n};
 	}
 
-	bool operator>=(const iterator& it) const
+	size_type home(std::uint32_t frag) const
 	{
-		return !(*this < it);
+		return frag >> (32 - _bits);
 	}
 
-	bool operator<=(const iterator& it) const
+	size_type mask() const
 	{
-		return !(*this > it);
+		return _slots.size() - 1;
 	}
 
-	bool is_no_value() const
+	void rehash(size_type cap)
 	{
-		return types::has_no_value(index_marker_type{_idx}) || _i2o == nullptr;
+		assert((cap & (cap - 1)) == 0);
+
+		std::vector<slot> old(cap, slot{0, T()});
+		old.swap(_slots);
+
+		_bits = 0;
+		while ((size_type(1) << _bits) < cap)
+			++_bits;
+		assert(_bits <= 32 && "basic_flat_unordered_map: too many elements");
+
+		for (const slot& s : old)
+		{
+			if (s.fragment == 0)
+				continue;
+
+			size_type pos = home(s.fragment);
+			while (_slots[pos].fragment != 0)
+				pos = (pos + 1) & mask();
+			_slots[pos] = s;
+		}
 	}
+
+private:
+	std::vector<slot> _slots;
+	size_type _size = 0;
+	unsigned _bits = 0; // log2(_slots.size())
+	const column_type* _column = nullptr;
 };
 
-/**
- * Maintains an indexed list of objects with ability to search a
- * object by an index and an index by a object.
- */
-template<
-	template<class, class> class Object2IndexT,
-	template<class> class Index2ObjectT,
-	class Index,
-	class TwoWayObjects,
-	class OneWayObjects
->
-class type
+template<class K, class V, template<class> class C, class Column>
+void bind_column(basic_flat_unordered_map<K, V, C>& o2i, const Column& column)
 {
-	using all_objects_tuple = typename tuple::helper<TwoWayObjects>::template cat<OneWayObjects>;
-	using tuple_helper_all = tuple::helper<all_objects_tuple>;
-	using tuple_helper_1w = tuple::helper<OneWayObjects>;
-	using tuple_helper_2w = tuple::helper<TwoWayObjects>;
-
-	// 2w objects are RO, 1w - RW
-	using index2objects_tuple = typename tuple::helper<typename tuple_helper_2w::template tuple_of_containers<Index2ObjectT>>::template cat<
-		typename tuple_helper_1w::template tuple_of_containers<Index2ObjectT>
-	>;
-	using index2objects_tuple_const = typename tuple::addconst<index2objects_tuple>::type;
-	
-	using objects2index_tuple = typename tuple_helper_2w::template tuple_of_cref_maps<Object2IndexT, Index>;
-public:
-	using index_type = Index;
-	using index_marker_type = marker::type<marker::index_marker, Index>;
-	using iterator = multi_way_object_indexer::iterator<Index, index2objects_tuple>;
-	using const_iterator = multi_way_object_indexer::iterator<Index, const index2objects_tuple_const>;
-	
-	using difference_type = typename iterator::difference_type;
-	using size_type = typename iterator::size_type;
-	using value_type = typename iterator::value_type;
-	using value_tuple = typename value_type::value_tuple;
-	using reference = typename iterator::reference;
-	using const_reference = typename iterator::const_reference;
-	
-	// NB no pointers declared
+	static_assert(
+		std::is_same<Column, typename basic_flat_unordered_map<K, V, C>::column_type>::value,
+		"basic_flat_unordered_map: Column doesn't match Index2ObjectT of the indexer"
+	);
+	o2i.bind_column(column);
+}
 
-	using reverse_iterator = std::reverse_iterator<iterator>;
-	using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+template<class K, class V, template<class> class C>
+void swap(basic_flat_unordered_map<K, V, C>& a, basic_flat_unordered_map<K, V, C>& b)
+{
+	a.swap(b);
+}
 
-	type() {}
+template<class Key, class T>
+using flat_unordered_map = basic_flat_unordered_map<Key, T, deque>;
 
-	type(const type&) = default;
+namespace impl_
+{
 
-	type(type&&) = default;
-	
-	template<class... Ts>
-	type(std::initializer_list<std::tuple<Ts...>> objs)
-	{
-		for (auto it = objs.begin(); it != objs.end(); ++it)
-			push_back(*it);
-	}
+// Copies strings into ChunkBytes blocks, strings longer than
+// ChunkBytes / 4 get their own blocks
+template<std::size_t ChunkBytes>
+class string_arena
+{
+public:
+	using size_type = std::size_t;
 
-	// allows to construct a container from different types of arguments
-	template<class Arg0, class... Args>
-	type(Arg0&& obj0, Args&&... objs)
+	string_view store(string_view s)
 	{
-		push_back_seq(std::forward<Arg0>(obj0), std::forward<Args>(objs)...);
-	}
+		if (s.empty())
+			return string_view();
 
-	type& operator=(const type&) = default;
+		if (s.size() > _left)
+		{
+			if (s.size() > ChunkBytes / 4)
+			{
+				char* block = allocate(s.size());
+				std::memcpy(block, s.data(), s.size());
+				_bytes += s.size();
+				return string_view(block, s.size());
+			}
 
-	type& operator=(type&&) = default;
+			_free = allocate(ChunkBytes);
+			_left = ChunkBytes;
+		}
 
-	reference front()
-	{
-		return *begin();
-	}
-	
-	const_reference front() const
-	{
-		return *begin();
-	}
-	
-	reference back()
-	{
-		auto it = end();
-		--it;
-		return *it;
+		std::memcpy(_free, s.data(), s.size());
+		const string_view res(_free, s.size());
+		_free += s.size();
+		_left -= s.size();
+		_bytes += s.size();
+		return res;
 	}
 
-	const_reference back() const
+	// the bytes of all strings
+	size_type bytes() const noexcept
 	{
-		auto it = end();
-		--it;
-		return *it;
+		return _bytes;
 	}
 
-	template<class... Ts>
-	iterator push_back(std::tuple<Ts...>&& v)
-	{
-		return push_back_int(value_type::make_value_tuple(std::move(v)));
-	}
-	
-	template<class T>
-	auto push_back(T&& v)
-		-> std::enable_if_t<!tuple::has_tuple_as_base<T>::value, iterator>
+	size_type allocated() const noexcept
 	{
-		return push_back_int(value_type::make_value_tuple(std::forward_as_tuple(std::move(v))));
+		return _allocated;
 	}
-	
-	template<class T0, class... Ts>
-	void push_back_seq(T0&& v0, Ts&&... vs)
+
+	void clear() noexcept
 	{
-		push_back(std::forward<T0>(v0));
-		push_back_seq(std::forward<Ts>(vs)...);
+		_blocks.clear();
+		_free = nullptr;
+		_left = 0;
+		_bytes = 0;
+		_allocated = 0;
 	}
 
-	void push_back_seq()
+	void swap(string_arena& o) noexcept
 	{
+		using std::swap;
+
+		swap(_blocks, o._blocks);
+		swap(_free, o._free);
+		swap(_left, o._left);
+		swap(_bytes, o._bytes);
+		swap(_allocated, o._allocated);
 	}
 
-	template<class... Ts>
-	iterator push_in_hole(std::tuple<Ts...>&& v)
+protected:
+	char* allocate(size_type n)
 	{
-		return push_in_hole_int(value_type::make_value_tuple(std::move(v)));
+		_blocks.emplace_back(new char[n]);
+		_allocated += n;
+		return _blocks.back().get();
 	}
-	
-	iterator begin() noexcept
+
+private:
+	std::vector<std::unique_ptr<char[]>> _blocks;
+	char* _free = nullptr; // in the last ChunkBytes block
+	size_type _left = 0;
+	size_type _bytes = 0;
+	size_type _allocated = 0;
+};
+
+inline unsigned floor_log2(std::uint64_t x) noexcept
+{
+	assert(x != 0);
+#if defined(__GNUC__)
+	return 63 - __builtin_clzll(x);
+#else
+	unsigned res = 0;
+	while (x >>= 1)
+		++res;
+	return res;
+#endif
+}
+
+} // namespace impl_
+
+namespace two_way_object_indexer
+{
+
+/**
+ * A string <-> index indexer for interning. The bytes are copied (only on a
+ * miss) into an arena of ChunkBytes chunks, so there is no allocation per
+ * string. The index -> string column is a chunked_vector of string_view
+ * and the string -> index map is a flat_unordered_map bound to it, so
+ * a string costs its bytes, a string_view and a slot (32 bits of the hash
+ * and Index).
+ *
+ * NB strings longer than ChunkBytes / 4 get their own arena blocks.
+ */
+template<class Index = std::uint32_t, std::size_t ChunkBytes = 65536>
+class basic_string_interner
+{
+	using column_type = chunked_vector<string_view>;
+	using object2index = basic_flat_unordered_map<std::reference_wrapper<const string_view>, Index, chunked_vector>;
+
+public:
+	using index_type = Index;
+	using index_marker_type = marker::type<marker::index_marker, Index>;
+	using value_type = string_view;
+	using size_type = std::size_t;
+	using iterator = typename column_type::const_iterator;
+	using const_iterator = iterator;
+
+	basic_string_interner()
 	{
-		return iterator(&_index2object_tuple, 0);
+		_object2index.bind_column(_index2object);
 	}
-	
-	const_iterator begin() const noexcept
+
+	// the indexes are preserved
+	basic_string_interner(const basic_string_interner& o) : basic_string_interner()
 	{
-		return const_iterator(reinterpret_cast<const index2objects_tuple_const*>(&_index2object_tuple), 0);
+		reserve(o.size());
+		for (string_view s : o)
+			get_or_insert(s);
 	}
-	
-	iterator end() noexcept
+
+	basic_string_interner(basic_string_interner&& o) noexcept : basic_string_interner()
 	{
-		assert(_end_idx >= 0);
-		return iterator(&_index2object_tuple, _end_idx);
+		swap(o);
 	}
-	
-	const_iterator end() const noexcept
+
+	basic_string_interner& operator=(const basic_string_interner& o)
 	{
-		assert(_end_idx >= 0);
-		return const_iterator(reinterpret_cast<const index2objects_tuple_const*>(&_index2object_tuple), _end_idx);
+		basic_string_interner copy(o);
+		swap(copy);
+		return *this;
 	}
-	
-	const_iterator cbegin() const noexcept
+
+	basic_string_interner& operator=(basic_string_interner&& o) noexcept
 	{
-		return begin();
+		basic_string_interner tmp(std::move(o));
+		swap(tmp);
+		return *this;
 	}
-	
-	const_iterator cend() const noexcept
+
+	// The index of s, s is copied into the arena if it is a new string
+	index_type get_or_insert(string_view s)
 	{
-		return end();
+		const auto p = _object2index.find_position(s);
+		if (p.found)
+			return (*_object2index.iterator_at(p)).second;
+
+		if (_index2object.size() > (size_type) std::numeric_limits<index_type>::max())
+			throw std::length_error("basic_string_interner: too many strings");
+
+		const index_type idx = static_cast<index_type>(_index2object.size());
+		_index2object.push_back(_arena.store(s));
+		_object2index.emplace_at(p, idx);
+		return idx;
 	}
 
-	reverse_iterator rbegin() noexcept
+	// no value if s is not interned
+	index_marker_type find(string_view s) const
 	{
-		return std::reverse_iterator<iterator>(end());
+		const auto it = _object2index.find(s);
+		if (it == _object2index.end())
+			return index_marker_type{};
+
+		return index_marker_type{(*it).second};
 	}
-	
-	reverse_iterator rend() noexcept
+
+	// NB the views are valid until clear() or the destruction
+	string_view operator[](index_type idx) const
 	{
-		return std::reverse_iterator<iterator>(begin());
+		return _index2object[idx];
 	}
-	
-	const_reverse_iterator crbegin() const noexcept
+
+	string_view at(index_type idx) const
 	{
-		return std::reverse_iterator<const_iterator>(end());
+		return _index2object.at(idx);
 	}
-	
-	const_reverse_iterator crend() const noexcept
+
+	iterator begin() const noexcept
 	{
-		return std::reverse_iterator<const_iterator>(begin());
+		return _index2object.begin();
 	}
 
-	bool operator==(const type& o) const noexcept
+	iterator end() const noexcept
 	{
-		return std::equal(begin(), end(), o.begin(), o.end());
+		return _index2object.end();
 	}
 
-	bool operator!=(const type& o) const noexcept
+	size_type size() const noexcept
 	{
-		return !(*this == o);
+		return _index2object.size();
 	}
 
-	void swap(type& o)
+	bool empty() const noexcept
 	{
-		using std::swap;
+		return _index2object.empty();
+	}
 
-		swap(_object2index_tuple, o._object2index_tuple);
-		swap(_index2object_tuple, o._index2object_tuple);
-		swap(_end_idx, o._end_idx);
-		swap(_erased, o._erased);
+	// the bytes of all strings
+	size_type bytes() const noexcept
+	{
+		return _arena.bytes();
 	}
 
-	size_type size() const noexcept
+	// the bytes allocated by the arena
+	size_type arena_bytes() const noexcept
 	{
-		assert(_end_idx >= 0);
-		return _end_idx;
+		return _arena.allocated();
 	}
 
-	size_type empty() const noexcept
+	void reserve(size_type n)
 	{
-		return size() == 0;
+		_index2object.reserve(n);
+		_object2index.reserve(n);
 	}
 
 	void clear()
 	{
-		*this = type{};
+		_object2index.clear();
+		_index2object.clear();
+		_arena.clear();
 	}
-	
-	iterator find(index_marker_type idx_marker)
+
+	void swap(basic_string_interner& o) noexcept
 	{
-		using i2o_size_type = decltype(std::get<0>(_index2object_tuple).size());
-		
-		auto idx = idx_marker._value;
-		
-		if ((i2o_size_type) idx >= std::get<0>(_index2object_tuple).size() || idx < 0)
-			return end();
+		using std::swap;
 
-		return begin() + idx;
+		swap(_object2index, o._object2index);
+		swap(_index2object, o._index2object);
+		_arena.swap(o._arena);
+
+		_object2index.bind_column(_index2object);
+		o._object2index.bind_column(o._index2object);
 	}
 
-	const_iterator find(index_marker_type idx_marker) const
+private:
+	object2index _object2index;
+	column_type _index2object;
+	impl_::string_arena<ChunkBytes> _arena;
+};
+
+template<class Index, std::size_t ChunkBytes>
+void swap(basic_string_interner<Index, ChunkBytes>& a, basic_string_interner<Index, ChunkBytes>& b) noexcept
+{
+	a.swap(b);
+}
+
+/**
+ * basic_string_interner for concurrent use. Lookups (find(), operator[]
+ * and get_or_insert() of an interned string) are lock-free and never
+ * block. An insert locks one of Stripes mutexes (chosen by the hash, so
+ * inserts of the same string are serialized), copies the string into the
+ * arena of the stripe and publishes it by a CAS of an empty slot. Growing
+ * the table locks all stripes, readers continue with the old table.
+ *
+ * The slot is 64 bits: 32 bits of the hash and the index. The index ->
+ * string column is a list of segments (2^10, 2^11, ... strings) which are
+ * never moved.
+ *
+ * NB old tables are released only by the destructor (they take less
+ * memory than the current one together).
+ */
+template<class Index = std::uint32_t, std::size_t ChunkBytes = 65536, std::size_t Stripes = 16>
+class basic_concurrent_string_interner
+{
+	static_assert(sizeof(Index) <= sizeof(std::uint32_t), "basic_concurrent_string_interner: Index should fit 32 bits");
+	static_assert(Stripes > 0 && (Stripes & (Stripes - 1)) == 0, "basic_concurrent_string_interner: Stripes should be a power of 2");
+
+	using hasher = ref_hash<std::reference_wrapper<const string_view>>;
+
+	static constexpr unsigned first_segment_bits = 10;
+	static constexpr unsigned min_table_bits = 10;
+
+	struct table
 	{
-		auto idx = idx_marker._value;
-		
-		if (idx >= std::get<0>(_index2object_tuple).size() || idx < 0)
-			return end();
+		explicit table(unsigned b)
+			: slots(new std::atomic<std::uint64_t>[std::size_t(1) << b]), bits(b)
+		{
+			for (std::size_t pos = 0; pos <= mask(); ++pos)
+				slots[pos].store(0, std::memory_order_relaxed);
+		}
 
-		return begin() + idx;
+		std::size_t mask() const
+		{
+			return (std::size_t(1) << bits) - 1;
+		}
+
+		std::size_t home(std::uint32_t frag) const
+		{
+			return frag >> (32 - bits);
+		}
+
+		// the number of strings before the table grows (7/8 load)
+		std::size_t limit() const
+		{
+			return mask() + 1 - (mask() + 1) / 8;
+		}
+
+		std::unique_ptr<std::atomic<std::uint64_t>[]> slots; // 0 is an empty slot
+		unsigned bits;
+	};
+
+	struct stripe
+	{
+		std::mutex mutex;
+		impl_::string_arena<ChunkBytes> arena;
+	};
+
+public:
+	using index_type = Index;
+	using index_marker_type = marker::type<marker::index_marker, Index>;
+	using value_type = string_view;
+	using size_type = std::size_t;
+
+	// n is the expected number of strings
+	explicit basic_concurrent_string_interner(size_type n = 0)
+	{
+		unsigned bits = min_table_bits;
+		while ((size_type(1) << bits) - (size_type(1) << bits) / 8 < n)
+			++bits;
+		assert(bits <= 32 && "basic_concurrent_string_interner: too many strings");
+
+		_tables.emplace_back(new table(bits));
+		_table.store(_tables.back().get(), std::memory_order_release);
+
+		for (auto& seg : _segments)
+			seg.store(nullptr, std::memory_order_relaxed);
 	}
 
-	template<class T>
-	iterator find(const T& obj)
+	basic_concurrent_string_interner(const basic_concurrent_string_interner&) = delete;
+	basic_concurrent_string_interner& operator=(const basic_concurrent_string_interner&) = delete;
+
+	~basic_concurrent_string_interner()
 	{
-		auto& o2i = object2index<T>();
-		
-		const auto it = o2i.find(obj);
-		if (it == o2i.end())
-			return end();
+		for (auto& seg : _segments)
+			delete[] seg.load(std::memory_order_relaxed);
+	}
 
-		return begin() + it->second;
+	// The index of s, s is copied into the arena if it is a new string
+	index_type get_or_insert(string_view s)
+	{
+		const std::uint32_t frag = impl_::hash_fragment<hasher>(s);
+		index_type idx;
+		if (lookup(*_table.load(std::memory_order_acquire), s, frag, idx))
+			return idx;
+
+		stripe& st = _stripes[frag & (Stripes - 1)];
+		string_view stored;
+		for (;;)
+		{
+			std::unique_lock<std::mutex> lock(st.mutex);
+
+			// no table change while a stripe is locked
+			table* t = _table.load(std::memory_order_acquire);
+			if (lookup(*t, s, frag, idx))
+				return idx;
+
+			std::size_t n = _next.load(std::memory_order_relaxed);
+			do
+			{
+				if (n >= t->limit())
+					break;
+				if (n > (std::size_t) std::numeric_limits<index_type>::max())
+					throw std::length_error("basic_concurrent_string_interner: too many strings");
+			}
+			while (!_next.compare_exchange_weak(n, n + 1, std::memory_order_relaxed));
+
+			if (n >= t->limit())
+			{
+				lock.unlock();
+				grow(t);
+				continue;
+			}
+
+			if (stored.data() == nullptr && !s.empty())
+				stored = st.arena.store(s);
+
+			idx = static_cast<index_type>(n);
+			column_slot(idx) = stored;
+			publish(*t, frag, idx);
+			_size.fetch_add(1, std::memory_order_relaxed);
+			return idx;
+		}
 	}
 
-	template<class T>
-	const_iterator find(const T& obj) const
+	// no value if s is not interned
+	index_marker_type find(string_view s) const
 	{
-		auto& o2i = object2index<T>();
-		
-		const auto it = o2i.find(obj);
-		if (it == o2i.end())
-			return end();
+		index_type idx;
+		if (!lookup(*_table.load(std::memory_order_acquire), s, impl_::hash_fragment<hasher>(s), idx))
+			return index_marker_type{};
 
-		return begin() + it->second;
+		return index_marker_type{idx};
 	}
 
-	template<class T>
-	iterator strict_find(const T& obj)
+	// idx should be returned by get_or_insert() or find()
+	string_view operator[](index_type idx) const
 	{
-		return (types::has_no_value(obj)) ? iterator{} : find(obj);
+		return object_at(idx);
 	}
 
-	template<class T>
-	const_iterator strict_find(const T& obj) const
+	size_type size() const noexcept
 	{
-		return (types::has_no_value(obj)) ? iterator{} : find(obj);
+		return _size.load(std::memory_order_relaxed);
 	}
 
-	template<class T>
-	auto lower_bound(const T& obj) const
+	bool empty() const noexcept
 	{
-		return object2index<T>().lower_bound(obj);
+		return size() == 0;
 	}
 
-	template<class T>
-	auto upper_bound(const T& obj) const
+	// the bytes of all strings (locks the stripes one by one)
+	size_type bytes() const
 	{
-		return object2index<T>().upper_bound(obj);
+		size_type res = 0;
+		for (auto& st : _stripes)
+		{
+			std::lock_guard<std::mutex> lock(st.mutex);
+			res += st.arena.bytes();
+		}
+		return res;
 	}
 
-	template<class T>
-	auto equal_range(const T& obj) const
+	// the bytes allocated by the arenas (locks the stripes one by one)
+	size_type arena_bytes() const
 	{
-		return object2index<T>().equal_range(obj);
+		size_type res = 0;
+		for (auto& st : _stripes)
+		{
+			std::lock_guard<std::mutex> lock(st.mutex);
+			res += st.arena.allocated();
+		}
+		return res;
 	}
 
-	reference operator[](index_marker_type idx)
+protected:
+	// segment k holds 2^(first_segment_bits + k) strings
+	static unsigned segment_of(std::size_t idx, std::size_t& offset)
 	{
-		index_type idx_int;
-		if (!types::get_value(idx, idx_int))
-			return reference{};
-		
-		auto it = begin() + idx_int;
-		if (it >= end())
-			return reference{};
-		else
-			return *it;
+		const unsigned k = impl_::floor_log2((idx >> first_segment_bits) + 1);
+		offset = idx - (((std::size_t(1) << k) - 1) << first_segment_bits);
+		return k;
 	}
-	
-	const_reference operator[](index_marker_type idx) const
+
+	string_view object_at(std::size_t idx) const
 	{
-		index_type idx_int;
-		if (!types::get_value(idx, idx_int))
-			return const_reference{};
-		
-		auto it = begin() + idx_int;
-		if (it >= end())
-			return const_reference{};
-		else
-			return *it;
+		std::size_t offset;
+		const unsigned k = segment_of(idx, offset);
+		return _segments[k].load(std::memory_order_acquire)[offset];
 	}
-	
-	template<class T>
-	reference operator[](const T& obj)
+
+	string_view& column_slot(std::size_t idx)
 	{
-		auto it = find(obj);
-		if (it < begin() || it >= end())
-			return reference{};
-		else
-			return *it;
+		std::size_t offset;
+		const unsigned k = segment_of(idx, offset);
+		string_view* seg = _segments[k].load(std::memory_order_acquire);
+		if (seg == nullptr)
+		{
+			std::unique_ptr<string_view[]> fresh(new string_view[std::size_t(1) << (first_segment_bits + k)]);
+			if (_segments[k].compare_exchange_strong(seg, fresh.get(), std::memory_order_acq_rel))
+				seg = fresh.release();
+		}
+		return seg[offset];
 	}
-	
-	template<
-		class T,
-		std::enable_if_t<!std::is_same<T, index_marker_type>::value, bool> = false
-	>
-	const_reference operator[](const T& obj) const
+
+	bool lookup(const table& t, string_view s, std::uint32_t frag, index_type& idx) const
 	{
-		auto it = find(obj);
-		if (it < begin() || it >= end())
-			return const_reference{};
-		else
-			return *it;
+		for (std::size_t pos = t.home(frag); ; pos = (pos + 1) & t.mask())
+		{
+			const std::uint64_t v = t.slots[pos].load(std::memory_order_acquire);
+			if (v == 0)
+				return false;
+
+			if ((v >> 32) == frag && object_at(v & 0xffffffffu) == s)
+			{
+				idx = static_cast<index_type>(v & 0xffffffffu);
+				return true;
+			}
+		}
 	}
-	
-	
-	template<class T>
-	reference at(const T& obj)
+
+	// the column slot of idx is written before
+	static void publish(table& t, std::uint32_t frag, index_type idx)
 	{
-		auto it = find(obj);
-		if (it < begin() || it >= end())
-			throw std::out_of_range("two_way_object_indexer at()");
-		else
-			return *it;
+		const std::uint64_t v = (std::uint64_t(frag) << 32) | std::uint64_t(idx);
+		for (std::size_t pos = t.home(frag); ; pos = (pos + 1) & t.mask())
+		{
+			std::uint64_t empty = 0;
+			if (t.slots[pos].load(std::memory_order_relaxed) == 0
+				&& t.slots[pos].compare_exchange_strong(empty, v, std::memory_order_release, std::memory_order_relaxed))
+				return;
+		}
 	}
 
-	template<class T>
-	const_reference at(const T& obj) const
+	// doubles the table if it is still seen
+	void grow(table* seen)
 	{
-		auto it = find(obj);
-		if (it < begin() || it >= end())
-			throw std::out_of_range("two_way_object_indexer at()");
-		else
-			return *it;
+		std::array<std::unique_lock<std::mutex>, Stripes> locks;
+		for (std::size_t i = 0; i < Stripes; ++i)
+			locks[i] = std::unique_lock<std::mutex>(_stripes[i].mutex);
+
+		if (_table.load(std::memory_order_relaxed) != seen)
+			return;
+
+		assert(seen->bits < 32 && "basic_concurrent_string_interner: too many strings");
+		std::unique_ptr<table> t(new table(seen->bits + 1));
+		for (std::size_t pos = 0; pos <= seen->mask(); ++pos)
+		{
+			const std::uint64_t v = seen->slots[pos].load(std::memory_order_relaxed);
+			if (v == 0)
+				continue;
+
+			std::size_t p = t->home(static_cast<std::uint32_t>(v >> 32));
+			while (t->slots[p].load(std::memory_order_relaxed) != 0)
+				p = (p + 1) & t->mask();
+			t->slots[p].store(v, std::memory_order_relaxed);
+		}
+
+		_table.store(t.get(), std::memory_order_release);
+		_tables.push_back(std::move(t));
 	}
 
-	void erase(const iterator& it)
+private:
+	std::atomic<table*> _table;
+	std::vector<std::unique_ptr<table>> _tables; // the current and the old ones, changed by grow()
+	std::array<std::atomic<string_view*>, 33 - first_segment_bits> _segments;
+	mutable std::array<stripe, Stripes> _stripes;
+	std::atomic<std::size_t> _next{0}; // the next index
+	std::atomic<std::size_t> _size{0}; // published strings
+};
+
+} // namespace two_way_object_indexer
+
+using string_interner = two_way_object_indexer::basic_string_interner<>;
+using concurrent_string_interner = two_way_object_indexer::basic_concurrent_string_interner<>;
+
+/**
+ * Sorted array object -> index map for read-mostly dictionaries. It can be
+ * used as Object2IndexT of multi_way_object_indexer instead of map::map and
+ * supports lower_bound, upper_bound and equal_range the same way.
+ *
+ * Like basic_flat_unordered_map it stores only indexes and compares objects
+ * through the bound index -> object column (see bind_column()). Inserts go
+ * to a small sorted delta which is merged into the main array when it
+ * exceeds ~sqrt(size()) elements or before an ordered traversal (begin(),
+ * lower_bound(), upper_bound()). find() and emplace() look into both
+ * arrays and never merge.
+ *
+ * NB the const ordered traversal merges the delta, so concurrent readers
+ * need an exclusive lock after inserts (or call merge() beforehand).
+ */
+template<class Key, class T, template<class> class Column, class Compare = ref_less<Key>>
+class basic_flat_sorted_map
+{
+public:
+	using key_type = Key;
+	using object_type = types::remove_cvrefw_t<Key>;
+	using mapped_type = T;
+	using value_type = std::pair<Key, T>;
+	using size_type = std::size_t;
+	using difference_type = std::ptrdiff_t;
+	using key_compare = Compare;
+	using column_type = Column<object_type>;
+
+private:
+	static constexpr size_type min_delta = 16;
+
+public:
+	class iterator
 	{
-		if (it.is_no_value())
-			return; // false;
+		friend class basic_flat_sorted_map;
+
+		struct arrow
+		{
+			value_type v;
+
+			const value_type* operator->() const { return &v; }
+		};
+
+		const basic_flat_sorted_map* _map = nullptr;
+		size_type _pos = 0; // positions >= _sorted.size() are in the delta
+
+		iterator(const basic_flat_sorted_map* m, size_type pos) : _map(m), _pos(pos) {}
+
+	public:
+		using iterator_category = std::bidirectional_iterator_tag;
+		using value_type = basic_flat_sorted_map::value_type;
+		using difference_type = std::ptrdiff_t;
+		using reference = value_type;
+		using pointer = arrow;
+
+		iterator() {}
+
+		reference operator*() const
+		{
+			const T index = _map->index_at(_pos);
+			return value_type(std::cref(_map->object(index)), index);
+		}
+
+		pointer operator->() const
+		{
+			return arrow{**this};
+		}
 
-		if (it < begin() || it >= end())
-			return; // false;
+		iterator& operator++()
+		{
+			++_pos;
+			return *this;
+		}
 
-		_erased.push_back(it._idx);
-		
-		tuple_helper_2w::template for_each_no_result_forward_args<erase_functor_2w>(
-			_object2index_tuple,
-			_index2object_tuple,
-			it._idx
-		);
-		tuple_helper_1w::template for_each_no_result_forward_args<erase_functor_1w>(
-			_index2object_tuple,
-			it._idx
-		);
-	}
+		iterator operator++(int)
+		{
+			iterator copy = *this;
+			++_pos;
+			return copy;
+		}
 
-#if 1
-	template<class Key, class... Pars>
-	std::pair<reference, bool> update_or_insert(const Key& key, Pars&&... pars)
-	{
-		bool insert = false;
-		
-		auto it = find(key);
-		if (it == end())
+		iterator& operator--()
 		{
-			push_back_int(value_type::make_value_tuple(std::forward_as_tuple(key, std::forward<Pars>(pars)...)));
-			it = end() - 1;
-			insert = true;
+			--_pos;
+			return *this;
 		}
-		else
+
+		iterator operator--(int)
 		{
-			tuple::helper<std::tuple<Pars...>>::template for_each_no_result_forward_args<protect<TwoWayObjects>::template rewrite_functor_1w>(
-				_index2object_tuple,
-				std::forward_as_tuple(std::forward<Pars>(pars)...),
-				(*it).template by_type<const index_marker_type>()
-			);
+			iterator copy = *this;
+			--_pos;
+			return copy;
 		}
-		assert((*it).template by_type<const Key>() == key);
-		return std::make_pair(*it, insert);
-	}
 
-	// this one should be used to modify 2-way objects
-	// it keeps the old i2o row but removes all key references to it
-	// returns true if the old row was not found by `key` (so logically it is a new row)
-	// NB when a map containing `key` is a multimap be ready to call Houston
-	template<class Key, class... Pars>
-	bool push_back_as_update(const Key& key, Pars&&... pars)
-	{
-		const auto old_it = find(key);
-		if (old_it == end())
+		bool operator==(const iterator& o) const
 		{
-			push_back(std::forward_as_tuple(key, std::forward<Pars>(pars)...));
-			return true; 
+			return _pos == o._pos;
 		}
 
-		index_type old_idx;
-		if (!types::get_value((*old_it).index(), old_idx))
+		bool operator!=(const iterator& o) const
 		{
-			assert(false);
-			return false;
+			return !operator==(o);
 		}
-		
-		// insert a new row, i2o only yet
-		// NB both 1w and 2w objects
-		tuple_helper_all::template for_each_no_result_forward_args<push_functor_1w>(
-			_index2object_tuple,
-			value_type::make_value_tuple(std::forward_as_tuple(key, std::forward<Pars>(pars)...)),
-			_end_idx
-		);
+	};
 
-		tuple_helper_2w::template for_each_no_result_forward_args<update_keys_functor_2w>(
-			_object2index_tuple,
-			_index2object_tuple,
-			old_idx,
-			_end_idx
-		);
-		
-		++_end_idx;
-		
-		return false;
+	using const_iterator = iterator;
+
+	basic_flat_sorted_map() {}
+
+	void bind_column(const column_type& column)
+	{
+		_column = &column;
 	}
-#endif
-	
-protected:
-	iterator push_back_int(value_tuple&& tup)
+
+	// NB merges the delta
+	iterator begin() const
 	{
-		// 2 way objects
-		
-		tuple_helper_2w::template for_each_no_result_forward_args<push_functor_2w>(
-			_object2index_tuple,
-			_index2object_tuple,
-			std::move(tup),
-			_end_idx
-		);
+		merge();
+		return iterator(this, 0);
+	}
 
-		// 1 way objects
+	iterator end() const
+	{
+		return iterator(this, size());
+	}
 
-		tuple_helper_1w::template for_each_no_result_forward_args<push_functor_1w>(
-			_index2object_tuple,
-			std::move(tup),
-			_end_idx
-		);
+	size_type size() const noexcept
+	{
+		return _sorted.size() + _delta.size();
+	}
 
-		return iterator(&_index2object_tuple, _end_idx++);
+	bool empty() const noexcept
+	{
+		return size() == 0;
 	}
-	
-	iterator push_in_hole_int(value_tuple&& tup)
+
+	void clear()
 	{
-		if (_erased.empty()) { // there is no hole, push back
-			return push_back_int(std::move(tup));
-		}
-		
-		const index_type idx = _erased.back();
-		_erased.pop_back();
+		_sorted.clear();
+		_delta.clear();
+	}
 
-		tuple_helper_2w::template for_each_no_result_forward_args<rewrite_functor_2w>(
-			_object2index_tuple,
-			_index2object_tuple,
-			std::move(tup),
-			idx
-		);
+	void reserve(size_type n)
+	{
+		_sorted.reserve(n);
+	}
 
-		// 1 way objects
+	key_compare key_comp() const
+	{
+		return key_compare();
+	}
 
-		tuple_helper_1w::template for_each_no_result_forward_args<protect<TwoWayObjects>::template rewrite_functor_1w>(
-			_index2object_tuple,
-			std::move(tup),
-			index_marker_type{idx}
-		);
+	// K may be any type supported by the (transparent) key_compare
+	template<class K>
+	iterator find(const K& obj) const
+	{
+		auto it = std::lower_bound(_sorted.begin(), _sorted.end(), probe<K>{obj}, index_compare{this});
+		if (it != _sorted.end() && !less(obj, object(*it)))
+			return iterator(this, it - _sorted.begin());
 
-		return iterator(&_index2object_tuple, idx);
+		it = std::lower_bound(_delta.begin(), _delta.end(), probe<K>{obj}, index_compare{this});
+		if (it != _delta.end() && !less(obj, object(*it)))
+			return iterator(this, _sorted.size() + (it - _delta.begin()));
+
+		return end();
 	}
-	
-	template<class T>
-	Object2IndexT<std::reference_wrapper<const T>, Index>& object2index()
+
+	size_type count(const object_type& obj) const
 	{
-		static_assert(
-			tuple::among_tuple_types<T, TwoWayObjects>::value,
-			"Unable to index the collection by the type not specified in TwoWayObjects"
+		return find(obj) != end();
+	}
+
+	// NB merges the delta
+	template<class K>
+	iterator lower_bound(const K& obj) const
+	{
+		merge();
+		return iterator(
+			this,
+			std::lower_bound(_sorted.begin(), _sorted.end(), probe<K>{obj}, index_compare{this}) - _sorted.begin()
 		);
-		return std::get<Object2IndexT<std::reference_wrapper<const T>, Index>>(_object2index_tuple);
 	}
 
-	template<class T>
-	const Object2IndexT<std::reference_wrapper<const T>, Index>& object2index() const
+	// NB merges the delta
+	template<class K>
+	iterator upper_bound(const K& obj) const
 	{
-		static_assert(
-			tuple::among_tuple_types<T, TwoWayObjects>::value,
-			"Unable to index the collection by the type not specified in TwoWayObjects"
+		merge();
+		return iterator(
+			this,
+			std::upper_bound(_sorted.begin(), _sorted.end(), probe<K>{obj}, index_compare{this}) - _sorted.begin()
 		);
-		return std::get<Object2IndexT<std::reference_wrapper<const T>, Index>>(_object2index_tuple);
 	}
 
-	template<class T>
-	Index2ObjectT<T>& index2object()
+	// objects are unique, doesn't merge the delta
+	std::pair<iterator, iterator> equal_range(const object_type& obj) const
 	{
-		return std::get<Index2ObjectT<T>>(_index2object_tuple);
+		auto it = find(obj);
+		if (it == end())
+			return std::make_pair(it, it);
+
+		auto next = it;
+		return std::make_pair(it, ++next);
 	}
 
-	template<class T>
-	const Index2ObjectT<std::reference_wrapper<const T>>& index2object() const
+	// NB objects are unique, the existing element is not replaced
+	std::pair<iterator, bool> emplace(const Key& key, T index)
 	{
-		return std::get<Index2ObjectT<T>>(_index2object_tuple);
+		const object_type& obj = key;
+		auto found = find(obj);
+		if (found != end())
+			return std::make_pair(found, false);
+
+		const auto it = _delta.insert(
+			std::upper_bound(_delta.begin(), _delta.end(), probe<object_type>{obj}, index_compare{this}),
+			index
+		);
+		if (_delta.size() <= delta_limit())
+			return std::make_pair(iterator(this, _sorted.size() + (it - _delta.begin())), true);
+
+		merge();
+		return std::make_pair(find(obj), true);
 	}
 
-private:
-	objects2index_tuple _object2index_tuple;
-	index2objects_tuple _index2object_tuple;
-	index_type _end_idx = 0;
-	std::list<index_type> _erased;
-};
+	iterator emplace_hint(const_iterator, const Key& key, T index)
+	{
+		return emplace(key, index).first;
+	}
 
+	void erase(const_iterator it)
+	{
+		assert(it._map == this && it._pos < size());
 
-} // namespace multi_way_object_indexer
+		if (it._pos < _sorted.size())
+			_sorted.erase(_sorted.begin() + it._pos);
+		else
+			_delta.erase(_delta.begin() + (it._pos - _sorted.size()));
+	}
 
-template<class Key>
-struct ref_hash : marker::hash<Key> {};
+	size_type erase(const object_type& obj)
+	{
+		auto it = find(obj);
+		if (it == end())
+			return 0;
 
-template<class K>
-struct ref_hash<std::reference_wrapper<K>>
-{
-	using hash = marker::hash<K>;
+		erase(it);
+		return 1;
+	}
 
-	std::size_t operator()(const K& k) const { return hash()(k); }
-};
+	// merges the delta into the main array
+	void merge() const
+	{
+		if (_delta.empty())
+			return;
 
-template<class K>
-struct ref_hash<std::reference_wrapper<const K>>
-{
-	using hash = marker::hash<K>;
+		std::vector<T> merged;
+		merged.reserve(std::max(_sorted.capacity(), size()));
+		std::merge(
+			_sorted.begin(), _sorted.end(),
+			_delta.begin(), _delta.end(),
+			std::back_inserter(merged),
+			[this](T a, T b) { return less(object(a), object(b)); }
+		);
+		_sorted.swap(merged);
+		_delta.clear();
+	}
 
-	std::size_t operator()(const K& k) const { return hash()(k); }
-};
+	void swap(basic_flat_sorted_map& o)
+	{
+		using std::swap;
 
-template<class T>
-struct ref_less : std::less<T> {};
+		swap(_sorted, o._sorted);
+		swap(_delta, o._delta);
+		swap(_column, o._column);
+	}
 
-template<class T>
-struct ref_less<T&>
-{
-	using less = std::less<T>;
+protected:
+	// the object searched (distinct from T even if K is T)
+	template<class K>
+	struct probe
+	{
+		const K& obj;
+	};
 
-	bool operator()(const T& a, const T& b) const { return less()(a, b); }
-};
+	// compares an index and an object in both orders (for lower/upper_bound)
+	struct index_compare
+	{
+		const basic_flat_sorted_map* map;
 
-template<class T>
-struct ref_less<std::reference_wrapper<T>>
-{
-	using less = std::less<T>;
+		template<class K>
+		bool operator()(T idx, const probe<K>& p) const
+		{
+			return map->less(map->object(idx), p.obj);
+		}
 
-	bool operator()(const T& a, const T& b) const { return less()(a, b); }
-};
+		template<class K>
+		bool operator()(const probe<K>& p, T idx) const
+		{
+			return map->less(p.obj, map->object(idx));
+		}
+	};
 
-template<class T>
-struct ref_equal_to : std::equal_to<T> {};
+	template<class A, class B>
+	static bool less(const A& a, const B& b)
+	{
+		return key_compare()(a, b);
+	}
 
-template<class T>
-struct ref_equal_to<std::reference_wrapper<T>>
-{
-	using equal_to = std::equal_to<T>;
-	
-	bool operator()(const T& a, const T& b) const { return equal_to()(a, b); }
+	const object_type& object(T index) const
+	{
+		assert(_column);
+		return (*_column)[index];
+	}
+
+	T index_at(size_type pos) const
+	{
+		return (pos < _sorted.size()) ? _sorted[pos] : _delta[pos - _sorted.size()];
+	}
+
+	size_type delta_limit() const
+	{
+		size_type limit = min_delta;
+		while (limit * limit < _sorted.size())
+			limit *= 2;
+		return limit;
+	}
+
+private:
+	mutable std::vector<T> _sorted;
+	mutable std::vector<T> _delta; // sorted too
+	const column_type* _column = nullptr;
 };
 
+template<class K, class V, template<class> class C, class Cmp>
+constexpr typename basic_flat_sorted_map<K, V, C, Cmp>::size_type basic_flat_sorted_map<K, V, C, Cmp>::min_delta;
 
-// all default parameters except Key and Value
-template<class Key, class T>
-using map = std::map<Key, T, ref_less<Key>>;
+template<class K, class V, template<class> class C, class Cmp, class Column>
+void bind_column(basic_flat_sorted_map<K, V, C, Cmp>& o2i, const Column& column)
+{
+	static_assert(
+		std::is_same<Column, typename basic_flat_sorted_map<K, V, C, Cmp>::column_type>::value,
+		"basic_flat_sorted_map: Column doesn't match Index2ObjectT of the indexer"
+	);
+	o2i.bind_column(column);
+}
 
-template<class Key, class T>
-using multimap = std::multimap<Key, T, ref_less<Key>>;
+template<class K, class V, template<class> class C, class Cmp>
+void swap(basic_flat_sorted_map<K, V, C, Cmp>& a, basic_flat_sorted_map<K, V, C, Cmp>& b)
+{
+	a.swap(b);
+}
 
+// the drop-in replacement of map::map as Object2IndexT
 template<class Key, class T>
-using unordered_map = std::unordered_map<Key, T, ref_hash<Key>, ref_equal_to<Key>>;
-
-// Don't use vector! (we should guarantee constant memory position with elements)
-template<class T>
-using deque = std::deque<T>;
+using flat_map = basic_flat_sorted_map<Key, T, deque>;
 
 /* std::back_insert_iterator extension */
 
@@ -2603,3 +7391,32 @@ back_insert_iterator<Container> back_inserter(Container& c)
 }
 
 } // namespace map
+
+namespace types
+{
+
+template<class Key, class Value, template<class> class Column>
+struct key_type<map::basic_flat_unordered_map<Key, Value, Column>>
+{
+	using type = Key;
+};
+
+template<class Key, class Value, template<class> class Column, class Compare>
+struct key_type<map::basic_flat_sorted_map<Key, Value, Column, Compare>>
+{
+	using type = Key;
+};
+
+template<class Value, std::size_t ChunkBits>
+struct key_type<map::basic_chunked_vector<Value, ChunkBits>>
+{
+	using type = Value;
+};
+
+template<class Value, std::size_t ChunkBits>
+struct key_type<map::basic_cow_chunked_vector<Value, ChunkBits>>
+{
+	using type = Value;
+};
+
+} // namespace types
@@ -0,0 +1,471 @@
+#pragma once
+
+#include "maps.h"
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A flat file image of multi_way_object_indexer::type with trivially
+// copyable objects. The image contains the columns as arrays and an open
+// addressing hash table per 2-way column (the layout of
+// basic_flat_unordered_map). mapped_image maps the file and is usable
+// read-only without any rebuild.
+//
+// NB the image is bound to the platform and the hash functions of the
+// binary which wrote it.
+namespace map
+{
+
+namespace multi_way_object_indexer
+{
+
+struct image_header
+{
+	char magic[8];
+	std::uint64_t rows;
+	std::uint32_t columns; // 2-way columns first, then 1-way
+	std::uint32_t indexes; // one per 2-way column
+	// followed by image_section[columns + indexes]
+};
+
+struct image_section
+{
+	std::uint64_t offset; // from the image start
+	std::uint64_t count; // elements or slots
+	std::uint32_t elem_size;
+	std::uint32_t bits; // log2(count) for hash tables
+};
+
+template<class Index>
+struct image_slot
+{
+	std::uint32_t fragment; // 0 means an empty slot
+	Index index;
+};
+
+constexpr char image_magic[8] = {'M', 'W', 'O', 'I', 'M', 'G', '1', 0};
+constexpr std::size_t image_alignment = 64;
+
+struct image_access
+{
+	template<class T, class Table>
+	static decltype(auto) column(const Table& t)
+	{
+		return t.template index2object<T>();
+	}
+
+	template<class T, class Table>
+	static decltype(auto) object2index(const Table& t)
+	{
+		return t.template object2index<T>();
+	}
+};
+
+namespace impl_
+{
+
+inline std::uint64_t align_image(std::uint64_t offset)
+{
+	return (offset + image_alignment - 1) & ~std::uint64_t(image_alignment - 1);
+}
+
+template<class T, class... Ts>
+struct type_position;
+
+template<class T, class... Ts>
+struct type_position<T, T, Ts...> : std::integral_constant<std::size_t, 0> {};
+
+template<class T, class U, class... Ts>
+struct type_position<T, U, Ts...> : std::integral_constant<std::size_t, 1 + type_position<T, Ts...>::value> {};
+
+template<class... Ts>
+struct all_trivially_copyable : std::true_type {};
+
+template<class T, class... Ts>
+struct all_trivially_copyable<T, Ts...> : std::integral_constant<
+	bool,
+	std::is_trivially_copyable<T>::value && all_trivially_copyable<Ts...>::value
+> {};
+
+template<class T>
+using image_hasher = ref_hash<std::reference_wrapper<const T>>;
+
+// hash table slots for the 2-way column T built from the indexer map
+template<class Index, class T, class Object2Index, class Column>
+std::vector<image_slot<Index>> build_slots(const Object2Index& o2i, const Column& column, unsigned& bits)
+{
+	std::size_t cap = 8;
+	while (cap - cap / 8 < o2i.size())
+		cap *= 2;
+	bits = 0;
+	while ((std::size_t(1) << bits) < cap)
+		++bits;
+
+	std::vector<image_slot<Index>> slots(cap, image_slot<Index>{0, Index()});
+	for (const auto& kv : o2i)
+	{
+		const Index idx = kv.second;
+		const std::uint32_t frag = ::map::impl_::hash_fragment<image_hasher<T>>(column[idx]);
+		std::size_t pos = frag >> (32 - bits);
+		while (slots[pos].fragment != 0)
+			pos = (pos + 1) & (cap - 1);
+		slots[pos] = image_slot<Index>{frag, idx};
+	}
+	return slots;
+}
+
+inline void write_padding(std::ostream& out, std::uint64_t& offset, std::uint64_t to)
+{
+	static const char zeros[image_alignment] = {};
+	assert(to >= offset && to - offset < image_alignment);
+	out.write(zeros, to - offset);
+	offset = to;
+}
+
+template<class T, class Column>
+void write_column(std::ostream& out, const Column& column, std::size_t rows)
+{
+	// copy through a buffer, Column elements are not contiguous
+	std::vector<T> buf;
+	buf.reserve(std::min<std::size_t>(rows, 4096));
+	for (std::size_t idx = 0; idx < rows; ++idx)
+	{
+		buf.push_back(column[idx]);
+		if (buf.size() == buf.capacity() || idx + 1 == rows)
+		{
+			out.write(reinterpret_cast<const char*>(buf.data()), buf.size() * sizeof(T));
+			buf.clear();
+		}
+	}
+}
+
+} // namespace impl_
+
+template<class Table>
+class image_view;
+
+/**
+ * A read-only view of an image in memory (see write_image()). The column
+ * of T is a contiguous array, find() probes the image hash table.
+ */
+template<
+	template<class, class> class Object2IndexT,
+	template<class> class Index2ObjectT,
+	class Index,
+	class... TwoWay,
+	class... OneWay,
+	class Stats
+>
+class image_view<type<Object2IndexT, Index2ObjectT, Index, std::tuple<TwoWay...>, std::tuple<OneWay...>, Stats>>
+{
+public:
+	using table_type = type<Object2IndexT, Index2ObjectT, Index, std::tuple<TwoWay...>, std::tuple<OneWay...>, Stats>;
+	using index_type = Index;
+	using index_marker_type = marker::type<marker::index_marker, Index>;
+	using size_type = std::size_t;
+
+	static constexpr std::size_t columns = sizeof...(TwoWay) + sizeof...(OneWay);
+	static constexpr std::size_t indexes = sizeof...(TwoWay);
+
+	image_view() {}
+
+	// throws std::runtime_error if the image doesn't match the table type
+	// or is corrupt, the hash tables are checked too (O(slots)) so an
+	// image from an untrusted source doesn't make find() read out of the
+	// columns or loop
+	image_view(const void* data, std::size_t size)
+		: _data(static_cast<const char*>(data))
+	{
+		if (size < sizeof(image_header) + (columns + indexes) * sizeof(image_section))
+			throw std::runtime_error("multi_way_object_indexer image: truncated");
+
+		const image_header& h = header();
+		if (std::memcmp(h.magic, image_magic, sizeof(image_magic)) != 0)
+			throw std::runtime_error("multi_way_object_indexer image: bad magic");
+
+		if (h.columns != columns || h.indexes != indexes)
+			throw std::runtime_error("multi_way_object_indexer image: the number of columns doesn't match");
+
+		const std::size_t elem_sizes[] = {sizeof(TwoWay)..., sizeof(OneWay)...};
+		for (std::size_t k = 0; k < columns + indexes; ++k)
+		{
+			const image_section& s = section(k);
+			const std::size_t elem_size = (k < columns) ? elem_sizes[k] : sizeof(image_slot<Index>);
+			if (s.elem_size != elem_size || s.offset % image_alignment != 0)
+				throw std::runtime_error("multi_way_object_indexer image: the layout doesn't match");
+
+			if (s.offset > size || s.count > (size - s.offset) / elem_size)
+				throw std::runtime_error("multi_way_object_indexer image: truncated");
+
+			if (k < columns && s.count != h.rows)
+				throw std::runtime_error("multi_way_object_indexer image: bad column size");
+		}
+
+		for (std::size_t k = columns; k < columns + indexes; ++k)
+			check_index(section(k), h.rows);
+	}
+
+	size_type size() const noexcept
+	{
+		return (_data) ? header().rows : 0;
+	}
+
+	bool empty() const noexcept
+	{
+		return size() == 0;
+	}
+
+	// the array of size() objects
+	template<class T>
+	const T* column() const
+	{
+		constexpr std::size_t k = impl_::type_position<T, TwoWay..., OneWay...>::value;
+		return reinterpret_cast<const T*>(_data + section(k).offset);
+	}
+
+	template<class T>
+	index_marker_type find(const T& obj) const
+	{
+		static_assert(
+			tuple::among_types<T, TwoWay...>::value,
+			"Unable to index the collection by the type not specified in TwoWayObjects"
+		);
+		constexpr std::size_t k = impl_::type_position<T, TwoWay...>::value;
+
+		const image_section& s = section(columns + k);
+		const auto* slots = reinterpret_cast<const image_slot<Index>*>(_data + s.offset);
+		const T* objects = column<T>();
+		const std::size_t mask = s.count - 1;
+
+		const std::uint32_t frag = ::map::impl_::hash_fragment<impl_::image_hasher<T>>(obj);
+		for (std::size_t pos = frag >> (32 - s.bits); slots[pos].fragment != 0; pos = (pos + 1) & mask)
+		{
+			if (slots[pos].fragment == frag && ref_equal_to<std::reference_wrapper<const T>>()(objects[slots[pos].index], obj))
+				return index_marker_type{slots[pos].index};
+		}
+		return index_marker_type{};
+	}
+
+	// the object of the row found by another object
+	template<class T, class Key>
+	const T* find_object(const Key& key) const
+	{
+		index_type idx;
+		if (!types::get_value(find(key), idx))
+			return nullptr;
+		return column<T>() + idx;
+	}
+
+protected:
+	const image_header& header() const
+	{
+		return *reinterpret_cast<const image_header*>(_data);
+	}
+
+	const image_section& section(std::size_t k) const
+	{
+		return reinterpret_cast<const image_section*>(_data + sizeof(image_header))[k];
+	}
+
+	// find() needs count = 2^bits slots with an empty one and the indexes
+	// of the column
+	void check_index(const image_section& s, std::uint64_t rows) const
+	{
+		if (s.bits == 0 || s.bits > 32 || s.count != (std::uint64_t(1) << s.bits))
+			throw std::runtime_error("multi_way_object_indexer image: bad hash table size");
+
+		const auto* slots = reinterpret_cast<const image_slot<Index>*>(_data + s.offset);
+		bool has_empty = false;
+		for (std::uint64_t pos = 0; pos < s.count; ++pos)
+		{
+			if (slots[pos].fragment == 0)
+				has_empty = true;
+			else if (static_cast<std::uint64_t>(slots[pos].index) >= rows) // negative too
+				throw std::runtime_error("multi_way_object_indexer image: bad hash table index");
+		}
+
+		if (!has_empty)
+			throw std::runtime_error("multi_way_object_indexer image: full hash table");
+	}
+
+private:
+	const char* _data = nullptr;
+};
+
+/**
+ * Writes the image of the table. All objects should be trivially
+ * copyable, erased rows are written as is but are not indexed.
+ */
+template<
+	template<class, class> class Object2IndexT,
+	template<class> class Index2ObjectT,
+	class Index,
+	class... TwoWay,
+	class... OneWay,
+	class Stats
+>
+void write_image(
+	const type<Object2IndexT, Index2ObjectT, Index, std::tuple<TwoWay...>, std::tuple<OneWay...>, Stats>& table,
+	std::ostream& out
+)
+{
+	static_assert(
+		impl_::all_trivially_copyable<TwoWay..., OneWay...>::value,
+		"multi_way_object_indexer image: all objects should be trivially copyable"
+	);
+
+	constexpr std::size_t columns = sizeof...(TwoWay) + sizeof...(OneWay);
+	constexpr std::size_t indexes = sizeof...(TwoWay);
+	const std::size_t rows = table.size();
+
+	std::vector<std::vector<image_slot<Index>>> slots;
+	std::vector<unsigned> bits(indexes);
+	{
+		unsigned* b = bits.data();
+		const int expand[] = {0, (
+			slots.push_back(impl_::build_slots<Index, TwoWay>(
+				image_access::object2index<TwoWay>(table),
+				image_access::column<TwoWay>(table),
+				*b++
+			)),
+			0
+		)...};
+		(void) expand;
+	}
+
+	image_header h = {};
+	std::memcpy(h.magic, image_magic, sizeof(image_magic));
+	h.rows = rows;
+	h.columns = columns;
+	h.indexes = indexes;
+
+	std::vector<image_section> sections;
+	std::uint64_t offset = sizeof(image_header) + (columns + indexes) * sizeof(image_section);
+	for (std::size_t elem_size : {sizeof(TwoWay)..., sizeof(OneWay)...})
+	{
+		offset = impl_::align_image(offset);
+		sections.push_back(image_section{offset, rows, (std::uint32_t) elem_size, 0});
+		offset += rows * elem_size;
+	}
+	for (std::size_t k = 0; k < indexes; ++k)
+	{
+		offset = impl_::align_image(offset);
+		sections.push_back(image_section{offset, slots[k].size(), sizeof(image_slot<Index>), bits[k]});
+		offset += slots[k].size() * sizeof(image_slot<Index>);
+	}
+
+	out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+	out.write(reinterpret_cast<const char*>(sections.data()), sections.size() * sizeof(image_section));
+
+	offset = sizeof(image_header) + (columns + indexes) * sizeof(image_section);
+	std::size_t k = 0;
+	const auto next_section = [&out, &offset, &sections, &k]() {
+		impl_::write_padding(out, offset, sections[k].offset);
+		offset += sections[k].count * sections[k].elem_size;
+		++k;
+	};
+
+	const int expand[] = {0, (
+		next_section(),
+		impl_::write_column<TwoWay>(out, image_access::column<TwoWay>(table), rows),
+		0
+	)..., (
+		next_section(),
+		impl_::write_column<OneWay>(out, image_access::column<OneWay>(table), rows),
+		0
+	)...};
+	(void) expand;
+
+	for (const auto& s : slots)
+	{
+		next_section();
+		out.write(reinterpret_cast<const char*>(s.data()), s.size() * sizeof(image_slot<Index>));
+	}
+
+	if (!out)
+		throw std::runtime_error("multi_way_object_indexer image: write error");
+}
+
+template<class Table>
+void save_image(const Table& table, const std::string& path)
+{
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	if (!out)
+		throw std::system_error(errno, std::generic_category(), path);
+
+	write_image(table, out);
+	out.close();
+	if (!out)
+		throw std::system_error(errno, std::generic_category(), path);
+}
+
+// The image file mapped into memory (read-only)
+template<class Table>
+class mapped_image : public image_view<Table>
+{
+public:
+	explicit mapped_image(const std::string& path)
+	{
+		const int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			throw std::system_error(errno, std::generic_category(), path);
+
+		struct stat st;
+		if (::fstat(fd, &st) != 0)
+		{
+			const int err = errno;
+			::close(fd);
+			throw std::system_error(err, std::generic_category(), path);
+		}
+		_size = st.st_size;
+
+		_addr = ::mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+		const int err = errno;
+		::close(fd); // the mapping keeps the file
+		if (_addr == MAP_FAILED)
+		{
+			_addr = nullptr;
+			throw std::system_error(err, std::generic_category(), path);
+		}
+
+		try
+		{
+			static_cast<image_view<Table>&>(*this) = image_view<Table>(_addr, _size);
+		}
+		catch (...)
+		{
+			::munmap(_addr, _size);
+			throw;
+		}
+	}
+
+	mapped_image(const mapped_image&) = delete;
+	mapped_image& operator=(const mapped_image&) = delete;
+
+	~mapped_image()
+	{
+		if (_addr)
+			::munmap(_addr, _size);
+	}
+
+private:
+	void* _addr = nullptr;
+	std::size_t _size = 0;
+};
+
+} // namespace multi_way_object_indexer
+
+} // namespace map
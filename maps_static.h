@@ -0,0 +1,445 @@
+#pragma once
+
+#include "maps.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// A fixed capacity multi_way_object_indexer which is built in a constexpr
+// context. The columns are std::arrays and every 2-way column has a
+// perfect hash found at compile time (hash and displace: O(N) slots and
+// construction), so a lookup is two multiply-shifts, a displacement and
+// one comparison and a constexpr table costs nothing at startup:
+//
+//   constexpr map::static_multi_way_indexer<
+//     3, std::tuple<int, const char*>, std::tuple<double>
+//   > t{ std::make_tuple(1, "a", 0.5), ... };
+//   static_assert(t.find(1) == 0, "");
+//
+// 2-way objects are integral, enum, const char* or map::string_view.
+// Duplicated objects in a 2-way column or a failed perfect hash search
+// make the construction a non-constant expression (a compile error in a
+// constexpr context).
+namespace map
+{
+
+namespace impl_
+{
+
+// std::array of C++14 has no constexpr non-const access
+template<class T, std::size_t N>
+struct static_array
+{
+	T elems[N];
+
+	constexpr T& operator[](std::size_t i) { return elems[i]; }
+	constexpr const T& operator[](std::size_t i) const { return elems[i]; }
+};
+
+template<class T, std::enable_if_t<std::is_integral<T>::value, bool> = false>
+constexpr std::uint64_t static_hash(T v)
+{
+	return static_cast<std::uint64_t>(v);
+}
+
+template<class T, std::enable_if_t<std::is_enum<T>::value, bool> = false>
+constexpr std::uint64_t static_hash(T v)
+{
+	return static_cast<std::uint64_t>(static_cast<std::underlying_type_t<T>>(v));
+}
+
+constexpr std::size_t static_length(const char* s)
+{
+	std::size_t n = 0;
+	while (s[n] != 0)
+		++n;
+	return n;
+}
+
+// FNV-1a
+constexpr std::uint64_t static_hash(const char* s, std::size_t n)
+{
+	std::uint64_t h = 14695981039346656037ull;
+	for (std::size_t i = 0; i < n; ++i)
+	{
+		h ^= static_cast<unsigned char>(s[i]);
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+constexpr std::uint64_t static_hash(const char* s)
+{
+	return static_hash(s, static_length(s));
+}
+
+constexpr std::uint64_t static_hash(string_view s)
+{
+	return static_hash(s.data(), s.size());
+}
+
+constexpr bool static_equal(const char* a, std::size_t an, const char* b, std::size_t bn)
+{
+	if (an != bn)
+		return false;
+	for (std::size_t i = 0; i < an; ++i)
+		if (a[i] != b[i])
+			return false;
+	return true;
+}
+
+template<class T, class U>
+constexpr bool static_equal(const T& a, const U& b)
+{
+	return a == b;
+}
+
+constexpr bool static_equal(const char* a, const char* b)
+{
+	return static_equal(a, static_length(a), b, static_length(b));
+}
+
+constexpr bool static_equal(const char* a, string_view b)
+{
+	return static_equal(a, static_length(a), b.data(), b.size());
+}
+
+constexpr bool static_equal(string_view a, const char* b)
+{
+	return static_equal(a.data(), a.size(), b, static_length(b));
+}
+
+constexpr bool static_equal(string_view a, string_view b)
+{
+	return static_equal(a.data(), a.size(), b.data(), b.size());
+}
+
+// splitmix64 of the attempt number, odd
+constexpr std::uint64_t static_multiplier(std::uint64_t attempt)
+{
+	std::uint64_t z = (attempt + 1) * 0x9e3779b97f4a7c15ull;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return (z ^ (z >> 31)) | 1;
+}
+
+constexpr std::size_t static_position(std::uint64_t hash, std::uint64_t multiplier, unsigned bits)
+{
+	return static_cast<std::size_t>((hash * multiplier) >> (64 - bits));
+}
+
+constexpr unsigned static_bits(std::size_t want)
+{
+	unsigned bits = 1;
+	while ((std::size_t(1) << bits) < want)
+		++bits;
+	return bits;
+}
+
+// the load factor is up to 0.8
+constexpr unsigned static_slot_bits(std::size_t n)
+{
+	return static_bits(n + n / 4);
+}
+
+// 2 keys per bucket on average
+constexpr unsigned static_bucket_bits(std::size_t n)
+{
+	return static_bits(n / 2);
+}
+
+// an attempt with a bigger bucket is dropped
+constexpr std::size_t static_max_bucket = 8;
+
+constexpr std::size_t static_hash_attempts = 256;
+
+} // namespace impl_
+
+template<std::size_t N, class TwoWayObjects, class OneWayObjects = std::tuple<>>
+class static_multi_way_indexer;
+
+template<std::size_t N, class... TwoWay, class... OneWay>
+class static_multi_way_indexer<N, std::tuple<TwoWay...>, std::tuple<OneWay...>>
+{
+	static_assert(N > 0, "static_multi_way_indexer: zero capacity");
+	static_assert(sizeof...(TwoWay) > 0, "static_multi_way_indexer: no 2-way objects");
+
+public:
+	using row_type = std::tuple<TwoWay..., OneWay...>;
+	using size_type = std::size_t;
+	using columns_type = std::tuple<std::array<TwoWay, N>..., std::array<OneWay, N>...>;
+	using slot_type = std::conditional_t<
+		(N < 0xff),
+		std::uint8_t,
+		std::conditional_t<(N < 0xffff), std::uint16_t, std::uint32_t>
+	>;
+
+	static constexpr size_type npos = size_type(-1);
+	static constexpr unsigned slot_bits = impl_::static_slot_bits(N);
+	static constexpr size_type slot_count = size_type(1) << slot_bits;
+	static constexpr unsigned bucket_bits = impl_::static_bucket_bits(N);
+	static constexpr size_type bucket_count = size_type(1) << bucket_bits;
+	static constexpr slot_type empty_slot = slot_type(-1);
+
+	using displacement_type = std::conditional_t<
+		(slot_count <= 0x100),
+		std::uint8_t,
+		std::conditional_t<(slot_count <= 0x10000), std::uint16_t, std::uint32_t>
+	>;
+
+	// The bucket of a key selects the displacement of its slot:
+	// slot = (position(hash, slot_multiplier) + displacements[bucket]) % slot_count
+	struct perfect_hash
+	{
+		std::uint64_t bucket_multiplier;
+		std::uint64_t slot_multiplier;
+		impl_::static_array<displacement_type, bucket_count> displacements;
+		impl_::static_array<slot_type, slot_count> slots;
+	};
+
+	constexpr static_multi_way_indexer(std::initializer_list<row_type> rows)
+		: _size(rows.size() <= N
+			? rows.size()
+			: throw std::length_error("static_multi_way_indexer: too many rows")),
+		  _columns(make_columns(rows, std::index_sequence_for<TwoWay..., OneWay...>())),
+		  _hashes(make_hashes(rows, std::index_sequence_for<TwoWay...>()))
+	{}
+
+	constexpr size_type size() const { return _size; }
+	constexpr bool empty() const { return _size == 0; }
+	static constexpr size_type capacity() { return N; }
+
+	// Returns the row index of obj or npos
+	template<class T>
+	constexpr size_type find(const T& obj) const
+	{
+		return find_int<std::decay_t<const T>>(obj);
+	}
+
+	// Finds by a key of other type than T (e.g. string_view for a
+	// const char* column)
+	template<class T, class Key, std::enable_if_t<!std::is_same<T, std::decay_t<const Key>>::value, bool> = false>
+	constexpr size_type find(const Key& key) const
+	{
+		return find_int<T>(key);
+	}
+
+	// The object T of the row having the key or nullptr
+	template<class T, class Key>
+	constexpr const T* find_object(const Key& key) const
+	{
+		const size_type idx = find_int<std::decay_t<const Key>>(key);
+		return idx == npos ? nullptr : &get<T>(idx);
+	}
+
+	template<class T>
+	constexpr const T& get(size_type idx) const
+	{
+		return column<T>()[idx];
+	}
+
+	// NB elements past size() are value initialized
+	template<class T>
+	constexpr const std::array<T, N>& column() const
+	{
+		return std::get<column_idx<T>::value>(_columns);
+	}
+
+	template<class T>
+	constexpr const perfect_hash& hash() const
+	{
+		static_assert(column_idx<T>::value < sizeof...(TwoWay), "static_multi_way_indexer: not a 2-way object");
+		return _hashes[column_idx<T>::value];
+	}
+
+protected:
+	template<class T>
+	using column_idx = tuple::container_idx_from_tuple<0, columns_type, T>;
+
+	template<class T, class Key>
+	constexpr size_type find_int(const Key& key) const
+	{
+		constexpr std::size_t k = column_idx<T>::value;
+		static_assert(k < sizeof...(TwoWay), "static_multi_way_indexer: not a 2-way object");
+		const perfect_hash& h = _hashes[k];
+		const slot_type s = h.slots[slot_of(h, impl_::static_hash(key))];
+		return (s != empty_slot && impl_::static_equal(std::get<k>(_columns)[s], key)) ? s : npos;
+	}
+
+	static constexpr size_type slot_of(const perfect_hash& h, std::uint64_t hash)
+	{
+		const size_type b = impl_::static_position(hash, h.bucket_multiplier, bucket_bits);
+		return (impl_::static_position(hash, h.slot_multiplier, slot_bits) + h.displacements[b]) & (slot_count - 1);
+	}
+
+	template<std::size_t K, std::size_t... I>
+	static constexpr std::tuple_element_t<K, columns_type> make_column(
+		std::initializer_list<row_type> rows,
+		std::index_sequence<I...>
+	)
+	{
+		using value_type = std::tuple_element_t<K, row_type>;
+		return {{ (I < rows.size() ? std::get<K>(rows.begin()[I]) : value_type())... }};
+	}
+
+	template<std::size_t... K>
+	static constexpr columns_type make_columns(std::initializer_list<row_type> rows, std::index_sequence<K...>)
+	{
+		return columns_type(make_column<K>(rows, std::make_index_sequence<N>())...);
+	}
+
+	// Hash and displace: the buckets are placed from the biggest, each
+	// one at the first displacement where all its keys find empty slots.
+	// Equal keys share a bucket and a slot position, so the duplicates are
+	// found there.
+	template<std::size_t K>
+	static constexpr perfect_hash make_hash(std::initializer_list<row_type> rows)
+	{
+		const row_type* r = rows.begin();
+		const std::size_t n = rows.size();
+
+		impl_::static_array<std::uint64_t, N> hashes{};
+		for (std::size_t i = 0; i < n; ++i)
+			hashes[i] = impl_::static_hash(std::get<K>(r[i]));
+
+		for (std::uint64_t attempt = 0; attempt < impl_::static_hash_attempts; ++attempt)
+		{
+			perfect_hash h{
+				impl_::static_multiplier(2 * attempt),
+				impl_::static_multiplier(2 * attempt + 1),
+				{},
+				{}
+			};
+			for (std::size_t s = 0; s < slot_count; ++s)
+				h.slots[s] = empty_slot;
+
+			// the keys ordered by bucket
+			impl_::static_array<std::size_t, bucket_count + 1> first{};
+			impl_::static_array<std::size_t, N> bucket_of{};
+			impl_::static_array<std::size_t, N> position{};
+			impl_::static_array<std::size_t, N> keys{};
+			for (std::size_t i = 0; i < n; ++i)
+			{
+				bucket_of[i] = impl_::static_position(hashes[i], h.bucket_multiplier, bucket_bits);
+				position[i] = impl_::static_position(hashes[i], h.slot_multiplier, slot_bits);
+				++first[bucket_of[i] + 1];
+			}
+
+			std::size_t max_size = 0;
+			for (std::size_t b = 0; b < bucket_count; ++b)
+			{
+				if (first[b + 1] > max_size)
+					max_size = first[b + 1];
+				first[b + 1] += first[b];
+			}
+			if (max_size > impl_::static_max_bucket)
+				continue;
+
+			impl_::static_array<std::size_t, bucket_count> filled{};
+			for (std::size_t i = 0; i < n; ++i)
+				keys[first[bucket_of[i]] + filled[bucket_of[i]]++] = i;
+
+			bool perfect = true;
+			for (std::size_t b = 0; b < bucket_count && perfect; ++b)
+			{
+				for (std::size_t x = first[b]; x < first[b + 1] && perfect; ++x)
+				{
+					for (std::size_t y = x + 1; y < first[b + 1] && perfect; ++y)
+					{
+						if (position[keys[x]] != position[keys[y]])
+							continue;
+						if (impl_::static_equal(std::get<K>(r[keys[x]]), std::get<K>(r[keys[y]])))
+							throw std::invalid_argument("static_multi_way_indexer: duplicated 2-way object");
+						perfect = false;
+					}
+				}
+			}
+
+			for (std::size_t size = max_size; size > 0 && perfect; --size)
+			{
+				for (std::size_t b = 0; b < bucket_count && perfect; ++b)
+				{
+					if (first[b + 1] - first[b] != size)
+						continue;
+
+					std::size_t d = 0;
+					for (; d < slot_count; ++d)
+					{
+						bool empty = true;
+						for (std::size_t x = first[b]; x < first[b + 1] && empty; ++x)
+							empty = h.slots[(position[keys[x]] + d) & (slot_count - 1)] == empty_slot;
+						if (empty)
+							break;
+					}
+
+					if (d == slot_count)
+					{
+						perfect = false;
+						break;
+					}
+
+					h.displacements[b] = static_cast<displacement_type>(d);
+					for (std::size_t x = first[b]; x < first[b + 1]; ++x)
+						h.slots[(position[keys[x]] + d) & (slot_count - 1)] = static_cast<slot_type>(keys[x]);
+				}
+			}
+
+			if (perfect)
+				return h;
+		}
+		throw std::logic_error("static_multi_way_indexer: no perfect hash found");
+	}
+
+	template<std::size_t... K>
+	static constexpr std::array<perfect_hash, sizeof...(TwoWay)> make_hashes(
+		std::initializer_list<row_type> rows,
+		std::index_sequence<K...>
+	)
+	{
+		return {{ make_hash<K>(rows)... }};
+	}
+
+	size_type _size;
+	columns_type _columns;
+	std::array<perfect_hash, sizeof...(TwoWay)> _hashes;
+};
+
+template<std::size_t N, class... TwoWay, class... OneWay>
+constexpr typename static_multi_way_indexer<N, std::tuple<TwoWay...>, std::tuple<OneWay...>>::size_type
+static_multi_way_indexer<N, std::tuple<TwoWay...>, std::tuple<OneWay...>>::npos;
+
+template<std::size_t N, class... TwoWay, class... OneWay>
+constexpr unsigned static_multi_way_indexer<N, std::tuple<TwoWay...>, std::tuple<OneWay...>>::slot_bits;
+
+template<std::size_t N, class... TwoWay, class... OneWay>
+constexpr typename static_multi_way_indexer<N, std::tuple<TwoWay...>, std::tuple<OneWay...>>::size_type
+static_multi_way_indexer<N, std::tuple<TwoWay...>, std::tuple<OneWay...>>::slot_count;
+
+template<std::size_t N, class... TwoWay, class... OneWay>
+constexpr unsigned static_multi_way_indexer<N, std::tuple<TwoWay...>, std::tuple<OneWay...>>::bucket_bits;
+
+template<std::size_t N, class... TwoWay, class... OneWay>
+constexpr typename static_multi_way_indexer<N, std::tuple<TwoWay...>, std::tuple<OneWay...>>::size_type
+static_multi_way_indexer<N, std::tuple<TwoWay...>, std::tuple<OneWay...>>::bucket_count;
+
+template<std::size_t N, class... TwoWay, class... OneWay>
+constexpr typename static_multi_way_indexer<N, std::tuple<TwoWay...>, std::tuple<OneWay...>>::slot_type
+static_multi_way_indexer<N, std::tuple<TwoWay...>, std::tuple<OneWay...>>::empty_slot;
+
+} // namespace map
+
+namespace types
+{
+
+template<class Value, std::size_t N>
+struct key_type<std::array<Value, N>>
+{
+	using type = Value;
+};
+
+} // namespace types
@@ -130,3 +130,168 @@ TEST(Enum, ext_rainbow)
   }
 }
 
+
+namespace parsed {
+
+struct red {};
+struct green { static constexpr int c() { return 5; } };
+struct blue {};
+
+using colours = enumerate::type<int8_t, red, green, blue>;
+
+} // namespace parsed
+
+TEST(Enum, parse)
+{
+  using namespace parsed;
+
+#ifdef TYPES_ENUM_STATIC_NAMES
+  static_assert(map::impl_::static_equal(enumerate::enum_::static_name<green>(), "green"), "");
+  EXPECT_EQ(enumerate::enum_::get_name<blue>(), std::string(enumerate::enum_::static_name<blue>()));
+#endif
+
+  colours c;
+  c.parse("green");
+  EXPECT_EQ(colours(green()), c);
+  EXPECT_EQ(5, c.index());
+  c.parse(std::string("blue"));
+  EXPECT_EQ(colours(blue()), c);
+  EXPECT_EQ("blue", c.name());
+  c.parse(map::string_view("red"));
+  EXPECT_EQ(colours(red()), c);
+
+  for (const char* s : {"", "gree", "greenx", "RED"})
+  {
+    c.parse(s);
+    EXPECT_EQ(colours(), c);
+  }
+}
+
+TEST(Enum, name)
+{
+  using namespace parsed;
+
+  const map::string_view name = colours(green()).name();
+  EXPECT_EQ("green", name);
+  EXPECT_EQ("red", colours(red()).name());
+  EXPECT_EQ("blue", colours(blue()).name());
+  EXPECT_EQ("<N/A>", colours().name());
+  EXPECT_EQ(name.data(), colours(green()).name().data());
+
+  std::string s;
+  EXPECT_TRUE(colours(red()).get_as_string(s, nullptr));
+  EXPECT_EQ("red", s);
+  EXPECT_FALSE(colours().get_as_string(s, nullptr));
+}
+
+namespace shapes {
+
+struct shape
+{
+  virtual ~shape() {}
+  virtual int sides() const = 0;
+};
+
+struct triangle : shape { int sides() const override { return 3; } };
+struct square : shape { int sides() const override { return 4; } };
+struct hexagon : shape
+{
+  static constexpr int c() { return 9; }
+  int sides() const override { return 6; }
+};
+
+using figures = enumerate::type_with_base<int, shape, 1, triangle, square, hexagon>;
+
+} // namespace shapes
+
+TEST(Enum, object_ptr)
+{
+  using namespace shapes;
+
+  EXPECT_EQ(3, figures(triangle()).object_ptr()->sides());
+  EXPECT_EQ(4, figures(square()).object_ptr()->sides());
+  EXPECT_EQ(6, figures(hexagon()).object_ptr()->sides());
+  EXPECT_EQ(nullptr, figures().object_ptr());
+
+  // one static object per value
+  EXPECT_EQ(figures(square()).object_ptr(), figures(square()).object_ptr());
+  figures f;
+  f.parse("hexagon");
+  EXPECT_EQ(figures(hexagon()).object_ptr(), f.object_ptr());
+}
+
+namespace codes {
+
+struct ok { static constexpr int c() { return 0; } };
+struct warning
+{
+  static constexpr std::pair<int, int> range() { return {10, 19}; }
+};
+struct error
+{
+  static constexpr std::pair<int, int> range() { return {30, 34}; }
+};
+
+using statuses = enumerate::ranged<int, ok, warning, error>;
+
+// too wide for the dense tables, the values are not in the code order
+struct server_error { static constexpr std::pair<int, int> range() { return {500, 599}; } };
+struct informational { static constexpr std::pair<int, int> range() { return {100, 199}; } };
+struct success { static constexpr std::pair<int, int> range() { return {200, 299}; } };
+struct client_error { static constexpr std::pair<int, int> range() { return {400, 499}; } };
+struct redirect { static constexpr std::pair<int, int> range() { return {300, 399}; } };
+
+using http_statuses = enumerate::ranged_with_base<
+  int, void, 100, server_error, informational, success, client_error, redirect
+>;
+
+} // namespace codes
+
+TEST(Enum, ranged)
+{
+  using namespace codes;
+
+  EXPECT_EQ(0, statuses(0).index());
+  EXPECT_EQ(10, statuses(10).index());
+  EXPECT_EQ(15, statuses(15).index());
+  EXPECT_EQ(19, statuses(19).index());
+  EXPECT_EQ(34, statuses(34).index());
+  EXPECT_EQ("warning", statuses(15).name());
+  EXPECT_EQ("error", statuses(30).name());
+  EXPECT_TRUE(statuses(12).in(19));
+  EXPECT_FALSE(statuses(12).in(30));
+
+  // parse gives the code, not the position of the value
+  statuses s;
+  s.parse(std::string("error"));
+  EXPECT_EQ(30, s.index());
+  s.parse(std::string("warning"));
+  EXPECT_EQ(10, s.index());
+
+  for (int i : {-1, 1, 9, 20, 29, 35, 1000})
+  {
+    EXPECT_EQ(statuses(), statuses(i)) << i;
+    EXPECT_EQ("<N/A>", statuses(i).name()) << i;
+  }
+}
+
+TEST(Enum, ranged_sparse)
+{
+  using namespace codes;
+
+  EXPECT_EQ(100, http_statuses(100).index());
+  EXPECT_EQ(250, http_statuses(250).index());
+  EXPECT_EQ(599, http_statuses(599).index());
+  EXPECT_EQ(400, http_statuses(404).range_first());
+  EXPECT_EQ("client_error", http_statuses(404).name());
+  EXPECT_EQ("server_error", http_statuses(500).name());
+  EXPECT_TRUE(http_statuses(301).in(399));
+  EXPECT_FALSE(http_statuses(301).in(400));
+  EXPECT_EQ(http_statuses(redirect()), http_statuses(302));
+
+  for (int i : {-1, 0, 99, 600, 1000})
+  {
+    EXPECT_EQ(http_statuses(), http_statuses(i)) << i;
+    EXPECT_EQ("<N/A>", http_statuses(i).name()) << i;
+  }
+}
@@ -0,0 +1,1350 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <iterator>
+#include <mutex>
+#include <numeric>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+#include "types/maps.h"
+#include "types/maps_image.h"
+#include "types/maps_static.h"
+#include "gtest/gtest.h"
+
+namespace symbols {
+
+using flat_table = map::multi_way_object_indexer::type<
+  map::flat_unordered_map,
+  map::deque,
+  int,
+  std::tuple<std::string, int>,
+  std::tuple<double>
+>;
+
+using shared_table = map::multi_way_object_indexer::thread_safe::type<
+  map::unordered_map,
+  map::deque,
+  int,
+  std::tuple<std::string, int>,
+  std::tuple<double>,
+  std::shared_timed_mutex
+>;
+
+using sharded_table = map::multi_way_object_indexer::sharded::type<
+  map::unordered_map,
+  map::deque,
+  int,
+  std::tuple<std::string, int>,
+  std::tuple<double>,
+  8
+>;
+
+// A mutex which records how many threads hold such mutexes at once. The
+// first lock of a thread waits a while for another thread to lock one too.
+class overlap_mutex
+{
+public:
+  void lock()
+  {
+    _m.lock();
+    if (_depth++ > 0)
+      return;
+
+    const int h = ++_holders;
+    int max = _max_holders.load();
+    while (h > max && !_max_holders.compare_exchange_weak(max, h))
+      ;
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(20);
+    while (_max_holders.load() < 2 && std::chrono::steady_clock::now() < deadline)
+      std::this_thread::yield();
+  }
+
+  void unlock()
+  {
+    if (--_depth == 0)
+      --_holders;
+    _m.unlock();
+  }
+
+  static int max_holders() { return _max_holders.load(); }
+
+private:
+  std::mutex _m;
+  static thread_local int _depth;
+  static std::atomic<int> _holders;
+  static std::atomic<int> _max_holders;
+};
+
+thread_local int overlap_mutex::_depth = 0;
+std::atomic<int> overlap_mutex::_holders{0};
+std::atomic<int> overlap_mutex::_max_holders{0};
+
+using sharded_overlap_table = map::multi_way_object_indexer::sharded::type<
+  map::unordered_map,
+  map::deque,
+  int,
+  std::tuple<std::string, int>,
+  std::tuple<double>,
+  8,
+  overlap_mutex
+>;
+
+template<class Key, class T>
+using flat_chunked_map = map::basic_flat_unordered_map<Key, T, map::chunked_vector>;
+
+using chunked_table = map::multi_way_object_indexer::type<
+  flat_chunked_map,
+  map::chunked_vector,
+  int,
+  std::tuple<std::string, int>,
+  std::tuple<double>
+>;
+
+using sorted_table = map::multi_way_object_indexer::type<
+  map::flat_map,
+  map::deque,
+  int,
+  std::tuple<std::string, int>,
+  std::tuple<double>
+>;
+
+template<class Key, class T>
+using flat_cow_map = map::basic_flat_unordered_map<Key, T, map::cow_chunked_vector>;
+
+using cow_table = map::multi_way_object_indexer::type<
+  flat_cow_map,
+  map::cow_chunked_vector,
+  int,
+  std::tuple<std::string, int>,
+  std::tuple<double>
+>;
+
+using shared_cow_table = map::multi_way_object_indexer::thread_safe::type<
+  flat_cow_map,
+  map::cow_chunked_vector,
+  int,
+  std::tuple<std::string, int>,
+  std::tuple<double>,
+  std::shared_timed_mutex
+>;
+
+using pod_table = map::multi_way_object_indexer::type<
+  map::unordered_map,
+  map::deque,
+  int,
+  std::tuple<int, long>,
+  std::tuple<double>
+>;
+
+} // namespace symbols
+
+TEST(Maps, flat_unordered_map)
+{
+  using namespace symbols;
+
+  flat_table t;
+  for (int i = 0; i < 1000; ++i)
+    t.push_back(std::make_tuple(std::to_string(i), i * 10, i / 2.0));
+
+  EXPECT_EQ(1000U, t.size());
+  for (int i = 0; i < 1000; ++i)
+  {
+    auto it = t.find(std::to_string(i));
+    ASSERT_TRUE(it != t.end());
+    EXPECT_EQ(i * 10, (*it).by_type<const int>());
+    EXPECT_TRUE(t.find(i * 10) == it);
+  }
+  EXPECT_TRUE(t.find(std::string("none")) == t.end());
+
+  t.erase(t.find(std::string("7")));
+  EXPECT_TRUE(t.find(std::string("7")) == t.end());
+  EXPECT_TRUE(t.find(70) == t.end());
+  EXPECT_TRUE(t.find(std::string("8")) != t.end());
+
+  t.push_in_hole(std::make_tuple(std::string("seven"), 7, 3.5));
+  EXPECT_EQ(7, (*t.find(std::string("seven"))).by_type<const int>());
+
+  // the copy is bound to its own columns
+  const flat_table& ct = t;
+  flat_table c = ct;
+  t.clear();
+  EXPECT_TRUE(t.find(std::string("seven")) == t.end());
+  EXPECT_EQ(7, (*c.find(std::string("seven"))).by_type<const int>());
+  EXPECT_EQ(990, (*c.find(std::string("99"))).by_type<const int>());
+}
+
+TEST(Maps, flat_unordered_map_grows_on_insert_only)
+{
+  using o2i_type = map::flat_unordered_map<std::reference_wrapper<const std::string>, int>;
+
+  o2i_type::column_type column;
+  o2i_type m;
+  map::bind_column(m, column);
+  for (int i = 0; i < 7; ++i)
+  {
+    column.push_back(std::to_string(i));
+    EXPECT_TRUE(m.emplace(std::cref(column[i]), i).second);
+  }
+
+  // the load threshold is reached, a hit doesn't rehash
+  const auto buckets = m.bucket_count();
+  EXPECT_FALSE(m.emplace(std::cref(column[3]), 3).second);
+  EXPECT_TRUE(m.find_position(std::string("5")).found);
+  EXPECT_EQ(buckets, m.bucket_count());
+
+  column.push_back("7");
+  EXPECT_TRUE(m.emplace(std::cref(column[7]), 7).second);
+  EXPECT_LT(buckets, m.bucket_count());
+  for (int i = 0; i < 8; ++i)
+    EXPECT_EQ(i, m.find(std::to_string(i))->second);
+}
+
+TEST(Maps, thread_safe_shared_reads)
+{
+  using namespace symbols;
+
+  shared_table t;
+  for (int i = 0; i < 100; ++i)
+    t.push_back(std::make_tuple(std::to_string(i), i, i / 2.0));
+
+  const shared_table& ct = t;
+  std::vector<std::thread> readers;
+  std::vector<int> found(4, 0);
+  for (int n = 0; n < 4; ++n)
+  {
+    readers.emplace_back([&ct, &found, n]() {
+      for (int i = 0; i < 100; ++i)
+        found[n] += ct[std::to_string(i)].by_type<const int>() == i;
+    });
+  }
+  t.update_or_insert(std::string("100"), 50.0);
+  for (auto& r : readers)
+    r.join();
+
+  for (int n = 0; n < 4; ++n)
+    EXPECT_EQ(100, found[n]);
+  EXPECT_EQ(50.0, ct.at(std::string("100")).by_type<const double>());
+
+  shared_table::shared_lock lock(t._mutex);
+  double sum = 0;
+  for (auto it = ct.begin(lock); it != ct.end(lock); ++it)
+    sum += (*it).by_type<const double>();
+  EXPECT_EQ(4950 / 2.0 + 50.0, sum);
+
+  // a shared lock gives only the const iterators, even of a non-const table
+  static_assert(
+    std::is_same<
+      decltype(t.find(std::string("1"), lock)),
+      shared_table::basic_const_iterator<shared_table::shared_lock>
+    >::value,
+    "a shared lock must not give a write access"
+  );
+  EXPECT_EQ(0.5, (*t.find(std::string("1"), lock)).by_type<const double>());
+}
+
+TEST(Maps, sharded_concurrent_inserts)
+{
+  using namespace symbols;
+
+  sharded_table t;
+  std::vector<std::thread> producers;
+  for (int n = 0; n < 4; ++n)
+  {
+    producers.emplace_back([&t, n]() {
+      for (int i = n; i < 1000; i += 4)
+        t.push_back(std::make_tuple(std::to_string(i), i, i / 2.0));
+    });
+  }
+  for (auto& p : producers)
+    p.join();
+
+  EXPECT_EQ(1000U, t.size());
+  for (int i = 0; i < 1000; ++i)
+  {
+    const auto idx = t.find(std::to_string(i));
+    EXPECT_EQ(i, std::get<int>(t[idx]));
+    EXPECT_EQ(idx, t.find(i));
+  }
+
+  const auto res = t.update_or_insert(std::string("10"), 0.25);
+  EXPECT_FALSE(res.second);
+  EXPECT_EQ(0.25, std::get<double>(t[res.first]));
+
+  t.erase(res.first);
+  EXPECT_TRUE(t[std::string("10")].is_no_value());
+  EXPECT_THROW(t.at(std::string("10")), std::out_of_range);
+}
+
+TEST(Maps, sharded_unique_secondary)
+{
+  using namespace symbols;
+
+  sharded_table t;
+  std::vector<std::thread> producers;
+  std::atomic<int> inserted{0};
+  for (int n = 0; n < 4; ++n)
+  {
+    // every thread inserts the same ints with other strings
+    producers.emplace_back([&t, &inserted, n]() {
+      for (int i = 0; i < 500; ++i)
+      {
+        const auto idx = t.push_back(std::make_tuple(std::to_string(n * 1000 + i), i, 0.0));
+        inserted += idx != sharded_table::index_marker_type{};
+      }
+    });
+  }
+  for (auto& p : producers)
+    p.join();
+
+  EXPECT_EQ(500, inserted.load());
+  EXPECT_EQ(500U, t.size());
+  for (int i = 0; i < 500; ++i)
+    EXPECT_EQ(i, std::get<int>(t[t.find(i)]));
+
+  // the string is new, the int is not
+  const auto none = sharded_table::index_marker_type{};
+  EXPECT_EQ(none, t.push_back(std::make_tuple(std::string("new"), 7, 0.0)));
+  EXPECT_TRUE(t[std::string("new")].is_no_value());
+
+  // the inserted row would have the int 0
+  const auto res = t.update_or_insert(std::string("new"), 0.5);
+  EXPECT_EQ(none, res.first);
+  EXPECT_FALSE(res.second);
+  EXPECT_EQ(500U, t.size());
+
+  t.erase(t.find(0));
+  EXPECT_TRUE(t.update_or_insert(std::string("new"), 0.5).second);
+  EXPECT_EQ(std::string("new"), std::get<std::string>(t[0]));
+}
+
+TEST(Maps, sharded_parallel_inserts_with_secondary)
+{
+  using namespace symbols;
+
+  // the int is a non-primary 2-way object, the inserts still lock only
+  // their shards (and the stripes of the ints)
+  sharded_overlap_table t;
+  std::vector<std::thread> producers;
+  for (int n = 0; n < 4; ++n)
+  {
+    producers.emplace_back([&t, n]() {
+      for (int i = n; i < 400; i += 4)
+        t.push_back(std::make_tuple(std::to_string(i), i, 0.0));
+    });
+  }
+  for (auto& p : producers)
+    p.join();
+
+  EXPECT_GE(overlap_mutex::max_holders(), 2);
+  EXPECT_EQ(400U, t.size());
+  EXPECT_EQ(
+    sharded_overlap_table::index_marker_type{},
+    t.push_back(std::make_tuple(std::string("new"), 7, 0.0))
+  );
+}
+
+TEST(Maps, sharded_index_space)
+{
+  // 128 global indexes at most
+  using small_sharded = map::multi_way_object_indexer::sharded::type<
+    map::unordered_map, map::deque, std::int8_t, std::tuple<int>, std::tuple<double>, 4
+  >;
+
+  small_sharded t;
+  std::vector<bool> used(128);
+  int full_key = -1;
+  for (int i = 0; i < 1000 && full_key < 0; ++i)
+  {
+    try
+    {
+      std::int8_t idx = -1;
+      ASSERT_TRUE(types::get_value(t.push_back(std::make_tuple(i, 0.0)), idx));
+      ASSERT_GE(idx, 0);
+      EXPECT_FALSE(used[idx]) << (int) idx;
+      used[idx] = true;
+    }
+    catch (const std::length_error&)
+    {
+      full_key = i;
+    }
+  }
+
+  ASSERT_GE(full_key, 0);
+  EXPECT_EQ(small_sharded::index_marker_type{}, t.find(full_key));
+  EXPECT_EQ((std::size_t) std::count(used.begin(), used.end(), true), t.size());
+  EXPECT_THROW(t.update_or_insert(full_key, 1.0), std::length_error);
+
+  // the rows of the full shard are still updated
+  int key = 0;
+  while (small_sharded::shard_of(key) != small_sharded::shard_of(full_key))
+    ++key;
+  EXPECT_FALSE(t.update_or_insert(key, 1.0).second);
+  EXPECT_EQ(1.0, std::get<double>(t[key]));
+}
+
+TEST(Maps, push_back_range)
+{
+  using namespace symbols;
+
+  std::vector<std::tuple<std::string, int, double>> rows;
+  for (int i = 0; i < 1000; ++i)
+    rows.emplace_back(std::to_string(i), i, i / 2.0);
+
+  flat_table t;
+  t.reserve(rows.size());
+  t.push_back(std::make_tuple(std::string("first"), -1, 0.0));
+  auto it = t.push_back_range(rows.begin(), rows.end());
+  EXPECT_EQ(1001U, t.size());
+  EXPECT_EQ(0, (*it).by_type<const int>());
+  EXPECT_EQ(-1, (*t.find(std::string("first"))).by_type<const int>());
+
+  flat_table p;
+  p.assign(
+    std::make_move_iterator(rows.begin()),
+    std::make_move_iterator(rows.end()),
+    std::launch::async
+  );
+  EXPECT_EQ(1000U, p.size());
+  for (int i = 0; i < 1000; ++i)
+  {
+    auto it = p.find(std::to_string(i));
+    ASSERT_TRUE(it != p.end());
+    EXPECT_EQ(i / 2.0, (*it).by_type<const double>());
+    EXPECT_TRUE(p.find(i) == it);
+  }
+}
+
+TEST(Maps, chunked_vector)
+{
+  using namespace symbols;
+
+  map::basic_chunked_vector<int, 4> v;
+  v.reserve(20);
+  EXPECT_EQ(32U, v.capacity());
+  const int* first = &v.emplace_back(0);
+  for (int i = 1; i < 100; ++i)
+    v.push_back(i);
+
+  EXPECT_EQ(first, &v[0]); // elements never move
+  EXPECT_EQ(7U, v.chunk_count());
+  EXPECT_EQ(4U, v.chunk_length(6));
+  EXPECT_EQ(96, v.chunk_data(6)[0]);
+  EXPECT_EQ(4950, std::accumulate(v.begin(), v.end(), 0));
+  EXPECT_THROW(v.at(100), std::out_of_range);
+
+  chunked_table t;
+  for (int i = 0; i < 5000; ++i)
+    t.push_back(std::make_tuple(std::to_string(i), i, i / 2.0));
+  EXPECT_EQ(4999, (*t.find(std::string("4999"))).by_type<const int>());
+  EXPECT_EQ(10.0, (*t.find(20)).by_type<const double>());
+
+  map::two_way_object_indexer::type<
+    std::string,
+    int,
+    std::unordered_map<std::string, int>,
+    map::chunked_vector<std::reference_wrapper<const std::string>>
+  > strings;
+  strings.push_back(std::string("a"));
+  strings.push_back(std::string("b"));
+  EXPECT_EQ(1, (*strings.find(std::string("b"))).first());
+}
+
+TEST(Maps, compact)
+{
+  using namespace symbols;
+
+  flat_table t;
+  for (int i = 0; i < 10; ++i)
+    t.push_back(std::make_tuple(std::to_string(i), i, i / 2.0));
+
+  t.erase(t.find(1));
+  t.erase(t.find(4));
+  t.erase(t.find(9));
+  EXPECT_EQ(3U, t.holes());
+
+  const auto remap = t.compact();
+  EXPECT_EQ(0U, t.holes());
+  EXPECT_EQ(7U, t.size());
+  ASSERT_EQ(10U, remap.size());
+  EXPECT_EQ(flat_table::index_marker_type{}, remap[1]);
+  EXPECT_EQ(flat_table::index_marker_type{}, remap[9]);
+  EXPECT_EQ(flat_table::index_marker_type{1}, remap[8]);
+  EXPECT_EQ(flat_table::index_marker_type{4}, remap[7]);
+  EXPECT_EQ(flat_table::index_marker_type{0}, remap[0]);
+
+  for (int i : {0, 2, 3, 5, 6, 7, 8})
+  {
+    auto it = t.find(std::to_string(i));
+    ASSERT_TRUE(it != t.end());
+    EXPECT_TRUE(t.find(i) == it);
+    EXPECT_EQ(remap[i], (*it).index());
+    EXPECT_EQ(i / 2.0, (*it).by_type<const double>());
+  }
+  EXPECT_TRUE(t.find(std::string("9")) == t.end());
+
+  t.push_back(std::make_tuple(std::string("new"), 100, 0.0));
+  EXPECT_EQ(flat_table::index_marker_type{7}, (*t.find(100)).index());
+}
+
+TEST(Maps, scan)
+{
+  using namespace symbols;
+
+  flat_table t;
+  chunked_table c;
+  for (int i = 0; i < 3000; ++i)
+  {
+    t.push_back(std::make_tuple(std::to_string(i), i, i / 2.0));
+    c.push_back(std::make_tuple(std::to_string(i), i, i / 2.0));
+  }
+  t.erase(t.find(10));
+  c.erase(c.find(10));
+
+  const auto cheap = [](double price) { return price < 100.0; };
+  const map::selection st = t.scan<double>(cheap);
+  const map::selection sc = c.scan<double>(cheap);
+  EXPECT_EQ(3000U, st.size());
+  EXPECT_EQ(199U, st.count());
+  EXPECT_FALSE(st.test(10));
+  EXPECT_TRUE(st.test(199));
+  EXPECT_FALSE(st.test(200));
+  EXPECT_EQ(st.indexes(), sc.indexes());
+
+  map::selection odd = c.scan<int>([](int q) { return q % 2 != 0; });
+  odd &= sc;
+  EXPECT_EQ(100U, odd.count());
+  const chunked_table& cc = c;
+  odd.for_each([&cc](std::size_t idx) {
+    EXPECT_EQ(1, cc[chunked_table::index_marker_type(idx)].by_type<const int>() % 2);
+  });
+
+  shared_table s;
+  for (int i = 0; i < 100; ++i)
+    s.push_back(std::make_tuple(std::to_string(i), i, i / 2.0));
+  EXPECT_EQ(50U, s.scan<int>([](int q) { return q >= 50; }).count());
+}
+
+TEST(Maps, flat_sorted_map)
+{
+  using namespace symbols;
+
+  sorted_table t;
+  for (int i = 0; i < 1000; ++i)
+  {
+    const int q = (i * 7919) % 1000; // shuffled
+    t.push_back(std::make_tuple(std::to_string(q), q, q / 2.0));
+    ASSERT_TRUE(t.find(q) != t.end()); // found in the delta
+  }
+  EXPECT_EQ(1000U, t.size());
+
+  auto first = t.lower_bound(100);
+  const auto last = t.upper_bound(199);
+  int expected = 100;
+  for (; first != last; ++first, ++expected)
+  {
+    EXPECT_EQ(expected, first->first.get());
+    EXPECT_EQ(expected, (*t.find(sorted_table::index_marker_type(first->second))).by_type<const int>());
+  }
+  EXPECT_EQ(200, expected);
+
+  t.erase(t.find(150));
+  EXPECT_TRUE(t.find(150) == t.end());
+  EXPECT_TRUE(t.find(std::string("150")) == t.end());
+  EXPECT_EQ(151, t.lower_bound(150)->first.get());
+
+  const auto range = t.equal_range(std::string("42"));
+  ASSERT_TRUE(range.first != range.second);
+  EXPECT_EQ("42", range.first->first.get());
+
+  const sorted_table& ct = t;
+  sorted_table c = ct;
+  t.clear();
+  EXPECT_EQ(998, c.lower_bound(998)->first.get());
+  EXPECT_EQ(21.0, (*c.find(std::string("42"))).by_type<const double>());
+}
+
+TEST(Maps, snapshot)
+{
+  using namespace symbols;
+
+  cow_table t;
+  for (int i = 0; i < 3000; ++i)
+    t.push_back(std::make_tuple(std::to_string(i), i, i / 2.0));
+
+  const cow_table& ct = t;
+  const auto s = ct.snapshot();
+  EXPECT_EQ(3000U, s->size());
+  // unchanged chunks are shared
+  EXPECT_EQ(&(*ct.begin()).by_type<const double>(), &(*s->begin()).by_type<const double>());
+
+  t.update_or_insert(std::string("0"), -1.0);
+  t.push_back(std::make_tuple(std::string("new"), 3000, 0.0));
+  EXPECT_EQ(-1.0, (*ct.begin()).by_type<const double>());
+  EXPECT_EQ(0.0, (*s->begin()).by_type<const double>());
+  EXPECT_EQ(3000U, s->size());
+  EXPECT_EQ(2999, (*s)[cow_table::index_marker_type(2999)].by_type<const int>());
+  EXPECT_TRUE((*s)[cow_table::index_marker_type(3000)].is_no_value());
+  EXPECT_EQ(3001U, t.size());
+  EXPECT_EQ(1U, s->scan<double>([](double v) { return v == 0.0; }).count());
+  EXPECT_TRUE(t.find(std::string("0")) != t.end());
+  EXPECT_EQ(1000, (*t.find(std::string("1000"))).by_type<const int>());
+
+  shared_cow_table st;
+  std::atomic<bool> done{false};
+  std::thread writer([&st, &done]() {
+    for (int i = 0; i < 5000; ++i)
+      st.push_back(std::make_tuple(std::to_string(i), i, i / 2.0));
+    done = true;
+  });
+
+  std::vector<std::thread> readers;
+  std::vector<int> errors(4, 0);
+  for (int n = 0; n < 4; ++n)
+  {
+    readers.emplace_back([&st, &done, &errors, n]() {
+      do
+      {
+        const auto snap = st.snapshot();
+        int expected = 0;
+        for (auto it = snap->begin(); it != snap->end(); ++it, ++expected)
+          errors[n] += (*it).by_type<const int>() != expected;
+        errors[n] += expected != (int) snap->size();
+      } while (!done);
+    });
+  }
+  writer.join();
+  for (auto& r : readers)
+    r.join();
+
+  for (int n = 0; n < 4; ++n)
+    EXPECT_EQ(0, errors[n]);
+  EXPECT_EQ(5000U, st.snapshot()->size());
+  EXPECT_EQ(st.snapshot(), st.snapshot()); // published once
+}
+
+TEST(Maps, snapshot_shared_lookups)
+{
+  using namespace symbols;
+
+  shared_cow_table st;
+  for (int i = 0; i < 2000; ++i)
+    st.push_back(std::make_tuple(std::to_string(i), i, i / 2.0));
+  const auto snap = st.snapshot(); // the chunks are shared now
+
+  // non-const lookups, each one may copy a chunk
+  std::vector<std::thread> readers;
+  std::vector<int> errors(4, 0);
+  for (int n = 0; n < 4; ++n)
+  {
+    readers.emplace_back([&st, &errors, n]() {
+      for (int i = n; i < 2000; i += 2)
+      {
+        errors[n] += st[std::to_string(i)].by_type<const int>() != i;
+        errors[n] += st.at(i).by_type<double>() != i / 2.0;
+      }
+      errors[n] += st.front().by_type<const int>() != 0;
+      errors[n] += st.back().by_type<const int>() != 1999;
+    });
+  }
+  for (auto& r : readers)
+    r.join();
+
+  for (int n = 0; n < 4; ++n)
+    EXPECT_EQ(0, errors[n]);
+  EXPECT_EQ(2000U, snap->size());
+}
+
+TEST(Maps, mapped_image)
+{
+  using namespace symbols;
+  using image = map::multi_way_object_indexer::mapped_image<pod_table>;
+
+  pod_table t;
+  for (int i = 0; i < 10000; ++i)
+    t.push_back(std::make_tuple(i, i * 100L, i / 2.0));
+  t.erase(t.find(7));
+
+  const std::string path = ::testing::TempDir() + "maps_image.bin";
+  map::multi_way_object_indexer::save_image(t, path);
+
+  const image img(path);
+  EXPECT_EQ(10000U, img.size());
+  for (int i = 0; i < 10000; i += 13)
+  {
+    if (i == 7)
+      continue;
+    const auto idx = img.find(i);
+    ASSERT_EQ((*t.find(i)).index(), idx);
+    EXPECT_EQ(idx, img.find(i * 100L));
+    EXPECT_EQ(i / 2.0, *img.find_object<double>(i));
+  }
+  EXPECT_EQ(pod_table::index_marker_type{}, img.find(7));
+  EXPECT_EQ(pod_table::index_marker_type{}, img.find(-1));
+  EXPECT_EQ(nullptr, img.find_object<double>(700L));
+  EXPECT_EQ(4999.5, img.column<double>()[9999]);
+
+  // a different table type
+  using other = map::multi_way_object_indexer::type<
+    map::unordered_map, map::deque, int, std::tuple<int>, std::tuple<double>
+  >;
+  EXPECT_THROW(map::multi_way_object_indexer::mapped_image<other>{path}, std::runtime_error);
+  std::remove(path.c_str());
+}
+
+TEST(Maps, image_view_validation)
+{
+  using namespace symbols;
+  using namespace map::multi_way_object_indexer;
+  using view = image_view<pod_table>;
+  using slot = image_slot<int>;
+
+  pod_table t;
+  for (int i = 0; i < 100; ++i)
+    t.push_back(std::make_tuple(i, i * 100L, i / 2.0));
+
+  std::ostringstream out;
+  write_image(t, out);
+  const std::string image = out.str();
+
+  // 8 byte aligned copies
+  std::vector<std::uint64_t> buf;
+  const auto copy = [&buf, &image]() {
+    buf.assign(image.size() / 8 + 1, 0);
+    std::memcpy(buf.data(), image.data(), image.size());
+    return reinterpret_cast<char*>(buf.data());
+  };
+  const auto index_section = [](char* data) {
+    return reinterpret_cast<image_section*>(data + sizeof(image_header)) + view::columns;
+  };
+  const auto slots = [&index_section](char* data) {
+    return reinterpret_cast<slot*>(data + index_section(data)->offset);
+  };
+
+  char* data = copy();
+  EXPECT_EQ(view::index_marker_type{42}, view(data, image.size()).find(42));
+
+  index_section(data)->bits = 0;
+  EXPECT_THROW(view(data, image.size()), std::runtime_error);
+
+  data = copy();
+  index_section(data)->bits -= 1;
+  EXPECT_THROW(view(data, image.size()), std::runtime_error);
+
+  data = copy();
+  for (slot* s = slots(data); ; ++s)
+  {
+    if (s->fragment != 0)
+    {
+      s->index = 100;
+      break;
+    }
+  }
+  EXPECT_THROW(view(data, image.size()), std::runtime_error);
+
+  data = copy();
+  for (std::uint64_t pos = 0; pos < index_section(data)->count; ++pos)
+    slots(data)[pos].fragment |= 1;
+  EXPECT_THROW(view(data, image.size()), std::runtime_error);
+}
+
+TEST(Maps, heterogeneous_find)
+{
+  using namespace symbols;
+  using ordered_table = map::multi_way_object_indexer::type<
+    map::map, map::deque, int, std::tuple<std::string, int>, std::tuple<double>
+  >;
+  using hashed_table = map::multi_way_object_indexer::type<
+    map::unordered_map, map::deque, int, std::tuple<std::string, int>, std::tuple<double>
+  >;
+
+  flat_table f;
+  sorted_table s;
+  ordered_table o;
+  hashed_table h;
+  for (int i = 0; i < 100; ++i)
+  {
+    f.push_back(std::make_tuple(std::to_string(i), i, i / 2.0));
+    s.push_back(std::make_tuple(std::to_string(i), i, i / 2.0));
+    o.push_back(std::make_tuple(std::to_string(i), i, i / 2.0));
+    h.push_back(std::make_tuple(std::to_string(i), i, i / 2.0));
+  }
+
+  const std::string buf = "42 and more";
+  const map::string_view key(buf.data(), 2);
+
+  EXPECT_EQ(42, (*f.find<std::string>("42")).by_type<const int>());
+  EXPECT_EQ(42, (*f.find<std::string>(key)).by_type<const int>());
+  EXPECT_TRUE(f.find<std::string>("100") == f.end());
+
+  EXPECT_EQ(42, (*s.find<std::string>("42")).by_type<const int>());
+  EXPECT_EQ(42, (*s.find<std::string>(key)).by_type<const int>());
+  EXPECT_TRUE(s.find<std::string>("100") == s.end());
+
+  const ordered_table& co = o;
+  EXPECT_EQ(42, (*co.find<std::string>("42")).by_type<const int>());
+  EXPECT_EQ(42, (*co.find<std::string>(key)).by_type<const int>());
+  EXPECT_TRUE(co.find<std::string>("100") == co.end());
+
+  // std::unordered_map constructs the key
+  EXPECT_EQ(42, (*h.find<std::string>("42")).by_type<const int>());
+  EXPECT_TRUE(h.find<std::string>("100") == h.end());
+}
+
+TEST(Maps, find_many)
+{
+  using namespace symbols;
+
+  flat_table f;
+  shared_table s;
+  map::two_way_object_indexer::type<
+    std::string,
+    int,
+    std::unordered_map<std::string, int>,
+    map::deque<std::reference_wrapper<const std::string>>
+  > strings;
+  for (int i = 0; i < 1000; ++i)
+  {
+    f.push_back(std::make_tuple(std::to_string(i), i, i / 2.0));
+    s.push_back(std::make_tuple(std::to_string(i), i, i / 2.0));
+    strings.push_back(std::to_string(i));
+  }
+  f.erase(f.find(7));
+
+  std::vector<int> keys;
+  std::vector<std::string> names;
+  for (int i = 0; i < 100; ++i)
+  {
+    keys.push_back((i * 7919) % 1100); // some are missing
+    names.push_back(std::to_string(keys.back()));
+  }
+
+  std::vector<flat_table::index_marker_type> fi, si, ni, wi;
+  f.find_many(keys.begin(), keys.end(), std::back_inserter(fi));
+  s.find_many(keys.begin(), keys.end(), std::back_inserter(si));
+  f.find_many(names.begin(), names.end(), std::back_inserter(ni));
+  strings.find_many(names.begin(), names.end(), std::back_inserter(wi));
+  ASSERT_EQ(keys.size(), fi.size());
+  ASSERT_EQ(keys.size(), si.size());
+  ASSERT_EQ(keys.size(), ni.size());
+  ASSERT_EQ(keys.size(), wi.size());
+
+  for (std::size_t i = 0; i < keys.size(); ++i)
+  {
+    const bool found = keys[i] < 1000;
+    const flat_table::index_marker_type idx = found ? flat_table::index_marker_type{keys[i]} : flat_table::index_marker_type{};
+    EXPECT_EQ(keys[i] == 7 ? flat_table::index_marker_type{} : idx, fi[i]);
+    EXPECT_EQ(keys[i] == 7 ? flat_table::index_marker_type{} : idx, ni[i]);
+    EXPECT_EQ(idx, si[i]);
+    EXPECT_EQ(idx, wi[i]);
+  }
+
+  flat_table empty;
+  fi.clear();
+  empty.find_many(keys.begin(), keys.begin() + 3, std::back_inserter(fi));
+  EXPECT_EQ(3U, std::count(fi.begin(), fi.end(), flat_table::index_marker_type{}));
+}
+
+TEST(Maps, stats)
+{
+  using namespace symbols;
+  using counted_table = map::multi_way_object_indexer::type<
+    map::flat_unordered_map,
+    map::deque,
+    int,
+    std::tuple<std::string, int>,
+    std::tuple<double>,
+    map::multi_way_object_indexer::count_stats
+  >;
+  using counted_shared_table = map::multi_way_object_indexer::thread_safe::type<
+    map::unordered_map,
+    map::deque,
+    int,
+    std::tuple<std::string, int>,
+    std::tuple<double>,
+    std::shared_timed_mutex,
+    map::multi_way_object_indexer::count_stats
+  >;
+
+  counted_table t;
+  counted_shared_table s;
+  for (int i = 0; i < 100; ++i)
+  {
+    t.push_back(std::make_tuple(std::to_string(i), i, i / 2.0));
+    s.push_back(std::make_tuple(std::to_string(i), i, i / 2.0));
+  }
+  t.erase(t.find(5));
+  t.reset_stats();
+  s.reset_stats();
+
+  for (int i = 0; i < 200; ++i)
+  {
+    t.find(i);
+    s[i];
+  }
+  t.find(std::string("7"));
+  t.find<std::string>("300");
+  const std::vector<int> keys = {1, 2, 500};
+  std::vector<counted_table::index_marker_type> found;
+  t.find_many(keys.begin(), keys.end(), std::back_inserter(found));
+
+  const auto ts = t.stats();
+  ASSERT_EQ(2U, ts.columns.size());
+  EXPECT_EQ(2U, ts.columns[0].lookups);
+  EXPECT_EQ(1U, ts.columns[0].hits);
+  EXPECT_EQ(1U, ts.columns[0].misses);
+  EXPECT_EQ(203U, ts.columns[1].lookups);
+  EXPECT_EQ(101U, ts.columns[1].hits);
+  EXPECT_EQ(102U, ts.columns[1].misses);
+  EXPECT_GE(ts.columns[1].average_probe_length(), 1.0);
+  EXPECT_EQ(1U, ts.erased);
+
+  const auto ss = s.stats();
+  EXPECT_EQ(200U, ss.columns[1].lookups);
+  EXPECT_EQ(100U, ss.columns[1].hits);
+  EXPECT_GE(ss.columns[1].probes, ss.columns[1].hits); // the bucket nodes
+  EXPECT_EQ(200U, ss.lock_acquisitions);
+  EXPECT_EQ(0U, ss.columns[0].lookups);
+
+  const auto none = flat_table().stats();
+  EXPECT_EQ(2U, none.columns.size());
+  EXPECT_EQ(0U, none.columns[1].lookups);
+  EXPECT_EQ(0U, none.lock_acquisitions);
+}
+
+TEST(Maps, try_emplace)
+{
+  using namespace symbols;
+  using ordered_table = map::multi_way_object_indexer::type<
+    map::map, map::deque, int, std::tuple<std::string, int>, std::tuple<double>
+  >;
+  using hashed_table = map::multi_way_object_indexer::type<
+    map::unordered_map, map::deque, int, std::tuple<std::string, int>, std::tuple<double>
+  >;
+
+  flat_table f;
+  sorted_table s;
+  ordered_table o;
+  hashed_table h;
+  for (int i = 0; i < 100; ++i)
+  {
+    const std::string key = std::to_string(i);
+    EXPECT_TRUE(f.try_emplace(key, i, i / 2.0).second);
+    EXPECT_TRUE(s.try_emplace(key, i, i / 2.0).second);
+    EXPECT_TRUE(o.try_emplace(key, i, i / 2.0).second);
+    EXPECT_TRUE(h.try_emplace(key, i).second); // the default double
+  }
+
+  // an existing row is not changed
+  const auto res = f.try_emplace(std::string("42"), 1000, 7.0);
+  EXPECT_FALSE(res.second);
+  EXPECT_EQ(42, (*res.first).by_type<const int>());
+  EXPECT_EQ(21.0, (*f.find(42)).by_type<const double>());
+  EXPECT_FALSE(o.try_emplace(std::string("0"), 5).second);
+  EXPECT_FALSE(s.try_emplace(std::string("99"), 5).second);
+
+  for (int i = 0; i < 100; ++i)
+  {
+    const std::string key = std::to_string(i);
+    EXPECT_EQ(i, (*f.find(key)).by_type<const int>());
+    EXPECT_EQ(i, (*s.find(key)).by_type<const int>());
+    EXPECT_EQ(i, (*o.find(key)).by_type<const int>());
+    EXPECT_EQ(i, (*h.find(key)).by_type<const int>());
+    EXPECT_EQ(key, (*f.find(i)).by_type<const std::string>());
+    EXPECT_EQ(0.0, (*h.find(i)).by_type<const double>());
+  }
+
+  // update_or_insert goes the same way
+  EXPECT_FALSE(o.update_or_insert(std::string("7"), 0.25).second);
+  EXPECT_EQ(0.25, (*o.find(7)).by_type<const double>());
+  EXPECT_TRUE(o.update_or_insert(std::string("x"), 0.5).second);
+  EXPECT_EQ(101U, o.size());
+
+  shared_table t;
+  EXPECT_TRUE(t.try_emplace(std::string("a"), 1, 1.0).second);
+  EXPECT_FALSE(t.try_emplace(std::string("a"), 2, 2.0).second);
+  EXPECT_EQ(1.0, t[std::string("a")].by_type<const double>());
+}
+
+TEST(Maps, vacuum)
+{
+  using namespace symbols;
+
+  flat_table t;
+  for (int i = 0; i < 10; ++i)
+    t.push_back(std::make_tuple(std::to_string(i), i, i / 2.0));
+
+  // the key stays indexed, the old row is superseded
+  EXPECT_FALSE(t.push_back_as_update(std::string("3"), 3, 1.0));
+  EXPECT_EQ(1.0, (*t.find(std::string("3"))).by_type<const double>());
+  EXPECT_EQ(11U, t.size());
+  EXPECT_EQ(1U, t.superseded());
+  EXPECT_EQ(1.5, (*t.find(flat_table::index_marker_type{3})).by_type<const double>());
+
+  auto pin = t.pin(flat_table::index_marker_type{3});
+  EXPECT_FALSE(t.push_back_as_update(std::string("4"), 40, 2.0));
+  EXPECT_EQ(1U, t.vacuum()); // the row of "4" only
+  EXPECT_EQ(1U, t.holes());
+  EXPECT_EQ(1.5, (*t.find(flat_table::index_marker_type{3})).by_type<const double>());
+  EXPECT_EQ(40, (*t.find(std::string("4"))).by_type<const int>());
+  EXPECT_TRUE(t.find(4) == t.end());
+
+  pin.release();
+  EXPECT_EQ(1U, t.vacuum());
+  EXPECT_EQ(0U, t.superseded());
+  EXPECT_EQ(2U, t.holes());
+
+  // rolling updates reuse the holes
+  t.set_auto_vacuum(true);
+  for (int round = 0; round < 100; ++round)
+    for (int i = 0; i < 10; ++i)
+      EXPECT_FALSE(t.push_back_as_update(std::to_string(i), 100 * round + 1000 + i, round * 1.0));
+  EXPECT_LE(t.size(), 14U);
+  for (int i = 0; i < 10; ++i)
+  {
+    EXPECT_EQ(99.0, (*t.find(std::to_string(i))).by_type<const double>());
+    EXPECT_EQ(std::to_string(i), (*t.find(10900 + i)).by_type<const std::string>());
+  }
+
+  t.vacuum();
+  t.compact();
+  EXPECT_EQ(10U, t.size());
+  EXPECT_EQ(0U, t.superseded());
+  for (int i = 0; i < 10; ++i)
+    EXPECT_EQ(99.0, (*t.find(std::to_string(i))).by_type<const double>());
+}
+
+TEST(Maps, compact_keeps_pinned_rows)
+{
+  using namespace symbols;
+
+  flat_table t;
+  for (int i = 0; i < 10; ++i)
+    t.push_back(std::make_tuple(std::to_string(i), i, i / 2.0));
+
+  // rows 3 and 10 are superseded, the key "3" is in row 11
+  EXPECT_FALSE(t.push_back_as_update(std::string("3"), 30, 1.0));
+  EXPECT_FALSE(t.push_back_as_update(std::string("3"), 300, 2.0));
+  auto pin = t.pin(flat_table::index_marker_type{10});
+
+  t.erase(t.find(std::string("0")));
+  t.erase(t.find(std::string("1")));
+  t.erase(t.find(flat_table::index_marker_type{3})); // superseded
+  EXPECT_EQ(1U, t.superseded());
+
+  // only row 11 is moved, to the hole 0
+  const auto remap = t.compact();
+  EXPECT_EQ(flat_table::index_marker_type{0}, remap[11]);
+  EXPECT_EQ(flat_table::index_marker_type{10}, remap[10]);
+  EXPECT_EQ(11U, t.size());
+  EXPECT_EQ(2U, t.holes());
+  EXPECT_EQ(300, (*t.find(std::string("3"))).by_type<const int>());
+
+  EXPECT_EQ(0U, t.vacuum());
+  EXPECT_EQ(30, (*t.find(flat_table::index_marker_type{10})).by_type<const int>());
+
+  pin.release();
+  EXPECT_EQ(1U, t.vacuum());
+  EXPECT_EQ(0U, t.superseded());
+}
+
+TEST(Maps, emplace_back_piecewise)
+{
+  using namespace symbols;
+
+  flat_table t;
+  const auto it = t.emplace_back(
+    std::piecewise_construct,
+    std::forward_as_tuple(3, 'a'),
+    std::forward_as_tuple(7),
+    std::make_tuple()
+  );
+  EXPECT_EQ("aaa", (*it).by_type<const std::string>());
+  EXPECT_EQ(7, (*t.find(std::string("aaa"))).by_type<const int>());
+  EXPECT_EQ(0.0, (*t.find(7)).by_type<const double>());
+
+  std::string moved(100, 'x');
+  t.emplace_back(std::piecewise_construct, std::forward_as_tuple(std::move(moved)), std::make_tuple(8), std::make_tuple(0.5));
+  EXPECT_EQ(0.5, (*t.find(std::string(100, 'x'))).by_type<const double>());
+  EXPECT_EQ(2U, t.size());
+
+  shared_table s;
+  s.emplace_back(std::piecewise_construct, std::make_tuple("abc"), std::make_tuple(1), std::make_tuple(2.0));
+  EXPECT_EQ(2.0, s[std::string("abc")].by_type<const double>());
+}
+
+namespace {
+
+class counting_resource : public map::pmr::memory_resource
+{
+public:
+  std::size_t allocated = 0;
+  std::size_t deallocated = 0;
+
+protected:
+  void* do_allocate(std::size_t bytes, std::size_t alignment) override
+  {
+    allocated += bytes;
+    return map::pmr::get_default_resource()->allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override
+  {
+    deallocated += bytes;
+    map::pmr::get_default_resource()->deallocate(p, bytes, alignment);
+  }
+
+  bool do_is_equal(const map::pmr::memory_resource& o) const noexcept override
+  {
+    return this == &o;
+  }
+};
+
+} // namespace
+
+TEST(Maps, pmr)
+{
+  using pmr_table = map::multi_way_object_indexer::type<
+    map::pmr::unordered_map,
+    map::pmr::deque,
+    int,
+    std::tuple<int>,
+    std::tuple<double>
+  >;
+  using pmr_ordered_table = map::multi_way_object_indexer::thread_safe::type<
+    map::pmr::map,
+    map::pmr::deque,
+    int,
+    std::tuple<int>,
+    std::tuple<double>
+  >;
+
+  counting_resource arena;
+  {
+    pmr_table t(std::allocator_arg, map::pmr::polymorphic_allocator<char>(&arena));
+    for (int i = 0; i < 1000; ++i)
+      t.push_back(std::make_tuple(i, i / 2.0));
+    EXPECT_GT(arena.allocated, 1000 * (sizeof(int) + sizeof(double)));
+    EXPECT_EQ(250.0, (*t.find(500)).by_type<const double>());
+
+    const std::size_t before = arena.allocated;
+    pmr_ordered_table o(std::allocator_arg, map::pmr::polymorphic_allocator<char>(&arena));
+    o.push_back(std::make_tuple(1, 2.0));
+    EXPECT_GT(arena.allocated, before);
+    EXPECT_EQ(2.0, o[1].by_type<const double>());
+  }
+  EXPECT_EQ(arena.allocated, arena.deallocated);
+}
+
+TEST(Maps, pmr_move_between_resources)
+{
+  using pmr_table = map::multi_way_object_indexer::type<
+    map::pmr::unordered_map,
+    map::pmr::deque,
+    int,
+    std::tuple<std::string, int>,
+    std::tuple<double>
+  >;
+  using pmr_shared_table = map::multi_way_object_indexer::thread_safe::type<
+    map::pmr::unordered_map,
+    map::pmr::deque,
+    int,
+    std::tuple<std::string>,
+    std::tuple<double>
+  >;
+  const auto key = [](int i) {
+    return std::string(40, 'f') + std::to_string(i); // not a short string
+  };
+
+  counting_resource ra, rb;
+  pmr_table a(std::allocator_arg, map::pmr::polymorphic_allocator<char>(&ra));
+  a.push_back(std::make_tuple(key(-1), -1, 0.0));
+  {
+    pmr_table b(std::allocator_arg, map::pmr::polymorphic_allocator<char>(&rb));
+    for (int i = 0; i < 100; ++i)
+      b.push_back(std::make_tuple(key(i), i, i / 2.0));
+    b.erase(b.find(7));
+
+    a = std::move(b);
+  }
+  ASSERT_EQ(100U, a.size());
+  EXPECT_EQ(5, (*a.find(key(5))).by_type<const int>());
+  EXPECT_TRUE(a.find(key(5)) == a.find(5));
+  EXPECT_TRUE(a.find(key(7)) == a.end());
+  EXPECT_TRUE(a.find(key(-1)) == a.end());
+
+  pmr_table c(std::allocator_arg, map::pmr::polymorphic_allocator<char>(&rb));
+  c.push_back(std::make_tuple(key(-1), -1, 0.0));
+  a.swap(c);
+  EXPECT_EQ(1U, a.size());
+  EXPECT_EQ(-1, (*a.find(key(-1))).by_type<const int>());
+  EXPECT_EQ(49.5, (*c.find(key(99))).by_type<const double>());
+  EXPECT_TRUE(c.find(key(-1)) == c.end());
+
+  pmr_shared_table s(std::allocator_arg, map::pmr::polymorphic_allocator<char>(&ra));
+  pmr_shared_table z(std::allocator_arg, map::pmr::polymorphic_allocator<char>(&rb));
+  s.push_back(std::make_tuple(key(1), 1.0));
+  z.push_back(std::make_tuple(key(2), 2.0));
+  s.swap(z);
+  EXPECT_EQ(2.0, s[key(2)].by_type<const double>());
+  EXPECT_EQ(1.0, z[key(1)].by_type<const double>());
+  EXPECT_TRUE(s[key(1)].is_no_value());
+}
+
+namespace {
+
+enum class color { red, green, blue };
+
+using static_table = map::static_multi_way_indexer<
+  4,
+  std::tuple<int, const char*, color>,
+  std::tuple<double>
+>;
+
+constexpr static_table static_colors{
+  std::make_tuple(10, "red", color::red, 0.1),
+  std::make_tuple(20, "green", color::green, 0.2),
+  std::make_tuple(30, "blue", color::blue, 0.3)
+};
+
+static_assert(static_colors.find(20) == 1, "");
+static_assert(static_colors.find(color::blue) == 2, "");
+static_assert(static_colors.find<const char*>("red") == 0, "");
+static_assert(static_colors.find(25) == static_table::npos, "");
+static_assert(*static_colors.find_object<color>(30) == color::blue, "");
+
+using big_static_table = map::static_multi_way_indexer<600, std::tuple<int>, std::tuple<double>>;
+
+template<std::size_t... I>
+constexpr big_static_table make_big_static_table(std::index_sequence<I...>)
+{
+  return big_static_table{std::make_tuple(int(I * 7919 % 100003), I / 2.0)...};
+}
+
+constexpr big_static_table big_static = make_big_static_table(std::make_index_sequence<600>());
+
+// O(N) slots
+static_assert(big_static_table::slot_count <= 2 * 600, "");
+static_assert(big_static.find(599 * 7919 % 100003) == 599, "");
+
+} // namespace
+
+TEST(Maps, static_multi_way_indexer)
+{
+  EXPECT_EQ(3u, static_colors.size());
+  EXPECT_EQ(4u, static_colors.capacity());
+
+  for (int i = 0; i < 40; ++i)
+  {
+    const auto idx = static_colors.find(i);
+    if (i % 10 == 0 && i > 0)
+    {
+      ASSERT_EQ(std::size_t(i / 10 - 1), idx);
+      EXPECT_EQ(i, static_colors.get<int>(idx));
+    }
+    else
+      EXPECT_EQ(static_table::npos, idx);
+  }
+
+  const std::string green = "green";
+  EXPECT_EQ(1u, static_colors.find<const char*>(map::string_view(green)));
+  EXPECT_EQ(0.2, *static_colors.find_object<double>(green.c_str()));
+  EXPECT_EQ(nullptr, static_colors.find_object<double>("yellow"));
+  EXPECT_EQ(static_table::npos, static_colors.find<const char*>(map::string_view("gree")));
+
+  for (int i = 0; i < 600; ++i)
+    EXPECT_EQ(std::size_t(i), big_static.find(i * 7919 % 100003));
+  EXPECT_EQ(big_static_table::npos, big_static.find(1));
+}
+
+TEST(Maps, string_interner)
+{
+  map::two_way_object_indexer::basic_string_interner<std::uint32_t, 64> strings;
+
+  const std::string long_string(100, 'x');
+  EXPECT_EQ(0u, strings.get_or_insert("alpha"));
+  EXPECT_EQ(1u, strings.get_or_insert(std::string("beta")));
+  EXPECT_EQ(2u, strings.get_or_insert(""));
+  EXPECT_EQ(3u, strings.get_or_insert(long_string));
+  for (int i = 0; i < 100; ++i)
+    EXPECT_EQ(std::uint32_t(4 + i), strings.get_or_insert(std::to_string(i)));
+
+  const std::size_t bytes = strings.bytes();
+  const std::size_t arena = strings.arena_bytes();
+  EXPECT_EQ(1u, strings.get_or_insert(std::string("beta")));
+  EXPECT_EQ(0u, strings.get_or_insert(map::string_view("alphabet", 5)));
+  EXPECT_EQ(bytes, strings.bytes());
+  EXPECT_EQ(arena, strings.arena_bytes());
+  EXPECT_EQ(104u, strings.size());
+
+  EXPECT_EQ(decltype(strings)::index_marker_type{3}, strings.find(long_string));
+  EXPECT_EQ(decltype(strings)::index_marker_type{}, strings.find("gamma"));
+  EXPECT_EQ("99", strings[103]);
+  EXPECT_EQ(long_string, strings.at(3));
+  EXPECT_THROW(strings.at(104), std::out_of_range);
+
+  // the copy and the moved interner keep the indexes
+  const auto& cs = strings;
+  auto copy = cs;
+  auto moved = std::move(strings);
+  for (std::uint32_t i = 0; i < 104; ++i)
+  {
+    EXPECT_EQ(moved[i], copy[i]);
+    EXPECT_EQ(decltype(copy)::index_marker_type{i}, copy.find(moved[i]));
+    EXPECT_EQ(decltype(moved)::index_marker_type{i}, moved.find(copy[i]));
+  }
+  EXPECT_TRUE(std::equal(copy.begin(), copy.end(), moved.begin()));
+
+  copy.clear();
+  EXPECT_TRUE(copy.empty());
+  EXPECT_EQ(0u, copy.get_or_insert("beta"));
+}
+
+TEST(Maps, concurrent_string_interner)
+{
+  map::two_way_object_indexer::basic_concurrent_string_interner<std::uint32_t, 256, 4> strings;
+
+  const int n = 5000;
+  const int threads = 4;
+  std::vector<std::vector<std::uint32_t>> ids(threads, std::vector<std::uint32_t>(n));
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; ++t)
+  {
+    workers.emplace_back([&strings, &ids, t]() {
+      // the threads insert the same strings in different orders
+      for (int i = 0; i < n; ++i)
+      {
+        const int k = (t % 2 == 0) ? i : n - 1 - i;
+        ids[t][k] = strings.get_or_insert(std::to_string(k));
+        EXPECT_EQ(std::to_string(k), strings[ids[t][k]]);
+      }
+    });
+  }
+  for (auto& w : workers)
+    w.join();
+
+  EXPECT_EQ(std::size_t(n), strings.size());
+  std::vector<bool> seen(n, false);
+  for (int k = 0; k < n; ++k)
+  {
+    for (int t = 1; t < threads; ++t)
+      ASSERT_EQ(ids[0][k], ids[t][k]);
+    ASSERT_LT(ids[0][k], std::uint32_t(n));
+    EXPECT_FALSE(seen[ids[0][k]]);
+    seen[ids[0][k]] = true;
+    EXPECT_EQ(decltype(strings)::index_marker_type{ids[0][k]}, strings.find(std::to_string(k)));
+  }
+  EXPECT_EQ(decltype(strings)::index_marker_type{}, strings.find("none"));
+
+  const std::size_t bytes = strings.bytes();
+  EXPECT_EQ(ids[0][7], strings.get_or_insert("7"));
+  EXPECT_EQ(bytes, strings.bytes());
+  EXPECT_EQ(std::uint32_t(n), strings.get_or_insert(""));
+  EXPECT_EQ("", strings[std::uint32_t(n)]);
+}
@@ -0,0 +1,116 @@
+// Read contention benchmark for multi_way_object_indexer::thread_safe::type.
+// Compares the exclusive (std::mutex) and the shared (std::shared_timed_mutex)
+// lookup modes by the read throughput with different number of threads.
+//
+// usage: maps_bench [rows] [lookups per thread]
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+#include "types/maps.h"
+
+namespace bench {
+
+template<class Mutex>
+using table = map::multi_way_object_indexer::thread_safe::type<
+  map::unordered_map,
+  map::deque,
+  int,
+  std::tuple<std::string, int>,
+  std::tuple<double>,
+  Mutex
+>;
+
+template<class Table>
+void fill(Table& t, int rows)
+{
+  for (int i = 0; i < rows; ++i)
+    t.push_back(std::make_tuple(std::to_string(i), i, i * 0.5));
+}
+
+// returns lookups per second (all threads)
+template<class Table>
+double read_contention(const Table& t, int rows, int threads, int lookups)
+{
+  std::vector<std::string> keys;
+  keys.reserve(rows);
+  for (int i = 0; i < rows; ++i)
+    keys.push_back(std::to_string(i));
+
+  std::atomic<int> ready{0};
+  std::atomic<bool> go{false};
+  std::atomic<long> found{0};
+
+  std::vector<std::thread> workers;
+  for (int n = 0; n < threads; ++n)
+  {
+    workers.emplace_back([&, n]() {
+      long f = 0;
+      unsigned k = n * 7919u;
+      ++ready;
+      while (!go)
+        std::this_thread::yield();
+
+      for (int i = 0; i < lookups; ++i)
+      {
+        k = k * 1103515245u + 12345u;
+        const auto& key = keys[(k >> 8) % rows];
+        f += !t[key].is_no_value();
+      }
+      found += f;
+    });
+  }
+
+  while (ready < threads)
+    std::this_thread::yield();
+
+  const auto start = std::chrono::steady_clock::now();
+  go = true;
+  for (auto& w : workers)
+    w.join();
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  if (found != (long) threads * lookups)
+    std::cerr << "lookup failures: " << (long) threads * lookups - found << std::endl;
+
+  return threads * (double) lookups / elapsed.count();
+}
+
+} // namespace bench
+
+int main(int argc, char* argv[])
+{
+  using namespace bench;
+
+  const int rows = (argc > 1) ? std::atoi(argv[1]) : 100000;
+  const int lookups = (argc > 2) ? std::atoi(argv[2]) : 1000000;
+
+  table<std::mutex> exclusive;
+  table<std::shared_timed_mutex> shared;
+  fill(exclusive, rows);
+  fill(shared, rows);
+
+  std::cout << "rows: " << rows << ", lookups per thread: " << lookups << std::endl;
+  std::cout << std::setw(8) << "threads"
+    << std::setw(20) << "mutex, Mops/s"
+    << std::setw(20) << "shared, Mops/s" << std::endl;
+
+  const int max_threads = 32;
+  for (int threads = 1; threads <= max_threads; threads *= 2)
+  {
+    std::cout << std::setw(8) << threads
+      << std::setw(20) << std::fixed << std::setprecision(2)
+      << read_contention(exclusive, rows, threads, lookups) / 1e6
+      << std::setw(20)
+      << read_contention(shared, rows, threads, lookups) / 1e6
+      << std::endl;
+  }
+}
@@ -0,0 +1,355 @@
+// Baseline benchmark of the maps.h indexers: two_way_object_indexer::type,
+// multi_way_object_indexer::type (node and flat hash maps) and
+// thread_safe::type. Measures push_back, find by every 2-way column, find
+// by an index marker, full iteration, erase + push_in_hole,
+// update_or_insert and the read throughput with concurrent readers (with
+// and without a writer) for the row counts 1e2, 1e3, ... max rows.
+//
+// usage: maps_ops_bench [max rows] [max threads]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include "types/maps.h"
+
+namespace bench {
+
+using two_way_table = map::two_way_object_indexer::type<
+  int,
+  int,
+  std::unordered_map<int, int>,
+  std::deque<std::reference_wrapper<const int>>
+>;
+
+template<template<class, class> class Object2Index>
+using multi_way_table = map::multi_way_object_indexer::type<
+  Object2Index,
+  map::deque,
+  int,
+  std::tuple<std::string, int>,
+  std::tuple<double>
+>;
+
+using thread_safe_table = map::multi_way_object_indexer::thread_safe::type<
+  map::unordered_map,
+  map::deque,
+  int,
+  std::tuple<std::string, int>,
+  std::tuple<double>,
+  std::shared_timed_mutex
+>;
+
+// the minimal number of operations per measurement
+const long min_ops = 1000000;
+
+// keeps the results alive
+std::atomic<long> sink{0};
+
+struct keys
+{
+  std::vector<std::string> strings;
+  std::vector<int> ints;
+  std::vector<int> order; // random row numbers, min_ops at least
+
+  explicit keys(int rows)
+  {
+    strings.reserve(rows);
+    ints.reserve(rows);
+    for (int i = 0; i < rows; ++i)
+    {
+      strings.push_back(std::to_string(i));
+      ints.push_back(i * 7);
+    }
+
+    const long n = std::max<long>(rows, min_ops);
+    order.reserve(n);
+    unsigned k = 12345u;
+    for (long i = 0; i < n; ++i)
+    {
+      k = k * 1103515245u + 12345u;
+      order.push_back((k >> 8) % rows);
+    }
+  }
+};
+
+template<class F>
+double ns_per_op(long ops, F&& f)
+{
+  const auto start = std::chrono::steady_clock::now();
+  f();
+  const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / ops;
+}
+
+void report(const char* table, const char* op, int rows, double ns)
+{
+  std::cout << std::setw(12) << table
+    << std::setw(24) << op
+    << std::setw(10) << rows
+    << std::setw(12) << std::fixed << std::setprecision(1) << ns << std::endl;
+}
+
+// the number of tables to build to have min_ops rows in total
+long repetitions(int rows)
+{
+  return std::max<long>(1, min_ops / rows);
+}
+
+template<class Table>
+void fill(Table& t, const keys& k)
+{
+  for (std::size_t i = 0; i < k.ints.size(); ++i)
+    t.push_back(std::make_tuple(k.strings[i], k.ints[i], i * 0.5));
+}
+
+void two_way_suite(const keys& k)
+{
+  const int rows = k.ints.size();
+  const long reps = repetitions(rows);
+
+  std::vector<std::unique_ptr<two_way_table>> tables;
+  for (long r = 0; r < reps; ++r)
+    tables.emplace_back(new two_way_table);
+  report("two_way", "push_back", rows, ns_per_op(reps * rows, [&]() {
+    for (auto& t : tables)
+      for (int v : k.ints)
+        t->push_back(v);
+  }));
+  tables.resize(1);
+  const two_way_table& t = *tables.front();
+
+  const long n = k.order.size();
+  report("two_way", "find(object)", rows, ns_per_op(n, [&]() {
+    long f = 0;
+    for (int i : k.order)
+      f += t.find(k.ints[i]) != t.end();
+    sink += f;
+  }));
+
+  report("two_way", "find(index marker)", rows, ns_per_op(n, [&]() {
+    long f = 0;
+    for (int i : k.order)
+      f += t.find(two_way_table::value_type::first_type{i}) != t.end();
+    sink += f;
+  }));
+
+  report("two_way", "iteration", rows, ns_per_op(reps * rows, [&]() {
+    long s = 0;
+    for (long r = 0; r < reps; ++r)
+      for (auto v : t)
+        s += v.second();
+    sink += s;
+  }));
+}
+
+template<class Table>
+void multi_way_suite(const char* name, const keys& k)
+{
+  const int rows = k.ints.size();
+  const long reps = repetitions(rows);
+
+  std::vector<std::unique_ptr<Table>> tables;
+  for (long r = 0; r < reps; ++r)
+    tables.emplace_back(new Table);
+  report(name, "push_back", rows, ns_per_op(reps * rows, [&]() {
+    for (auto& t : tables)
+      fill(*t, k);
+  }));
+  tables.resize(1);
+  Table& t = *tables.front();
+  const Table& ct = t;
+
+  const long n = k.order.size();
+  report(name, "find(std::string)", rows, ns_per_op(n, [&]() {
+    long f = 0;
+    for (int i : k.order)
+      f += ct.find(k.strings[i]) != ct.end();
+    sink += f;
+  }));
+
+  report(name, "find(int)", rows, ns_per_op(n, [&]() {
+    long f = 0;
+    for (int i : k.order)
+      f += ct.find(k.ints[i]) != ct.end();
+    sink += f;
+  }));
+
+  report(name, "find(index marker)", rows, ns_per_op(n, [&]() {
+    long f = 0;
+    for (int i : k.order)
+      f += ct.find(typename Table::index_marker_type{i}) != ct.end();
+    sink += f;
+  }));
+
+  report(name, "iteration", rows, ns_per_op(reps * rows, [&]() {
+    double s = 0;
+    for (long r = 0; r < reps; ++r)
+      for (auto row : ct)
+        s += row.template by_type<const double>();
+    sink += (long) s;
+  }));
+
+  report(name, "update_or_insert", rows, ns_per_op(n, [&]() {
+    for (long i = 0; i < n; ++i)
+      t.update_or_insert(k.strings[k.order[i]], i * 0.25);
+  }));
+
+  report(name, "erase + push_in_hole", rows, ns_per_op(n, [&]() {
+    for (int i : k.order)
+    {
+      t.erase(t.find(k.ints[i]));
+      t.push_in_hole(std::make_tuple(k.strings[i], k.ints[i], 0.0));
+    }
+  }));
+}
+
+// returns reads per second (all readers)
+double contention(thread_safe_table& t, const keys& k, int readers, bool writer)
+{
+  const thread_safe_table& ct = t;
+  const long lookups = k.order.size();
+  std::atomic<int> ready{0};
+  std::atomic<bool> go{false};
+  std::atomic<bool> done{false};
+
+  std::vector<std::thread> workers;
+  for (int r = 0; r < readers; ++r)
+  {
+    workers.emplace_back([&, r]() {
+      long f = 0;
+      ++ready;
+      while (!go)
+        std::this_thread::yield();
+
+      for (long i = 0; i < lookups; ++i)
+        f += !ct[k.strings[k.order[(i + r * 7919) % lookups]]].is_no_value();
+      sink += f;
+    });
+  }
+
+  std::thread w;
+  if (writer)
+  {
+    w = std::thread([&]() {
+      for (long i = 0; !done; ++i)
+        t.update_or_insert(k.strings[k.order[i % lookups]], i * 0.25);
+    });
+  }
+
+  while (ready < readers)
+    std::this_thread::yield();
+
+  const auto start = std::chrono::steady_clock::now();
+  go = true;
+  for (auto& r : workers)
+    r.join();
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  done = true;
+  if (w.joinable())
+    w.join();
+
+  return readers * (double) lookups / elapsed.count();
+}
+
+void thread_safe_suite(const keys& k, int max_threads)
+{
+  const int rows = k.ints.size();
+  const long reps = repetitions(rows);
+
+  std::vector<std::unique_ptr<thread_safe_table>> tables;
+  for (long r = 0; r < reps; ++r)
+    tables.emplace_back(new thread_safe_table);
+  report("thread_safe", "push_back", rows, ns_per_op(reps * rows, [&]() {
+    for (auto& t : tables)
+      fill(*t, k);
+  }));
+  tables.resize(1);
+  thread_safe_table& t = *tables.front();
+  const thread_safe_table& ct = t;
+
+  const long n = k.order.size();
+  report("thread_safe", "[std::string]", rows, ns_per_op(n, [&]() {
+    long f = 0;
+    for (int i : k.order)
+      f += !ct[k.strings[i]].is_no_value();
+    sink += f;
+  }));
+
+  report("thread_safe", "[int]", rows, ns_per_op(n, [&]() {
+    long f = 0;
+    for (int i : k.order)
+      f += !ct[k.ints[i]].is_no_value();
+    sink += f;
+  }));
+
+  report("thread_safe", "find(index marker)", rows, ns_per_op(n, [&]() {
+    thread_safe_table::read_lock lock(t._mutex);
+    long f = 0;
+    for (int i : k.order)
+      f += ct.find(thread_safe_table::index_marker_type{i}, lock) != ct.end(lock);
+    sink += f;
+  }));
+
+  report("thread_safe", "iteration", rows, ns_per_op(reps * rows, [&]() {
+    thread_safe_table::read_lock lock(t._mutex);
+    double s = 0;
+    for (long r = 0; r < reps; ++r)
+      for (auto it = ct.begin(lock); it != ct.end(lock); ++it)
+        s += (*it).by_type<const double>();
+    sink += (long) s;
+  }));
+
+  report("thread_safe", "update_or_insert", rows, ns_per_op(n, [&]() {
+    for (long i = 0; i < n; ++i)
+      t.update_or_insert(k.strings[k.order[i]], i * 0.25);
+  }));
+
+  for (int readers = 1; readers <= max_threads; readers *= 2)
+  {
+    for (bool writer : {false, true})
+    {
+      const std::string op = std::to_string(readers) + (writer ? " readers + writer" : " readers");
+      report("thread_safe", op.c_str(), rows, 1e9 / contention(t, k, readers, writer));
+    }
+  }
+}
+
+} // namespace bench
+
+int main(int argc, char* argv[])
+{
+  using namespace bench;
+
+  const int max_rows = (argc > 1) ? std::atoi(argv[1]) : 1000000;
+  const int max_threads = (argc > 2)
+    ? std::atoi(argv[2])
+    : std::max(1u, std::thread::hardware_concurrency());
+
+  std::cout << "ns per operation (per read for the contention rows)" << std::endl;
+  std::cout << std::setw(12) << "table"
+    << std::setw(24) << "operation"
+    << std::setw(10) << "rows"
+    << std::setw(12) << "ns/op" << std::endl;
+
+  for (long rows = 100; rows <= max_rows; rows *= 10)
+  {
+    const keys k(rows);
+    two_way_suite(k);
+    multi_way_suite<multi_way_table<map::unordered_map>>("multi_way", k);
+    multi_way_suite<multi_way_table<map::flat_unordered_map>>("flat", k);
+    thread_safe_suite(k, max_threads);
+  }
+}